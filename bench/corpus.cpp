@@ -0,0 +1,259 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#include "corpus.h"
+
+#include "elf.h"
+#include "psp.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+namespace
+{
+    // SceModuleInfo on the PSP
+    const size_t MODINFO_SIZE = 52;
+    
+    const char SECTION_NAMES[] = "\0.text\0.rodata.sceModuleInfo\0.data\0.bss\0.rel.text\0.shstrtab";
+    
+    // offset of 'name' in SECTION_NAMES
+    u32 sectionName(const char *name)
+    {
+        for (u32 i = 1; i < sizeof(SECTION_NAMES); i += std::strlen(SECTION_NAMES + i) + 1)
+        {
+            if (std::strcmp(SECTION_NAMES + i, name) == 0)
+            {
+                return i;
+            }
+        }
+        
+        return 0;
+    }
+    
+    template <typename T> void append(std::vector<char>& out, const T& value)
+    {
+        auto bytes = (const char *)&value;
+        out.insert(out.end(), bytes, bytes + sizeof(T));
+    }
+    
+    void align(std::vector<char>& out, size_t alignment)
+    {
+        out.resize((out.size() + alignment - 1) & ~(alignment - 1));
+    }
+    
+    // compiled MIPS repeats a small set of instruction shapes with varying
+    // registers and immediates, which is what deflate gets to work with
+    void makeText(std::vector<char>& out, size_t size, std::mt19937& rng)
+    {
+        std::vector<u32> common(96);
+        
+        for (auto& word : common)
+        {
+            word = rng();
+        }
+        
+        for (size_t i = 0; i < size; i += 4)
+        {
+            auto word = (u32)((rng() % 10 < 7) ? (common[rng() % common.size()]) : (rng() & 0x03E0FFFF));
+            append(out, word);
+        }
+    }
+    
+    // tables and strings, mostly small values
+    void makeData(std::vector<char>& out, size_t size, std::mt19937& rng)
+    {
+        for (size_t i = 0; i < size; ++i)
+        {
+            out.push_back((rng() % 4 == 0) ? ('a' + rng() % 26) : (char)(rng() & 0x0F));
+        }
+    }
+    
+    Elf32_Shdr section(u32 name, u32 type, u32 flags, u32 addr, u32 offset, u32 size, u32 alignment)
+    {
+        Elf32_Shdr shdr;
+        std::memset(&shdr, 0, sizeof(shdr));
+        shdr.sh_name = name;
+        shdr.sh_type = type;
+        shdr.sh_flags = flags;
+        shdr.sh_addr = addr;
+        shdr.sh_offset = offset;
+        shdr.sh_size = size;
+        shdr.sh_addralign = alignment;
+        return shdr;
+    }
+    
+    void makeElf(std::vector<char>& elf, const CorpusSpec& spec, std::mt19937& rng)
+    {
+        auto phnum = std::min(std::max(spec.phnum, 1u), 3u);
+        auto textSize = (spec.textSize + 15) & ~(size_t)15;
+        auto dataSize = textSize / 8;
+        auto relSize = (textSize / 64) & ~(size_t)7;
+        auto bssSize = (u32)(textSize / 4);
+        auto kernel = (spec.type == EXECUTABLE_TYPE_KERNEL_PRX);
+        
+        // headers go first, their offsets are patched once the layout is known
+        elf.assign(sizeof(Elf32_Ehdr) + phnum * sizeof(Elf32_Phdr), 0);
+        align(elf, 64);
+        
+        auto textOffset = elf.size();
+        makeText(elf, textSize, rng);
+        
+        // the host's SceModuleInfo has 64 bit pointers, the PSP's are 32
+        auto modinfoOffset = elf.size();
+        SceModuleInfo modinfo;
+        std::memset(&modinfo, 0, sizeof(modinfo));
+        modinfo.modattribute = (kernel) ? (0x1000) : (0);
+        modinfo.modversion[0] = 1;
+        modinfo.modversion[1] = 1;
+        std::snprintf(modinfo.modname, sizeof(modinfo.modname), "%s", spec.name);
+        elf.insert(elf.end(), (const char *)&modinfo, (const char *)&modinfo.gp_value);
+        elf.resize(modinfoOffset + MODINFO_SIZE);
+        align(elf, 16);
+        
+        auto textEnd = elf.size();
+        auto dataOffset = elf.size();
+        makeData(elf, dataSize, rng);
+        align(elf, 16);
+        
+        auto relOffset = elf.size();
+        
+        for (size_t i = 0; i < relSize; i += 8)
+        {
+            append(elf, (u32)(rng() % textSize) & ~3u);
+            append(elf, (u32)(rng() % 8));
+        }
+        
+        auto namesOffset = elf.size();
+        elf.insert(elf.end(), SECTION_NAMES, SECTION_NAMES + sizeof(SECTION_NAMES));
+        align(elf, 4);
+        
+        auto dataAddr = (u32)(textEnd - textOffset);
+        auto shoff = elf.size();
+        std::vector<Elf32_Shdr> sections =
+        {
+            section(0, 0, 0, 0, 0, 0, 0),
+            section(sectionName(".text"), SHT_PROGBITS, 6, 0, textOffset, textSize, 16),
+            section(sectionName(".rodata.sceModuleInfo"), SHT_PROGBITS, 2, modinfoOffset - textOffset, modinfoOffset, MODINFO_SIZE, 4),
+            section(sectionName(".data"), SHT_PROGBITS, 3, dataAddr, dataOffset, dataSize, 16),
+            section(sectionName(".bss"), SHT_NOBITS, 3, dataAddr + dataSize, dataOffset + dataSize, bssSize, 64),
+            section(sectionName(".rel.text"), SHT_PRXRELOC, 0, 0, relOffset, relSize, 4),
+            section(sectionName(".shstrtab"), SHT_STRTAB, 0, 0, namesOffset, sizeof(SECTION_NAMES), 1),
+        };
+        
+        for (auto& shdr : sections)
+        {
+            append(elf, shdr);
+        }
+        
+        auto ehdr = (Elf32_Ehdr *)elf.data();
+        ehdr->e_magic = ELF_MAGIC;
+        ehdr->e_class = 1;
+        ehdr->e_data = 1;
+        ehdr->e_idver = 1;
+        ehdr->e_type = ELF_TYPE_PRX;
+        ehdr->e_machine = 8;
+        ehdr->e_version = 1;
+        ehdr->e_phoff = sizeof(Elf32_Ehdr);
+        ehdr->e_shoff = shoff;
+        ehdr->e_flags = 0x10A23000;
+        ehdr->e_ehsize = sizeof(Elf32_Ehdr);
+        ehdr->e_phentsize = sizeof(Elf32_Phdr);
+        ehdr->e_phnum = phnum;
+        ehdr->e_shentsize = sizeof(Elf32_Shdr);
+        ehdr->e_shnum = sections.size();
+        ehdr->e_shstrndx = sections.size() - 1;
+        
+        // the text segment's physical address is the file offset of the module info
+        Elf32_Phdr phdrs[3] =
+        {
+            { 1, (u32)textOffset, 0, (u32)modinfoOffset | ((kernel) ? (0x80000000) : (0)), (u32)(textEnd - textOffset), (u32)(textEnd - textOffset), 5, 16 },
+            { 1, (u32)dataOffset, dataAddr, dataAddr, (u32)dataSize, (u32)dataSize + bssSize, 6, 64 },
+            { SHT_PRXRELOC, (u32)relOffset, 0, 0, (u32)relSize, 0, 0, 4 },
+        };
+        
+        std::memcpy(elf.data() + sizeof(Elf32_Ehdr), phdrs, phnum * sizeof(Elf32_Phdr));
+    }
+}
+
+bool writeCorpusFile(const std::string& path, const CorpusSpec& spec)
+{
+    std::mt19937 rng(spec.seed);
+    std::vector<char> elf, prefix;
+    makeElf(elf, spec, rng);
+    
+    if (spec.type == EXECUTABLE_TYPE_PBP)
+    {
+        // PARAM.SFO and ICON0.PNG, the other slots stay empty
+        prefix.assign(sizeof(PbpHeader), 0);
+        auto sfoOffset = prefix.size();
+        makeData(prefix, 0x180, rng);
+        auto iconOffset = prefix.size();
+        
+        for (int i = 0; i < 0x4000; ++i)
+        {
+            prefix.push_back((char)rng());
+        }
+        
+        auto pbp = (PbpHeader *)prefix.data();
+        pbp->magic = PBP_HEADER_MAGIC;
+        pbp->version = 0x10000;
+        pbp->sfo_offset = sfoOffset;
+        pbp->icon0_offset = iconOffset;
+        pbp->icon1_offset = pbp->pic0_offset = pbp->pic1_offset = pbp->snd0_offset = pbp->prx_offset = prefix.size();
+        pbp->psar_offset = prefix.size() + elf.size();
+    }
+    
+    auto file = std::fopen(path.c_str(), "wb");
+    
+    if (file == nullptr)
+    {
+        return false;
+    }
+    
+    auto ok = std::fwrite(prefix.data(), 1, prefix.size(), file) == prefix.size()
+        && std::fwrite(elf.data(), 1, elf.size(), file) == elf.size();
+    
+    // game data is already compressed or encrypted, so it is random here
+    std::vector<u32> chunk(256 * 1024);
+    auto remaining = (spec.type == EXECUTABLE_TYPE_PBP) ? (spec.psarSize) : (0);
+    
+    while (ok && remaining > 0)
+    {
+        auto size = std::min(remaining, chunk.size() * sizeof(u32));
+        
+        for (auto& word : chunk)
+        {
+            word = rng();
+        }
+        
+        ok = std::fwrite(chunk.data(), 1, size, file) == size;
+        remaining -= size;
+    }
+    
+    return (std::fclose(file) == 0) && ok;
+}
@@ -0,0 +1,55 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#ifndef CORPUS_H_
+#define CORPUS_H_
+
+#include <string>
+
+#include "packexec.h"
+
+// a synthetic module shaped like the output of the PSPSDK toolchain
+struct CorpusSpec
+{
+    const char *name;
+    ExecutableType type;
+    
+    // bytes of code, the data and relocations are sized from it
+    size_t textSize;
+    
+    // 1 to 3: text, then data and .bss, then relocations
+    unsigned int phnum;
+    
+    // bytes after the ELF, PBPs only
+    size_t psarSize;
+    
+    unsigned int seed;
+};
+
+// write the module described by 'spec' to 'path'. the PSAR is generated a
+// chunk at a time, so any size can be written without holding it.
+bool writeCorpusFile(const std::string& path, const CorpusSpec& spec);
+
+#endif // CORPUS_H_
@@ -0,0 +1,169 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#include "crc32.h"
+
+#include <zlib.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+namespace
+{
+    // the byte at a time crc that gzip.c used to carry, kept as the baseline
+    unsigned long crc_table[256];
+    int crc_table_computed = 0;
+    
+    void make_crc_table(void)
+    {
+        unsigned long c;
+        int n, k;
+        
+        for (n = 0; n < 256; n++) {
+            c = (unsigned long) n;
+            for (k = 0; k < 8; k++) {
+                if (c & 1) {
+                    c = 0xedb88320L ^ (c >> 1);
+                } else {
+                    c = c >> 1;
+                }
+            }
+            crc_table[n] = c;
+        }
+        crc_table_computed = 1;
+    }
+    
+    unsigned long update_crc(unsigned long crc, unsigned char *buf, int len)
+    {
+        unsigned long c = crc ^ 0xffffffffL;
+        int n;
+        
+        if (!crc_table_computed)
+            make_crc_table();
+        for (n = 0; n < len; n++) {
+            c = crc_table[(c ^ buf[n]) & 0xff] ^ (c >> 8);
+        }
+        return c ^ 0xffffffffL;
+    }
+    
+    u32 updateCrcBaseline(u32 crc, const void *buf, size_t len)
+    {
+        return (u32)update_crc(crc, (unsigned char *)buf, (int)len);
+    }
+    
+    u32 zlibCrc32(u32 crc, const void *buf, size_t len)
+    {
+        return (u32)crc32(crc, (const Bytef *)buf, (uInt)len);
+    }
+    
+    // best of a few runs over the whole buffer, in GB/s
+    double measure(Crc32Function update, const std::vector<unsigned char>& data, size_t chunk, u32& crc)
+    {
+        auto best = 0.0;
+        
+        for (int run = 0; run < 5; ++run)
+        {
+            auto start = std::chrono::steady_clock::now();
+            crc = 0;
+            
+            for (size_t offset = 0; offset < data.size(); offset += chunk)
+            {
+                auto size = (data.size() - offset < chunk) ? (data.size() - offset) : (chunk);
+                crc = update(crc, data.data() + offset, size);
+            }
+            
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            auto rate = data.size() / elapsed.count() / 1e9;
+            
+            if (rate > best)
+            {
+                best = rate;
+            }
+        }
+        
+        return best;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    auto size = (size_t)((argc > 1) ? (strtoul(argv[1], NULL, 0)) : (64u << 20));
+    
+    // deflate feeds the crc 64KiB at a time
+    auto chunk = (size_t)((argc > 2) ? (strtoul(argv[2], NULL, 0)) : (64u << 10));
+    
+    std::vector<unsigned char> data(size);
+    std::mt19937 rng(0x50535021);
+    
+    for (auto& byte : data)
+    {
+        byte = (unsigned char)rng();
+    }
+    
+    std::vector<Crc32Kernel> kernels =
+    {
+        { "update_crc", updateCrcBaseline, 1 },
+        { "zlib", zlibCrc32, 1 },
+    };
+    
+    const Crc32Kernel *engine;
+    auto count = crc32GetKernels(&engine);
+    kernels.insert(kernels.end(), engine, engine + count);
+    
+    std::printf("buffer %zu bytes, chunk %zu bytes, dispatch uses %s\n", size, chunk, crc32KernelName());
+    std::printf("%-12s %10s %10s  %s\n", "kernel", "GB/s", "speedup", "crc32");
+    
+    auto reference = 0u;
+    auto baseline = 0.0;
+    auto failed = false;
+    
+    for (auto& kernel : kernels)
+    {
+        if (!kernel.supported)
+        {
+            std::printf("%-12s %10s\n", kernel.name, "n/a");
+            continue;
+        }
+        
+        u32 crc;
+        auto rate = measure(kernel.update, data, chunk, crc);
+        
+        if (baseline == 0.0)
+        {
+            baseline = rate;
+            reference = crc;
+        }
+        
+        auto mismatch = (crc != reference);
+        failed |= mismatch;
+        
+        std::printf("%-12s %10.2f %9.1fx  %08X%s\n", kernel.name, rate, rate / baseline, crc, mismatch ? " MISMATCH" : "");
+    }
+    
+    return failed ? 1 : 0;
+}
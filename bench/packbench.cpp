@@ -0,0 +1,427 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+// times each stage of packing a synthetic corpus and prints the results as
+// JSON, so runs on different commits can be compared. stages are the best of
+// several runs. peak RSS is for the whole process so far, and the cases run
+// smallest first.
+
+#include "corpus.h"
+
+#include "packexec.h"
+#include "parallelgzip.h"
+#include "threadpool.h"
+#include "fileio.h"
+#include "crc32.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+    
+    struct BenchOptions
+    {
+        std::string directory;
+        unsigned int runs;
+        unsigned int threads;
+        GzipParams params;
+        size_t psarSize;
+        bool keep;
+    };
+    
+    struct StageResult
+    {
+        const char *name;
+        double seconds;
+        
+        // what the throughput is measured against
+        size_t bytes;
+    };
+    
+    struct CaseResult
+    {
+        size_t inputSize;
+        size_t elfSize;
+        size_t moduleSize;
+        size_t outputSize;
+        long peakRss;
+        
+        // heap allocations for buffers and deflate state in one more pack
+        // after the timed ones, which should be none
+        unsigned long steadyAllocations;
+        std::vector<StageResult> stages;
+    };
+    
+    // best wall time out of 'runs' calls, which all have to succeed
+    template <typename Stage> bool measure(unsigned int runs, double& best, Stage stage)
+    {
+        best = 0.0;
+        
+        for (auto run = 0u; run < runs; ++run)
+        {
+            auto start = Clock::now();
+            
+            if (!stage())
+            {
+                return false;
+            }
+            
+            std::chrono::duration<double> elapsed = Clock::now() - start;
+            
+            if (run == 0 || elapsed.count() < best)
+            {
+                best = elapsed.count();
+            }
+        }
+        
+        return true;
+    }
+    
+    // in KiB
+    long peakRss(void)
+    {
+#ifdef _WIN32
+        return 0;
+#else
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        
+#ifdef __APPLE__
+        return usage.ru_maxrss / 1024;
+#else
+        return usage.ru_maxrss;
+#endif
+#endif
+    }
+    
+    bool runCase(const CorpusSpec& spec, const BenchOptions& options, ThreadPool& pool, CaseResult& result)
+    {
+        auto inputPath = options.directory + "/" + spec.name + ".bin";
+        auto outputPath = options.directory + "/" + spec.name + ".packed";
+        
+        if (!writeCorpusFile(inputPath, spec))
+        {
+            std::fprintf(stderr, "could not write \"%s\"\n", inputPath.c_str());
+            return false;
+        }
+        
+        MappedFile file;
+        PreparedExec prepared;
+        PackedExec packed;
+        auto compSize = 0;
+        auto ok = true;
+        double seconds;
+        
+        // mapping is cheap, so the pages are touched to count the faults
+        ok = ok && measure(options.runs, seconds, [&]()
+        {
+            if (!file.open(inputPath))
+            {
+                return false;
+            }
+            
+            volatile char sink = 0;
+            
+            for (size_t offset = 0; offset < file.size(); offset += 4096)
+            {
+                sink ^= file.data()[offset];
+            }
+            
+            return true;
+        });
+        
+        result.inputSize = file.size();
+        result.stages.push_back({ "load", seconds, file.size() });
+        
+        ok = ok && measure(options.runs, seconds, [&]()
+        {
+            return prepare_executable(file.data(), file.size(), prepared, default_psp_tag, default_oe_tag) == NO_ERROR;
+        });
+        
+        auto elf = file.data() + prepared.offset;
+        result.elfSize = prepared.size;
+        result.stages.push_back({ "prepare", seconds, prepared.size });
+        
+        ok = ok && measure(options.runs, seconds, [&]()
+        {
+            volatile u32 crc = crc32Update(0, elf, prepared.size);
+            (void)crc;
+            return true;
+        });
+        
+        result.stages.push_back({ "crc32", seconds, prepared.size });
+        
+        auto bound = gzipGetMaxCompressedSize(prepared.size);
+        packed.module.resize(bound + sizeof(PSP_Header));
+        
+        ok = ok && measure(options.runs, seconds, [&]()
+        {
+            auto out = packed.module.data() + sizeof(PSP_Header);
+            
+            if (options.threads != 0)
+            {
+                compSize = gzipCompressParallel(pool, out, bound, elf, prepared.size, &options.params);
+            }
+            else
+            {
+                compSize = gzipCompressContext(gzipThreadContext(), out, bound, elf, prepared.size, &options.params);
+            }
+            
+            return compSize >= 0;
+        });
+        
+        result.stages.push_back({ "deflate", seconds, prepared.size });
+        
+        if (ok)
+        {
+            packed.module.resize(compSize + sizeof(PSP_Header));
+            result.moduleSize = compSize;
+        }
+        
+        ok = ok && measure(options.runs, seconds, [&]()
+        {
+            auto header = (PSP_Header *)packed.module.data();
+            std::memcpy(header, &prepared.header, sizeof(PSP_Header));
+            finish_psp_header(*header, compSize, key_data_seed(prepared, elf, prepared.size, PackOptions()));
+            assemble_executable(file.data(), file.size(), prepared, packed);
+            return true;
+        });
+        
+        result.outputSize = packed.size();
+        result.stages.push_back({ "assemble", seconds, packed.size() });
+        
+        ok = ok && measure(options.runs, seconds, [&]()
+        {
+            return writeFileAtomic(outputPath, packed.segments);
+        });
+        
+        result.stages.push_back({ "write", seconds, packed.size() });
+        file.close();
+        
+        // the same work as the command line, for comparison with the sum
+        auto total = [&]()
+        {
+            MappedFile input;
+            PackedExec output;
+            PackOptions packOptions;
+            packOptions.params = options.params;
+            packOptions.compressThreads = options.threads;
+            packOptions.pool = &pool;
+            
+            return input.open(inputPath) 
+                && pack_executable(input.data(), input.size(), output, default_psp_tag, default_oe_tag, packOptions) == NO_ERROR 
+                && writeFileAtomic(outputPath, output.segments);
+        };
+        
+        ok = ok && measure(options.runs, seconds, total);
+        result.stages.push_back({ "total", seconds, result.inputSize });
+        
+        auto allocations = sharedBufferPool().allocations() + gzipHeapAllocations();
+        ok = ok && total();
+        result.steadyAllocations = sharedBufferPool().allocations() + gzipHeapAllocations() - allocations;
+        result.peakRss = peakRss();
+        
+        if (!options.keep)
+        {
+            std::remove(inputPath.c_str());
+            std::remove(outputPath.c_str());
+        }
+        
+        if (!ok)
+        {
+            std::fprintf(stderr, "%s failed\n", spec.name);
+        }
+        
+        return ok;
+    }
+    
+    bool isDirectory(const std::string& path)
+    {
+        struct stat st;
+        return stat(path.c_str(), &st) == 0 && (st.st_mode & S_IFMT) == S_IFDIR;
+    }
+    
+    // like mkdir -p, so --dir can name somewhere new
+    bool makeDirectories(const std::string& path)
+    {
+        if (path.empty() || isDirectory(path))
+        {
+            return true;
+        }
+        
+        auto slash = path.find_last_of("/\\");
+        
+        if (slash != std::string::npos && slash > 0 && !makeDirectories(path.substr(0, slash)))
+        {
+            return false;
+        }
+        
+#ifdef _WIN32
+        _mkdir(path.c_str());
+#else
+        mkdir(path.c_str(), 0777);
+#endif
+        
+        return isDirectory(path);
+    }
+    
+    void usage(void)
+    {
+        std::fprintf(stderr, "usage: psp-packer-bench [--dir <dir>] [--runs <n>] [--threads <n>] [--level <n>] [--optimal] [--psar-mb <n>] [--keep]\n");
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    BenchOptions options;
+    auto temp = std::getenv("TMPDIR");
+    options.directory = (temp) ? (temp) : ("/tmp");
+    options.runs = 3;
+    options.threads = 0;
+    options.psarSize = 256u << 20;
+    options.keep = false;
+    gzipDefaultParams(&options.params);
+    
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--dir") == 0 && i + 1 < argc)
+        {
+            options.directory = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--runs") == 0 && i + 1 < argc)
+        {
+            options.runs = std::max(1ul, strtoul(argv[++i], NULL, 0));
+        }
+        else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            options.threads = strtoul(argv[++i], NULL, 0);
+        }
+        else if (std::strcmp(argv[i], "--level") == 0 && i + 1 < argc)
+        {
+            options.params.level = strtoul(argv[++i], NULL, 0);
+        }
+        else if (std::strcmp(argv[i], "--optimal") == 0)
+        {
+            options.params.encoder = GZIP_ENCODER_OPTIMAL;
+        }
+        else if (std::strcmp(argv[i], "--psar-mb") == 0 && i + 1 < argc)
+        {
+            options.psarSize = (size_t)strtoul(argv[++i], NULL, 0) << 20;
+        }
+        else if (std::strcmp(argv[i], "--keep") == 0)
+        {
+            options.keep = true;
+        }
+        else
+        {
+            usage();
+            return 1;
+        }
+    }
+    
+    if (!makeDirectories(options.directory))
+    {
+        std::fprintf(stderr, "could not create \"%s\"\n", options.directory.c_str());
+        return 1;
+    }
+    
+    // smallest first, so the peak RSS after each case is roughly its own
+    const CorpusSpec corpus[] =
+    {
+        { "user_256k", EXECUTABLE_TYPE_USER_PRX, 256 << 10, 2, 0, 1 },
+        { "kernel_1m", EXECUTABLE_TYPE_KERNEL_PRX, 1 << 20, 1, 0, 2 },
+        { "pbp_small_psar", EXECUTABLE_TYPE_PBP, 2 << 20, 2, 1 << 20, 3 },
+        { "user_4m", EXECUTABLE_TYPE_USER_PRX, 4 << 20, 3, 0, 4 },
+        { "pbp_large_psar", EXECUTABLE_TYPE_PBP, 6 << 20, 3, options.psarSize, 5 },
+    };
+    
+    ThreadPool pool(options.threads);
+    
+    std::printf("{\n");
+    std::printf("  \"crc32\": \"%s\",\n", crc32KernelName());
+    std::printf("  \"level\": %d,\n", options.params.level);
+    std::printf("  \"encoder\": \"%s\",\n", gzipEncoderName(options.params.encoder));
+    std::printf("  \"threads\": %u,\n", options.threads);
+    std::printf("  \"runs\": %u,\n", options.runs);
+    std::printf("  \"cases\": [");
+    
+    auto failed = false;
+    auto first = true;
+    
+    for (auto& spec : corpus)
+    {
+        std::fprintf(stderr, "%s...\n", spec.name);
+        
+        CaseResult result;
+        
+        if (!runCase(spec, options, pool, result))
+        {
+            failed = true;
+            continue;
+        }
+        
+        std::printf("%s\n    {\n", (first) ? ("") : (","));
+        std::printf("      \"name\": \"%s\",\n", spec.name);
+        std::printf("      \"type\": \"%s\",\n", executable_type_name(spec.type));
+        std::printf("      \"phnum\": %u,\n", spec.phnum);
+        std::printf("      \"input_bytes\": %zu,\n", result.inputSize);
+        std::printf("      \"elf_bytes\": %zu,\n", result.elfSize);
+        std::printf("      \"output_bytes\": %zu,\n", result.outputSize);
+        std::printf("      \"ratio\": %.4f,\n", (double)result.moduleSize / result.elfSize);
+        std::printf("      \"peak_rss_kb\": %ld,\n", result.peakRss);
+        std::printf("      \"steady_allocations\": %lu,\n", result.steadyAllocations);
+        std::printf("      \"stages\": {");
+        
+        for (size_t i = 0; i < result.stages.size(); ++i)
+        {
+            auto& stage = result.stages[i];
+            auto rate = (stage.seconds > 0.0) ? (stage.bytes / stage.seconds / 1e6) : (0.0);
+            
+            std::printf("%s\n        \"%s\": { \"seconds\": %.6f, \"mb_per_s\": %.1f }", (i == 0) ? ("") : (","), stage.name, stage.seconds, rate);
+        }
+        
+        std::printf("\n      }\n    }");
+        first = false;
+    }
+    
+    std::printf("\n  ]\n}\n");
+    return (failed) ? (1) : (0);
+}
@@ -0,0 +1,67 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#ifndef BUFFER_H_
+#define BUFFER_H_
+
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+// allocator that leaves elements default initialised, so resizing a vector of
+// chars to the worst case size neither writes nor faults in pages that the
+// compressor is about to overwrite anyway
+template <typename T>
+struct UninitializedAllocator : std::allocator<T>
+{
+    template <typename U>
+    struct rebind
+    {
+        using other = UninitializedAllocator<U>;
+    };
+    
+    UninitializedAllocator() = default;
+    
+    template <typename U>
+    UninitializedAllocator(const UninitializedAllocator<U>&) {}
+    
+    template <typename U>
+    void construct(U *p)
+    {
+        ::new ((void *)p) U;
+    }
+    
+    template <typename U, typename... Args>
+    void construct(U *p, Args&&... args)
+    {
+        ::new ((void *)p) U(std::forward<Args>(args)...);
+    }
+};
+
+// output buffer for compressed data
+using ModuleBuffer = std::vector<char, UninitializedAllocator<char>>;
+
+#endif // BUFFER_H_
@@ -0,0 +1,121 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#include "bufferpool.h"
+
+#include <algorithm>
+
+// enough to keep the output of a few big PBPs and every compression block
+#define SHARED_POOL_LIMIT (128u << 20)
+
+void BufferPool::take(ModuleBuffer& buffer, size_t size)
+{
+    if (buffer.capacity() < size)
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        auto best = m_buffers.end();
+        
+        // the smallest kept buffer that is big enough
+        for (auto it = m_buffers.begin(); it != m_buffers.end(); ++it)
+        {
+            if (it->capacity() >= size && (best == m_buffers.end() || it->capacity() < best->capacity()))
+            {
+                best = it;
+            }
+        }
+        
+        if (best != m_buffers.end())
+        {
+            m_kept -= best->capacity();
+            buffer.swap(*best);
+            m_buffers.erase(best);
+        }
+    }
+    
+    if (buffer.capacity() < size)
+    {
+        ++m_allocations;
+        
+        // nothing worth copying, so drop the contents rather than have
+        // resize() move them
+        ModuleBuffer().swap(buffer);
+        buffer.reserve(size);
+    }
+    else
+    {
+        ++m_reuses;
+    }
+    
+    // default initialised, so this never writes to the buffer
+    buffer.resize(size);
+}
+
+void BufferPool::give(ModuleBuffer& buffer)
+{
+    ModuleBuffer kept;
+    kept.swap(buffer);
+    
+    auto capacity = kept.capacity();
+    
+    if (capacity == 0)
+    {
+        return;
+    }
+    
+    std::lock_guard<std::mutex> guard(m_lock);
+    
+    // past the limit the smallest buffers make way, as long as that leaves
+    // room for this one
+    while (m_kept + capacity > m_limit && !m_buffers.empty())
+    {
+        auto smallest = std::min_element(m_buffers.begin(), m_buffers.end(), [](const ModuleBuffer& a, const ModuleBuffer& b)
+        {
+            return a.capacity() < b.capacity();
+        });
+        
+        if (smallest->capacity() >= capacity)
+        {
+            return;
+        }
+        
+        m_kept -= smallest->capacity();
+        m_buffers.erase(smallest);
+    }
+    
+    if (m_kept + capacity > m_limit)
+    {
+        return;
+    }
+    
+    m_kept += capacity;
+    kept.clear();
+    m_buffers.push_back(std::move(kept));
+}
+
+BufferPool& sharedBufferPool(void)
+{
+    static BufferPool pool(SHARED_POOL_LIMIT);
+    return pool;
+}
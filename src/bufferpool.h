@@ -0,0 +1,67 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#ifndef BUFFERPOOL_H_
+#define BUFFERPOOL_H_
+
+#include "buffer.h"
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+// buffers that jobs are done with, handed to the next job instead of going
+// back to the heap. buffers come back with their old contents, so only what
+// a job doesn't overwrite needs clearing. safe to use from any thread.
+class BufferPool
+{
+public:
+    // keep at most 'limit' bytes of buffers around
+    explicit BufferPool(size_t limit) : m_limit(limit), m_kept(0), m_allocations(0), m_reuses(0) {}
+    
+    // make 'buffer' 'size' bytes long, on a kept allocation when one is big
+    // enough
+    void take(ModuleBuffer& buffer, size_t size);
+    
+    // keep the buffer's allocation for the next take(), leaving it empty
+    void give(ModuleBuffer& buffer);
+    
+    // how often take() had to go to the heap, and how often it didn't
+    unsigned long allocations(void) const { return m_allocations; }
+    unsigned long reuses(void) const { return m_reuses; }
+    
+private:
+    size_t m_limit;
+    size_t m_kept;
+    std::mutex m_lock;
+    std::vector<ModuleBuffer> m_buffers;
+    std::atomic<unsigned long> m_allocations;
+    std::atomic<unsigned long> m_reuses;
+};
+
+// the pool packing, unpacking and compression blocks share
+BufferPool& sharedBufferPool(void);
+
+#endif // BUFFERPOOL_H_
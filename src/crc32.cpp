@@ -0,0 +1,403 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#include "crc32.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define CRC32_HAVE_PCLMUL
+#include <emmintrin.h>
+#include <smmintrin.h>
+#include <wmmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define CRC32_PCLMUL_TARGET
+#else
+#include <cpuid.h>
+#define CRC32_PCLMUL_TARGET __attribute__((target("pclmul,sse4.1")))
+#endif
+#endif
+
+#if defined(__aarch64__) && (defined(__ARM_FEATURE_CRC32) || (defined(__GNUC__) && __GNUC__ >= 9) || defined(__clang__))
+#define CRC32_HAVE_ARMV8
+#include <arm_acle.h>
+#if defined(__ARM_FEATURE_CRC32)
+#define CRC32_ARMV8_TARGET
+#elif defined(__clang__)
+#define CRC32_ARMV8_TARGET __attribute__((target("crc")))
+#else
+#define CRC32_ARMV8_TARGET __attribute__((target("+crc")))
+#endif
+#if defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#endif
+
+namespace
+{
+    struct CrcTables
+    {
+        // table[0] is the classic byte table, table[k] advances a byte
+        // through k further zero bytes
+        u32 table[16][256];
+    };
+    
+    CrcTables makeTables(void)
+    {
+        CrcTables tables;
+        
+        for (u32 n = 0; n < 256; ++n)
+        {
+            auto c = n;
+            
+            for (int k = 0; k < 8; ++k)
+            {
+                c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+            }
+            
+            tables.table[0][n] = c;
+        }
+        
+        for (u32 n = 0; n < 256; ++n)
+        {
+            for (int k = 1; k < 16; ++k)
+            {
+                auto prev = tables.table[k-1][n];
+                tables.table[k][n] = (prev >> 8) ^ tables.table[0][prev & 0xFF];
+            }
+        }
+        
+        return tables;
+    }
+    
+    const CrcTables& crcTables(void)
+    {
+        static const CrcTables tables = makeTables();
+        return tables;
+    }
+    
+    bool isLittleEndian(void)
+    {
+        const u32 one = 1;
+        return *(const u8 *)&one == 1;
+    }
+    
+    inline u32 load32(const u8 *p)
+    {
+        u32 value;
+        std::memcpy(&value, p, sizeof(value));
+        return value;
+    }
+    
+    u32 crc32Bytes(u32 c, const u8 *p, size_t len, const CrcTables& t)
+    {
+        while (len--)
+        {
+            c = t.table[0][(c ^ *p++) & 0xFF] ^ (c >> 8);
+        }
+        
+        return c;
+    }
+    
+    u32 crc32Slice8(u32 crc, const void *buf, size_t len)
+    {
+        auto& t = crcTables();
+        auto p = (const u8 *)buf;
+        auto c = ~crc;
+        
+        if (isLittleEndian())
+        {
+            for (; len >= 8; len -= 8, p += 8)
+            {
+                auto a = c ^ load32(p);
+                auto b = load32(p + 4);
+                
+                c = t.table[7][a & 0xFF] ^ t.table[6][(a >> 8) & 0xFF] ^ t.table[5][(a >> 16) & 0xFF] ^ t.table[4][a >> 24]
+                  ^ t.table[3][b & 0xFF] ^ t.table[2][(b >> 8) & 0xFF] ^ t.table[1][(b >> 16) & 0xFF] ^ t.table[0][b >> 24];
+            }
+        }
+        
+        return ~crc32Bytes(c, p, len, t);
+    }
+    
+    u32 crc32Slice16(u32 crc, const void *buf, size_t len)
+    {
+        auto& t = crcTables();
+        auto p = (const u8 *)buf;
+        auto c = ~crc;
+        
+        if (isLittleEndian())
+        {
+            for (; len >= 16; len -= 16, p += 16)
+            {
+                auto a = c ^ load32(p);
+                auto b = load32(p + 4);
+                auto d = load32(p + 8);
+                auto e = load32(p + 12);
+                
+                c = t.table[15][a & 0xFF] ^ t.table[14][(a >> 8) & 0xFF] ^ t.table[13][(a >> 16) & 0xFF] ^ t.table[12][a >> 24]
+                  ^ t.table[11][b & 0xFF] ^ t.table[10][(b >> 8) & 0xFF] ^ t.table[9][(b >> 16) & 0xFF] ^ t.table[8][b >> 24]
+                  ^ t.table[7][d & 0xFF] ^ t.table[6][(d >> 8) & 0xFF] ^ t.table[5][(d >> 16) & 0xFF] ^ t.table[4][d >> 24]
+                  ^ t.table[3][e & 0xFF] ^ t.table[2][(e >> 8) & 0xFF] ^ t.table[1][(e >> 16) & 0xFF] ^ t.table[0][e >> 24];
+            }
+        }
+        
+        return ~crc32Bytes(c, p, len, t);
+    }
+    
+#ifdef CRC32_HAVE_PCLMUL
+    bool cpuHasPclmul(void)
+    {
+        unsigned int ecx;
+#if defined(_MSC_VER)
+        int regs[4];
+        __cpuid(regs, 1);
+        ecx = regs[2];
+#else
+        unsigned int eax, ebx, edx;
+        
+        if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        {
+            return false;
+        }
+#endif
+        // pclmulqdq and sse4.1
+        return (ecx & (1 << 1)) && (ecx & (1 << 19));
+    }
+    
+    // fold 64 bytes at a time with carry-less multiplies, then barrett reduce
+    // (intel, "fast crc computation for generic polynomials using pclmulqdq").
+    // len must be a multiple of 16 and at least 64, crc is not inverted here.
+    CRC32_PCLMUL_TARGET u32 crc32FoldPclmul(u32 crc, const u8 *buf, size_t len)
+    {
+        alignas(16) static const u64 k1k2[] = { 0x0154442bd4, 0x01c6e41596 };
+        alignas(16) static const u64 k3k4[] = { 0x01751997d0, 0x00ccaa009e };
+        alignas(16) static const u64 k5k0[] = { 0x0163cd6124, 0x0000000000 };
+        alignas(16) static const u64 poly[] = { 0x01db710641, 0x01f7011641 };
+        
+        __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+        
+        x1 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+        x2 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+        x3 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+        x4 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+        
+        x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+        x0 = _mm_load_si128((const __m128i *)k1k2);
+        
+        buf += 64;
+        len -= 64;
+        
+        // fold four lanes in parallel
+        while (len >= 64)
+        {
+            x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+            x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+            x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+            x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+            
+            x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+            x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+            x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+            x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+            
+            y5 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+            y6 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+            y7 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+            y8 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+            
+            x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+            x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+            x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+            x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+            
+            buf += 64;
+            len -= 64;
+        }
+        
+        // fold the four lanes into one
+        x0 = _mm_load_si128((const __m128i *)k3k4);
+        
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+        
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+        
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+        
+        // remaining 16 byte blocks
+        while (len >= 16)
+        {
+            x2 = _mm_loadu_si128((const __m128i *)buf);
+            
+            x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+            x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+            x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+            
+            buf += 16;
+            len -= 16;
+        }
+        
+        // 128 bits down to 64
+        x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+        x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+        x1 = _mm_srli_si128(x1, 8);
+        x1 = _mm_xor_si128(x1, x2);
+        
+        x0 = _mm_loadl_epi64((const __m128i *)k5k0);
+        
+        x2 = _mm_srli_si128(x1, 4);
+        x1 = _mm_and_si128(x1, x3);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_xor_si128(x1, x2);
+        
+        // barrett reduce to 32 bits
+        x0 = _mm_load_si128((const __m128i *)poly);
+        
+        x2 = _mm_and_si128(x1, x3);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+        x2 = _mm_and_si128(x2, x3);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x1 = _mm_xor_si128(x1, x2);
+        
+        return (u32)_mm_extract_epi32(x1, 1);
+    }
+    
+    u32 crc32Pclmul(u32 crc, const void *buf, size_t len)
+    {
+        auto p = (const u8 *)buf;
+        
+        if (len >= 64)
+        {
+            auto chunk = len & ~(size_t)15;
+            crc = ~crc32FoldPclmul(~crc, p, chunk);
+            p += chunk;
+            len -= chunk;
+        }
+        
+        return crc32Slice16(crc, p, len);
+    }
+#endif // CRC32_HAVE_PCLMUL
+    
+#ifdef CRC32_HAVE_ARMV8
+    bool cpuHasArmv8Crc(void)
+    {
+#if defined(__ARM_FEATURE_CRC32) || defined(__APPLE__)
+        return true;
+#elif defined(__linux__) && defined(HWCAP_CRC32)
+        return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#else
+        return false;
+#endif
+    }
+    
+    CRC32_ARMV8_TARGET u32 crc32Armv8(u32 crc, const void *buf, size_t len)
+    {
+        auto p = (const u8 *)buf;
+        auto c = ~crc;
+        
+        // four independent streams would hide more latency, but one is
+        // already well past memory bandwidth for our sizes
+        for (; len >= 8; len -= 8, p += 8)
+        {
+            u64 value;
+            std::memcpy(&value, p, sizeof(value));
+            c = __crc32d(c, value);
+        }
+        
+        while (len--)
+        {
+            c = __crc32b(c, *p++);
+        }
+        
+        return ~c;
+    }
+#endif // CRC32_HAVE_ARMV8
+    
+    const Crc32Kernel *kernelList(size_t *count)
+    {
+        static const Crc32Kernel kernels[] =
+        {
+            { "slice8", crc32Slice8, 1 },
+            { "slice16", crc32Slice16, 1 },
+#ifdef CRC32_HAVE_PCLMUL
+            { "pclmul", crc32Pclmul, cpuHasPclmul() },
+#endif
+#ifdef CRC32_HAVE_ARMV8
+            { "armv8", crc32Armv8, cpuHasArmv8Crc() },
+#endif
+        };
+        
+        *count = sizeof(kernels) / sizeof(kernels[0]);
+        return kernels;
+    }
+    
+    const Crc32Kernel *selectKernel(void)
+    {
+        size_t count;
+        auto kernels = kernelList(&count);
+        
+        // the list is ordered slowest to fastest
+        for (auto i = count; i > 0; --i)
+        {
+            if (kernels[i-1].supported)
+            {
+                return &kernels[i-1];
+            }
+        }
+        
+        return &kernels[0];
+    }
+    
+    const Crc32Kernel& activeKernel(void)
+    {
+        static const Crc32Kernel *kernel = selectKernel();
+        return *kernel;
+    }
+}
+
+u32 crc32Update(u32 crc, const void *buf, size_t len)
+{
+    return activeKernel().update(crc, buf, len);
+}
+
+const char *crc32KernelName(void)
+{
+    return activeKernel().name;
+}
+
+size_t crc32GetKernels(const Crc32Kernel **kernels)
+{
+    size_t count;
+    *kernels = kernelList(&count);
+    return count;
+}
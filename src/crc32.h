@@ -0,0 +1,65 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#ifndef CRC32_H_
+#define CRC32_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint64_t u64;
+typedef uint32_t u32;
+typedef uint16_t u16;
+typedef uint8_t u8;
+
+typedef u32 (*Crc32Function)(u32 crc, const void *buf, size_t len);
+
+typedef struct
+{
+    const char *name;
+    Crc32Function update;
+    
+    // non-zero if this cpu can run the kernel
+    int supported;
+} Crc32Kernel;
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+// update a running gzip crc32 (initially 0) with buf[0..len-1] using the
+// fastest kernel this cpu supports.
+u32 crc32Update(u32 crc, const void *buf, size_t len);
+
+// name of the kernel crc32Update dispatches to
+const char *crc32KernelName(void);
+
+// every kernel compiled in, supported or not, fastest last
+size_t crc32GetKernels(const Crc32Kernel **kernels);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+#endif // CRC32_H_
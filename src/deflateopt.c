@@ -0,0 +1,867 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "deflateopt.h"
+
+#define WINDOW_SIZE     (32768)
+#define WINDOW_MASK     (WINDOW_SIZE - 1)
+#define HASH_BITS       (16)
+#define HASH_SIZE       (1 << HASH_BITS)
+#define MIN_MATCH       (3)
+#define MAX_MATCH       (258)
+
+/* how far down a hash chain to look, and how many matches of increasing
+   length to keep for each position */
+#define MAX_CHAIN       (1024)
+#define MAX_MATCHES     (16)
+
+/* input covered by each deflate block, and parsing passes over it */
+#define BLOCK_SIZE      (64 * 1024)
+#define PARSE_PASSES    (5)
+
+#define LITLEN_CODES    (286)
+/* the fixed code also gives lengths to litlen 286 and 287, which never
+   occur but still count towards its canonical codes */
+#define FIXED_LITLEN_CODES (288)
+#define DIST_CODES      (30)
+#define CODELEN_CODES   (19)
+#define MAX_CODE_LENGTH (15)
+#define MAX_CODELEN_LENGTH (7)
+#define END_OF_BLOCK    (256)
+
+static const u16 lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const u8 lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const u16 distBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const u8 distExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+static const u8 codelenOrder[CODELEN_CODES] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+/* a step through the input, a literal if the length is 1 */
+typedef struct
+{
+	u16 length;
+	u16 distance;
+} Match;
+
+typedef struct
+{
+	u32 litlen[LITLEN_CODES];
+	u32 dist[DIST_CODES];
+} SymbolCounts;
+
+typedef struct
+{
+	u8 litlen[FIXED_LITLEN_CODES];
+	u8 dist[DIST_CODES];
+} CodeLengths;
+
+/* estimated bits for each symbol */
+typedef struct
+{
+	float litlen[LITLEN_CODES];
+	float dist[DIST_CODES];
+} CostModel;
+
+typedef struct
+{
+	u8 *out;
+	u32 size;
+	u32 pos;
+	u64 bits;
+	int count;
+	int overflow;
+} BitWriter;
+
+typedef struct
+{
+	/* dictionary followed by the input */
+	const u8 *data;
+	u32 size;
+	
+	/* hash chains, holding every position below 'inserted' */
+	int *head;
+	int *prev;
+	u32 inserted;
+	
+	/* matches found at each position of the block */
+	Match *matches;
+	u8 *matchCount;
+	
+	/* cheapest way found to reach each position of the block */
+	float *cost;
+	Match *step;
+	
+	/* parse of the current pass and the smallest one so far */
+	Match *parse;
+	Match *bestParse;
+	
+	u8 lengthCode[MAX_MATCH + 1];
+	u8 distCode[WINDOW_SIZE + 1];
+} OptimalState;
+
+/* bits go out least significant first. a null writer only counts them. */
+static void putBits(BitWriter *w, u32 value, int length)
+{
+	w->bits |= (u64)value << w->count;
+	w->count += length;
+	
+	while (w->count >= 8)
+	{
+		if (w->pos < w->size)
+			w->out[w->pos] = (u8)w->bits;
+		else
+			w->overflow = 1;
+		
+		w->pos++;
+		w->bits >>= 8;
+		w->count -= 8;
+	}
+}
+
+static void alignBits(BitWriter *w)
+{
+	if (w->count)
+		putBits(w, 0, 8 - w->count);
+}
+
+static u32 hash3(const u8 *p)
+{
+	return ((u32)(p[0] | (p[1] << 8) | (p[2] << 16)) * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static void insertPositions(OptimalState *s, u32 end)
+{
+	while (s->inserted < end)
+	{
+		u32 pos = s->inserted++;
+		
+		if (pos + MIN_MATCH <= s->size)
+		{
+			u32 hash = hash3(s->data + pos);
+			s->prev[pos & WINDOW_MASK] = s->head[hash];
+			s->head[hash] = (int)pos;
+		}
+	}
+}
+
+/* every match at 'pos' that is longer than the ones nearer to it, so the
+   closest match for any length is the first one at least that long */
+static int findMatches(OptimalState *s, u32 pos, u32 limit, Match *out)
+{
+	const u8 *cur = s->data + pos;
+	u32 best = MIN_MATCH - 1;
+	int count = 0, chain = MAX_CHAIN;
+	int candidate;
+	
+	if (limit > MAX_MATCH)
+		limit = MAX_MATCH;
+	
+	if (limit < MIN_MATCH)
+		return 0;
+	
+	insertPositions(s, pos);
+	candidate = s->head[hash3(cur)];
+	
+	while (candidate >= 0 && pos - (u32)candidate <= WINDOW_SIZE && chain-- > 0)
+	{
+		const u8 *match = s->data + candidate;
+		int next;
+		
+		/* only a longer match is any use */
+		if (match[best] == cur[best] && match[0] == cur[0] && match[1] == cur[1])
+		{
+			u32 length = 2;
+			
+			while (length < limit && match[length] == cur[length])
+				length++;
+			
+			if (length > best)
+			{
+				out[count].length = (u16)length;
+				out[count].distance = (u16)(pos - candidate);
+				best = length;
+				
+				if (++count == MAX_MATCHES || length == limit)
+					break;
+			}
+		}
+		
+		/* links from before the window have been reused */
+		next = s->prev[candidate & WINDOW_MASK];
+		
+		if (next >= candidate)
+			break;
+		
+		candidate = next;
+	}
+	
+	return count;
+}
+
+static void costsFromLengths(const CodeLengths *lengths, CostModel *model)
+{
+	int i;
+	
+	for (i = 0; i < LITLEN_CODES; i++)
+		model->litlen[i] = lengths->litlen[i];
+	
+	for (i = 0; i < DIST_CODES; i++)
+		model->dist[i] = lengths->dist[i];
+}
+
+/* -log2 of each symbol's frequency, symbols not seen are priced as if they
+   were seen once */
+static void entropyCosts(const u32 *counts, int n, float *costs)
+{
+	double total = 0, bits;
+	int i;
+	
+	for (i = 0; i < n; i++)
+		total += counts[i];
+	
+	for (i = 0; i < n; i++)
+	{
+		bits = log2((total > 1) ? (total) : (1)) - log2((counts[i]) ? (counts[i]) : (1));
+		costs[i] = (float)((bits < 1) ? (1) : (bits));
+	}
+}
+
+static void fixedLengths(CodeLengths *lengths)
+{
+	int i;
+	
+	for (i = 0; i < FIXED_LITLEN_CODES; i++)
+		lengths->litlen[i] = (i < 144) ? (8) : ((i < 256) ? (9) : ((i < 280) ? (7) : (8)));
+	
+	for (i = 0; i < DIST_CODES; i++)
+		lengths->dist[i] = 5;
+}
+
+/* huffman code lengths no longer than 'limit'. deflate readers want complete
+   codes, so there are always at least two. */
+static void buildLengths(const u32 *counts, int n, int limit, u8 *lengths)
+{
+	int symbols[LITLEN_CODES], parent[2 * LITLEN_CODES], depth[2 * LITLEN_CODES];
+	u32 weight[2 * LITLEN_CODES];
+	int used = 0, leaf, node, next, i, j, longest = 0;
+	
+	memset(lengths, 0, n);
+	
+	for (i = 0; i < n; i++)
+	{
+		if (counts[i])
+			symbols[used++] = i;
+	}
+	
+	if (used < 2)
+	{
+		lengths[(used && symbols[0] == 0) ? (1) : (0)] = 1;
+		lengths[(used) ? (symbols[0]) : (1)] = 1;
+		return;
+	}
+	
+	/* least frequent first */
+	for (i = 1; i < used; i++)
+	{
+		int symbol = symbols[i];
+		
+		for (j = i; j > 0 && counts[symbols[j - 1]] > counts[symbol]; j--)
+			symbols[j] = symbols[j - 1];
+		
+		symbols[j] = symbol;
+	}
+	
+	/* leaves and merged nodes both come out in order of weight, so the two
+	   lightest are always at the front of one queue or the other */
+	for (i = 0; i < used; i++)
+		weight[i] = counts[symbols[i]];
+	
+	leaf = 0;
+	node = used;
+	
+	for (next = used; next < 2 * used - 1; next++)
+	{
+		int pick[2];
+		
+		for (j = 0; j < 2; j++)
+		{
+			if (leaf < used && (node >= next || weight[leaf] <= weight[node]))
+				pick[j] = leaf++;
+			else
+				pick[j] = node++;
+		}
+		
+		weight[next] = weight[pick[0]] + weight[pick[1]];
+		parent[pick[0]] = parent[pick[1]] = next;
+	}
+	
+	depth[2 * used - 2] = 0;
+	
+	for (i = 2 * used - 3; i >= 0; i--)
+		depth[i] = depth[parent[i]] + 1;
+	
+	for (i = 0; i < used; i++)
+	{
+		lengths[symbols[i]] = (u8)((depth[i] < limit) ? (depth[i]) : (limit));
+		
+		if (depth[i] > longest)
+			longest = depth[i];
+	}
+	
+	if (longest > limit)
+	{
+		u32 kraft = 0, target = 1u << limit;
+		
+		for (i = 0; i < used; i++)
+			kraft += 1u << (limit - lengths[symbols[i]]);
+		
+		/* clamping oversubscribed the code, lengthen the rarest of the
+		   longest codes that can still grow */
+		while (kraft > target)
+		{
+			int pick = -1;
+			
+			for (i = 0; i < used; i++)
+			{
+				int length = lengths[symbols[i]];
+				
+				if (length < limit && (pick < 0 || length > lengths[symbols[pick]]))
+					pick = i;
+			}
+			
+			kraft -= 1u << (limit - lengths[symbols[pick]] - 1);
+			lengths[symbols[pick]]++;
+		}
+		
+		/* then fill any gap that leaves by shortening the most common codes */
+		while (kraft < target)
+		{
+			int pick = -1;
+			
+			for (i = used - 1; i >= 0; i--)
+			{
+				int length = lengths[symbols[i]];
+				
+				if (length > 1 && kraft + (1u << (limit - length)) <= target && (pick < 0 || length > lengths[symbols[pick]]))
+					pick = i;
+			}
+			
+			kraft += 1u << (limit - lengths[symbols[pick]]);
+			lengths[symbols[pick]]--;
+		}
+	}
+}
+
+/* canonical codes, bit reversed since deflate sends them most significant
+   bit first */
+static void buildCodes(const u8 *lengths, int n, u16 *codes)
+{
+	u16 count[MAX_CODE_LENGTH + 1], next[MAX_CODE_LENGTH + 1];
+	u32 code = 0;
+	int i, bits;
+	
+	memset(count, 0, sizeof(count));
+	
+	for (i = 0; i < n; i++)
+		count[lengths[i]]++;
+	
+	count[0] = 0;
+	
+	for (bits = 1; bits <= MAX_CODE_LENGTH; bits++)
+	{
+		code = (code + count[bits - 1]) << 1;
+		next[bits] = (u16)code;
+	}
+	
+	for (i = 0; i < n; i++)
+	{
+		u32 value, reversed = 0;
+		
+		if (lengths[i] == 0)
+			continue;
+		
+		value = next[lengths[i]]++;
+		
+		for (bits = 0; bits < lengths[i]; bits++)
+		{
+			reversed = (reversed << 1) | (value & 1);
+			value >>= 1;
+		}
+		
+		codes[i] = (u16)reversed;
+	}
+}
+
+/* cheapest path through the block by the costs in 'model' */
+static u32 parseBlock(OptimalState *s, u32 start, u32 n, const CostModel *model, Match *parse)
+{
+	const u8 *block = s->data + start;
+	float lengthCost[MAX_MATCH + 1], distCost[DIST_CODES];
+	u32 i, k, count = 0;
+	
+	for (i = MIN_MATCH; i <= MAX_MATCH; i++)
+		lengthCost[i] = model->litlen[257 + s->lengthCode[i]] + lengthExtra[s->lengthCode[i]];
+	
+	for (i = 0; i < DIST_CODES; i++)
+		distCost[i] = model->dist[i] + distExtra[i];
+	
+	s->cost[0] = 0;
+	
+	for (i = 1; i <= n; i++)
+		s->cost[i] = HUGE_VALF;
+	
+	for (i = 0; i < n; i++)
+	{
+		const Match *match = s->matches + (size_t)i * MAX_MATCHES;
+		float cost = s->cost[i] + model->litlen[block[i]];
+		u32 length = MIN_MATCH;
+		
+		if (cost < s->cost[i + 1])
+		{
+			s->cost[i + 1] = cost;
+			s->step[i + 1].length = 1;
+			s->step[i + 1].distance = 0;
+		}
+		
+		/* inside long repeats only the longest match is worth pricing */
+		if (s->matchCount[i] && match[s->matchCount[i] - 1].length == MAX_MATCH)
+			length = MAX_MATCH;
+
+		/* each length is cheapest at the nearest match that reaches it */
+		for (k = 0; k < s->matchCount[i]; k++)
+		{
+			float base = s->cost[i] + distCost[s->distCode[match[k].distance]];
+			
+			for (; length <= match[k].length; length++)
+			{
+				cost = base + lengthCost[length];
+				
+				if (cost < s->cost[i + length])
+				{
+					s->cost[i + length] = cost;
+					s->step[i + length] = match[k];
+					s->step[i + length].length = (u16)length;
+				}
+			}
+		}
+	}
+	
+	/* walk back from the end, then put the steps in order */
+	for (i = n; i > 0; i -= s->step[i].length)
+		parse[count++] = s->step[i];
+	
+	for (i = 0; i < count / 2; i++)
+	{
+		Match swap = parse[i];
+		parse[i] = parse[count - 1 - i];
+		parse[count - 1 - i] = swap;
+	}
+	
+	return count;
+}
+
+static void countSymbols(const OptimalState *s, u32 pos, const Match *parse, u32 count, SymbolCounts *counts)
+{
+	u32 i;
+	
+	memset(counts, 0, sizeof(SymbolCounts));
+	
+	for (i = 0; i < count; i++)
+	{
+		if (parse[i].length == 1)
+		{
+			counts->litlen[s->data[pos]]++;
+		}
+		else
+		{
+			counts->litlen[257 + s->lengthCode[parse[i].length]]++;
+			counts->dist[s->distCode[parse[i].distance]]++;
+		}
+		
+		pos += parse[i].length;
+	}
+	
+	counts->litlen[END_OF_BLOCK]++;
+}
+
+/* bits taken by the symbols of a block, without its header */
+static u64 symbolBits(const SymbolCounts *counts, const CodeLengths *lengths)
+{
+	u64 bits = 0;
+	int i;
+	
+	for (i = 0; i < LITLEN_CODES; i++)
+		bits += (u64)counts->litlen[i] * (lengths->litlen[i] + ((i > END_OF_BLOCK) ? (lengthExtra[i - 257]) : (0)));
+	
+	for (i = 0; i < DIST_CODES; i++)
+		bits += (u64)counts->dist[i] * (lengths->dist[i] + distExtra[i]);
+	
+	return bits;
+}
+
+/* run length code the code lengths, returning the number of symbols */
+static int runLengths(const u8 *lengths, int n, u8 *symbols, u8 *extras)
+{
+	int i = 0, count = 0;
+	
+	while (i < n)
+	{
+		u8 value = lengths[i];
+		int run = 1;
+		
+		while (i + run < n && lengths[i + run] == value)
+			run++;
+		
+		i += run;
+		
+		if (value == 0)
+		{
+			while (run >= 11)
+			{
+				int repeat = (run < 138) ? (run) : (138);
+				symbols[count] = 18;
+				extras[count++] = (u8)(repeat - 11);
+				run -= repeat;
+			}
+			
+			if (run >= 3)
+			{
+				symbols[count] = 17;
+				extras[count++] = (u8)(run - 3);
+				run = 0;
+			}
+		}
+		else
+		{
+			symbols[count] = value;
+			extras[count++] = 0;
+			run--;
+			
+			while (run >= 3)
+			{
+				int repeat = (run < 6) ? (run) : (6);
+				symbols[count] = 16;
+				extras[count++] = (u8)(repeat - 3);
+				run -= repeat;
+			}
+		}
+		
+		while (run-- > 0)
+		{
+			symbols[count] = value;
+			extras[count++] = 0;
+		}
+	}
+	
+	return count;
+}
+
+static void writeDynamicHeader(BitWriter *w, const CodeLengths *lengths)
+{
+	u8 all[LITLEN_CODES + DIST_CODES], symbols[LITLEN_CODES + DIST_CODES], extras[LITLEN_CODES + DIST_CODES];
+	u8 codelenLengths[CODELEN_CODES];
+	u16 codelenCodes[CODELEN_CODES];
+	u32 counts[CODELEN_CODES];
+	int litlen = LITLEN_CODES, dist = DIST_CODES, codelen = CODELEN_CODES;
+	int count, i;
+	
+	while (litlen > 257 && lengths->litlen[litlen - 1] == 0)
+		litlen--;
+	
+	while (dist > 1 && lengths->dist[dist - 1] == 0)
+		dist--;
+	
+	memcpy(all, lengths->litlen, litlen);
+	memcpy(all + litlen, lengths->dist, dist);
+	count = runLengths(all, litlen + dist, symbols, extras);
+	
+	memset(counts, 0, sizeof(counts));
+	
+	for (i = 0; i < count; i++)
+		counts[symbols[i]]++;
+	
+	buildLengths(counts, CODELEN_CODES, MAX_CODELEN_LENGTH, codelenLengths);
+	buildCodes(codelenLengths, CODELEN_CODES, codelenCodes);
+	
+	while (codelen > 4 && codelenLengths[codelenOrder[codelen - 1]] == 0)
+		codelen--;
+	
+	putBits(w, litlen - 257, 5);
+	putBits(w, dist - 1, 5);
+	putBits(w, codelen - 4, 4);
+	
+	for (i = 0; i < codelen; i++)
+		putBits(w, codelenLengths[codelenOrder[i]], 3);
+	
+	for (i = 0; i < count; i++)
+	{
+		putBits(w, codelenCodes[symbols[i]], codelenLengths[symbols[i]]);
+		
+		if (symbols[i] == 16)
+			putBits(w, extras[i], 2);
+		else if (symbols[i] == 17)
+			putBits(w, extras[i], 3);
+		else if (symbols[i] == 18)
+			putBits(w, extras[i], 7);
+	}
+}
+
+static u64 dynamicHeaderBits(const CodeLengths *lengths)
+{
+	BitWriter w;
+	memset(&w, 0, sizeof(BitWriter));
+	writeDynamicHeader(&w, lengths);
+	return (u64)w.pos * 8 + w.count;
+}
+
+static void writeSymbols(BitWriter *w, const OptimalState *s, u32 pos, const Match *parse, u32 count, const CodeLengths *lengths)
+{
+	u16 litlenCodes[FIXED_LITLEN_CODES], distCodes[DIST_CODES];
+	u32 i;
+	
+	buildCodes(lengths->litlen, FIXED_LITLEN_CODES, litlenCodes);
+	buildCodes(lengths->dist, DIST_CODES, distCodes);
+	
+	for (i = 0; i < count; i++)
+	{
+		u32 length = parse[i].length, distance = parse[i].distance;
+		
+		if (length == 1)
+		{
+			u8 byte = s->data[pos];
+			putBits(w, litlenCodes[byte], lengths->litlen[byte]);
+		}
+		else
+		{
+			int code = s->lengthCode[length];
+			putBits(w, litlenCodes[257 + code], lengths->litlen[257 + code]);
+			putBits(w, length - lengthBase[code], lengthExtra[code]);
+			
+			code = s->distCode[distance];
+			putBits(w, distCodes[code], lengths->dist[code]);
+			putBits(w, distance - distBase[code], distExtra[code]);
+		}
+		
+		pos += length;
+	}
+	
+	putBits(w, litlenCodes[END_OF_BLOCK], lengths->litlen[END_OF_BLOCK]);
+}
+
+static void writeStored(BitWriter *w, const u8 *data, u32 n, int last)
+{
+	do
+	{
+		u32 chunk = (n < 0xFFFF) ? (n) : (0xFFFF);
+		u32 i;
+		
+		putBits(w, last && chunk == n, 1);
+		putBits(w, 0, 2);
+		alignBits(w);
+		putBits(w, chunk, 16);
+		putBits(w, ~chunk & 0xFFFF, 16);
+		
+		for (i = 0; i < chunk; i++)
+			putBits(w, data[i], 8);
+		
+		data += chunk;
+		n -= chunk;
+	} while (n > 0);
+}
+
+static void compressBlock(OptimalState *s, u32 start, u32 n, int last, BitWriter *w)
+{
+	SymbolCounts counts, bestCounts;
+	CodeLengths lengths, best, fixed;
+	CostModel model;
+	u64 bits, bestBits = ~(u64)0, fixedBits, storedBits;
+	u32 i, count, bestCount = 0;
+	int pass;
+	
+	for (i = 0; i < n; i++)
+		s->matchCount[i] = (u8)findMatches(s, start + i, n - i, s->matches + (size_t)i * MAX_MATCHES);
+	
+	/* the first pass prices symbols as the fixed code would, later passes
+	   by how often the one before used them */
+	fixedLengths(&fixed);
+	costsFromLengths(&fixed, &model);
+	
+	/* dynamic codes never use the last two */
+	memset(&lengths, 0, sizeof(lengths));
+	
+	for (pass = 0; pass < PARSE_PASSES; pass++)
+	{
+		count = parseBlock(s, start, n, &model, s->parse);
+		countSymbols(s, start, s->parse, count, &counts);
+		buildLengths(counts.litlen, LITLEN_CODES, MAX_CODE_LENGTH, lengths.litlen);
+		buildLengths(counts.dist, DIST_CODES, MAX_CODE_LENGTH, lengths.dist);
+		
+		bits = dynamicHeaderBits(&lengths) + symbolBits(&counts, &lengths);
+		
+		if (bits < bestBits)
+		{
+			Match *swap = s->bestParse;
+			s->bestParse = s->parse;
+			s->parse = swap;
+			
+			bestBits = bits;
+			bestCount = count;
+			bestCounts = counts;
+			best = lengths;
+		}
+		
+		entropyCosts(counts.litlen, LITLEN_CODES, model.litlen);
+		entropyCosts(counts.dist, DIST_CODES, model.dist);
+	}
+	
+	/* small blocks can do better on the fixed code, random ones stored */
+	fixedBits = symbolBits(&bestCounts, &fixed);
+	storedBits = ((u64)n + 5 * ((n + 0xFFFE) / 0xFFFF)) * 8 + 7;
+	
+	if (storedBits < bestBits && storedBits < fixedBits)
+	{
+		writeStored(w, s->data + start, n, last);
+	}
+	else if (fixedBits <= bestBits)
+	{
+		putBits(w, last, 1);
+		putBits(w, 1, 2);
+		writeSymbols(w, s, start, s->bestParse, bestCount, &fixed);
+	}
+	else
+	{
+		putBits(w, last, 1);
+		putBits(w, 2, 2);
+		writeDynamicHeader(w, &best);
+		writeSymbols(w, s, start, s->bestParse, bestCount, &best);
+	}
+}
+
+int deflateOptimal(void *outbuffer, u32 outsize, const void *inbuffer, u32 insize, const void *dict, u32 dictsize, int finish)
+{
+	OptimalState *s;
+	BitWriter w;
+	u8 *data = NULL;
+	u32 start, i;
+	int code, res = -1;
+	
+	/* nothing further back can be reached */
+	if (dictsize > WINDOW_SIZE)
+	{
+		dict = (const u8 *)dict + dictsize - WINDOW_SIZE;
+		dictsize = WINDOW_SIZE;
+	}
+	
+	s = (OptimalState *)calloc(1, sizeof(OptimalState));
+	
+	if (s == NULL)
+		return -1;
+	
+	/* one buffer so matches can run from the dictionary into the input */
+	data = (u8 *)malloc((size_t)dictsize + insize + 1);
+	s->head = (int *)malloc(HASH_SIZE * sizeof(int));
+	s->prev = (int *)malloc(WINDOW_SIZE * sizeof(int));
+	s->matches = (Match *)malloc((size_t)BLOCK_SIZE * MAX_MATCHES * sizeof(Match));
+	s->matchCount = (u8 *)malloc(BLOCK_SIZE);
+	s->cost = (float *)malloc((BLOCK_SIZE + 1) * sizeof(float));
+	s->step = (Match *)malloc((BLOCK_SIZE + 1) * sizeof(Match));
+	s->parse = (Match *)malloc(BLOCK_SIZE * sizeof(Match));
+	s->bestParse = (Match *)malloc(BLOCK_SIZE * sizeof(Match));
+	
+	if (!data || !s->head || !s->prev || !s->matches || !s->matchCount || !s->cost || !s->step || !s->parse || !s->bestParse)
+		goto done;
+	
+	if (dictsize)
+		memcpy(data, dict, dictsize);
+	
+	if (insize)
+		memcpy(data + dictsize, inbuffer, insize);
+	
+	s->data = data;
+	s->size = dictsize + insize;
+	memset(s->head, 0xFF, HASH_SIZE * sizeof(int));
+	
+	for (code = 0; code < 29; code++)
+	{
+		u32 end = (code < 28) ? (lengthBase[code + 1]) : (MAX_MATCH + 1);
+		
+		for (i = lengthBase[code]; i < end; i++)
+			s->lengthCode[i] = (u8)code;
+	}
+	
+	for (code = 0; code < DIST_CODES; code++)
+	{
+		u32 end = (code < DIST_CODES - 1) ? (distBase[code + 1]) : (WINDOW_SIZE + 1);
+		
+		for (i = distBase[code]; i < end; i++)
+			s->distCode[i] = (u8)code;
+	}
+	
+	memset(&w, 0, sizeof(BitWriter));
+	w.out = (u8 *)outbuffer;
+	w.size = outsize;
+	
+	for (start = 0; start < insize; start += BLOCK_SIZE)
+	{
+		u32 n = (insize - start < BLOCK_SIZE) ? (insize - start) : (BLOCK_SIZE);
+		compressBlock(s, dictsize + start, n, finish && start + n == insize, &w);
+	}
+	
+	if (finish && insize == 0)
+	{
+		/* an empty fixed block */
+		putBits(&w, 1, 1);
+		putBits(&w, 1, 2);
+		putBits(&w, 0, 7);
+	}
+	
+	if (!finish)
+	{
+		/* an empty stored block, as Z_SYNC_FLUSH leaves */
+		putBits(&w, 0, 3);
+		alignBits(&w);
+		putBits(&w, 0x0000, 16);
+		putBits(&w, 0xFFFF, 16);
+	}
+	
+	alignBits(&w);
+	res = (w.overflow) ? (-2) : ((int)w.pos);
+	
+done:
+	free(data);
+	free(s->head);
+	free(s->prev);
+	free(s->matches);
+	free(s->matchCount);
+	free(s->cost);
+	free(s->step);
+	free(s->parse);
+	free(s->bestParse);
+	free(s);
+	return res;
+}
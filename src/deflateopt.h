@@ -0,0 +1,47 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#ifndef DEFLATEOPT_H_
+#define DEFLATEOPT_H_
+
+#include "gzip.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+// raw deflate by iterated optimal parsing. every match the hash chains turn
+// up is kept, and the cheapest path through them is found again and again
+// with symbol costs taken from the previous pass. much slower than zlib,
+// for builds where size matters more than time. matches can reach back into
+// 'dict', which precedes the input. the stream is finished if 'finish' is
+// set, otherwise it ends byte aligned on a sync flush. returns the
+// compressed size, -1 if out of memory or -2 if outbuffer is too small.
+int deflateOptimal(void *outbuffer, u32 outsize, const void *inbuffer, u32 insize, const void *dict, u32 dictsize, int finish);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+#endif // DEFLATEOPT_H_
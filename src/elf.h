@@ -36,6 +36,14 @@ typedef uint8_t u8;
 #define ELF_MAGIC       (0x464C457F)
 #define ELF_TYPE_PRX    (0xFFA0)
 
+#define SHT_PROGBITS    (1)
+#define SHT_STRTAB      (3)
+#define SHT_NOBITS      (8)
+#define SHT_REL         (9)
+#define SHT_PRXRELOC    (0x700000A0)
+
+#define SHF_ALLOC       (2)
+
 typedef struct {
 	u32		e_magic;
 	u8		e_class;
@@ -0,0 +1,187 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#include "elfstrip.h"
+#include "elf.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+    bool inside(size_t offset, size_t length, size_t size)
+    {
+        return offset <= size && length <= size - offset;
+    }
+    
+    bool overlaps(size_t a, size_t aLength, size_t b, size_t bLength)
+    {
+        return a < b + bLength && b < a + aLength;
+    }
+    
+    bool sectionNeeded(const Elf32_Ehdr *ehdr, const Elf32_Shdr& section, int index)
+    {
+        return index == 0 
+        || index == ehdr->e_shstrndx 
+        || (section.sh_flags & SHF_ALLOC) != 0 
+        || section.sh_type == SHT_REL 
+        || section.sh_type == SHT_PRXRELOC;
+    }
+}
+
+bool strip_elf(const char *elf, size_t size, ExecBuffer& output)
+{
+    if (size < sizeof(Elf32_Ehdr))
+    {
+        return false;
+    }
+    
+    auto ehdr = (const Elf32_Ehdr *)elf;
+    auto phdr = (const Elf32_Phdr *)(elf + ehdr->e_phoff);
+    auto shdr = (const Elf32_Shdr *)(elf + ehdr->e_shoff);
+    auto headersEnd = (size_t)ehdr->e_phoff + (size_t)ehdr->e_phnum * sizeof(Elf32_Phdr);
+    
+    if (!inside(ehdr->e_phoff, (size_t)ehdr->e_phnum * sizeof(Elf32_Phdr), size) 
+    || !inside(ehdr->e_shoff, (size_t)ehdr->e_shnum * sizeof(Elf32_Shdr), size) 
+    || ehdr->e_shnum == 0 || ehdr->e_shstrndx >= ehdr->e_shnum)
+    {
+        return false;
+    }
+    
+    // everything up to the end of the last segment stays where it is
+    auto keepEnd = std::max(headersEnd, sizeof(Elf32_Ehdr));
+    
+    for (int i = 0; i < ehdr->e_phnum; ++i)
+    {
+        if (!inside(phdr[i].p_offset, phdr[i].p_filesz, size))
+        {
+            return false;
+        }
+        
+        keepEnd = std::max(keepEnd, (size_t)phdr[i].p_offset + phdr[i].p_filesz);
+    }
+    
+    for (int i = 0; i < ehdr->e_shnum; ++i)
+    {
+        if (shdr[i].sh_type != SHT_NOBITS && !inside(shdr[i].sh_offset, shdr[i].sh_size, size))
+        {
+            return false;
+        }
+    }
+    
+    output.assign(elf, elf + keepEnd);
+    
+    std::vector<int> newIndex(ehdr->e_shnum, 0);
+    std::vector<Elf32_Shdr> sections;
+    
+    for (int i = 0; i < ehdr->e_shnum; ++i)
+    {
+        if (sectionNeeded(ehdr, shdr[i], i))
+        {
+            newIndex[i] = (int)sections.size();
+            sections.push_back(shdr[i]);
+            continue;
+        }
+        
+        if (shdr[i].sh_type == SHT_NOBITS || shdr[i].sh_offset >= keepEnd)
+        {
+            continue;
+        }
+        
+        // zero dropped data left in between, unless it shares bytes with
+        // something that is kept
+        auto offset = (size_t)shdr[i].sh_offset;
+        auto length = std::min<size_t>(shdr[i].sh_size, keepEnd - offset);
+        auto shared = overlaps(offset, length, 0, headersEnd);
+        
+        for (int j = 0; j < ehdr->e_phnum && !shared; ++j)
+        {
+            shared = overlaps(offset, length, phdr[j].p_offset, phdr[j].p_filesz);
+        }
+        
+        for (int j = 0; j < ehdr->e_shnum && !shared; ++j)
+        {
+            shared = (shdr[j].sh_type != SHT_NOBITS && sectionNeeded(ehdr, shdr[j], j) && overlaps(offset, length, shdr[j].sh_offset, shdr[j].sh_size));
+        }
+        
+        if (!shared)
+        {
+            std::memset(output.data() + offset, 0, length);
+        }
+    }
+    
+    for (auto& section : sections)
+    {
+        // links and targets may have been dropped
+        section.sh_link = (section.sh_link < ehdr->e_shnum) ? (newIndex[section.sh_link]) : (0);
+        
+        if (section.sh_type == SHT_REL || section.sh_type == SHT_PRXRELOC)
+        {
+            section.sh_info = (section.sh_info < ehdr->e_shnum) ? (newIndex[section.sh_info]) : (0);
+        }
+        
+        if (section.sh_type == SHT_NOBITS || section.sh_size == 0 || section.sh_offset + section.sh_size <= keepEnd)
+        {
+            continue;
+        }
+        
+        // past the segments, so move it up behind whatever came before
+        auto data = elf + section.sh_offset;
+        auto align = std::max<size_t>(section.sh_addralign, 1);
+        output.resize((output.size() + align - 1) / align * align);
+        section.sh_offset = (u32)output.size();
+        output.insert(output.end(), data, data + section.sh_size);
+    }
+    
+    output.resize((output.size() + 3) & ~(size_t)3);
+    
+    auto newEhdr = (Elf32_Ehdr *)output.data();
+    newEhdr->e_shoff = (u32)output.size();
+    newEhdr->e_shnum = (u16)sections.size();
+    newEhdr->e_shstrndx = (u16)newIndex[ehdr->e_shstrndx];
+    
+    auto table = (const char *)sections.data();
+    output.insert(output.end(), table, table + sections.size() * sizeof(Elf32_Shdr));
+    return true;
+}
+
+bool strip_prepared_elf(PreparedExec& prepared, const char *&elf, u32& size, ExecBuffer& stripped)
+{
+    if (!strip_elf(elf, size, stripped))
+    {
+        return false;
+    }
+    
+    // an ELF with nothing to strip can only grow
+    if (stripped.size() < size)
+    {
+        elf = stripped.data();
+        size = (u32)stripped.size();
+        prepared.header.elf_size = size;
+    }
+    
+    return true;
+}
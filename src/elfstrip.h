@@ -0,0 +1,47 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#ifndef ELFSTRIP_H_
+#define ELFSTRIP_H_
+
+#include <cstddef>
+
+#include "packexec.h"
+
+// copy what the PSP loader reads out of a PRX ELF into 'output': the
+// headers, every segment, the allocated sections, the relocations and the
+// section names. sections past the last segment that aren't needed are
+// dropped and the rest moved up behind it, under a new section header
+// table. dropped sections between the segments are zeroed rather than moved,
+// so segment offsets and the module info offset stay the same. returns false
+// if the headers point outside the ELF.
+bool strip_elf(const char *elf, size_t size, ExecBuffer& output);
+
+// strip the prepared ELF at 'elf' into 'stripped' if that makes it smaller,
+// pointing 'elf' and 'size' at the result and updating the header's
+// elf_size to match. returns false if the ELF is broken.
+bool strip_prepared_elf(PreparedExec& prepared, const char *&elf, u32& size, ExecBuffer& stripped);
+
+#endif // ELFSTRIP_H_
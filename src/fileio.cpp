@@ -0,0 +1,474 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#include "fileio.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <cerrno>
+#include <climits>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#endif
+
+// segments smaller than this aren't worth the extra calls to copy by range
+#define COPY_RANGE_MIN  (64 * 1024)
+
+bool MappedFile::open(const std::string& path)
+{
+    close();
+    
+#ifdef _WIN32
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    
+    if (!file.is_open())
+    {
+        return false;
+    }
+    
+    m_size = (size_t)file.tellg();
+    m_buffer.reset(new char[m_size ? m_size : 1]);
+    m_data = m_buffer.get();
+    
+    file.seekg(0);
+    return (bool)file.read(m_data, m_size);
+#else
+    auto fd = ::open(path.c_str(), O_RDONLY);
+    
+    if (fd < 0)
+    {
+        return false;
+    }
+    
+    struct stat st;
+    
+    if (fstat(fd, &st) != 0)
+    {
+        ::close(fd);
+        return false;
+    }
+    
+    m_size = st.st_size;
+    
+    // private and writable: pages we patch get copied, the file never changes
+    if (m_size != 0)
+    {
+        auto map = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        
+        if (map != MAP_FAILED)
+        {
+            m_data = (char *)map;
+            m_mapped = true;
+            m_fd = fd;
+            return true;
+        }
+    }
+    
+    // can't map it (pipes, odd filesystems), read it instead
+    m_buffer.reset(new char[m_size ? m_size : 1]);
+    m_data = m_buffer.get();
+    
+    for (size_t offset = 0; offset < m_size; )
+    {
+        auto res = pread(fd, m_data + offset, m_size - offset, offset);
+        
+        if (res <= 0)
+        {
+            ::close(fd);
+            close();
+            return false;
+        }
+        
+        offset += res;
+    }
+    
+    m_fd = fd;
+    return true;
+#endif
+}
+
+void MappedFile::close(void)
+{
+#ifndef _WIN32
+    if (m_mapped)
+    {
+        munmap(m_data, m_size);
+    }
+    
+    if (m_fd >= 0)
+    {
+        ::close(m_fd);
+    }
+#endif
+    
+    m_buffer.reset();
+    m_data = nullptr;
+    m_size = 0;
+    m_mapped = false;
+    m_fd = -1;
+}
+
+#ifndef _WIN32
+bool writeSegments(int fd, const std::vector<ExecView>& segments)
+{
+    std::vector<iovec> iov;
+    
+    for (auto& segment : segments)
+    {
+        if (segment.size != 0)
+        {
+            iov.push_back({ (void *)segment.data, segment.size });
+        }
+    }
+    
+    // gather everything in as few calls as possible, picking up after short
+    // writes where they left off
+    auto next = iov.begin();
+    
+    while (next != iov.end())
+    {
+        auto count = std::min<size_t>(iov.end() - next, IOV_MAX);
+        auto res = writev(fd, &*next, (int)count);
+        
+        if (res <= 0)
+        {
+            return false;
+        }
+        
+        while (next != iov.end() && (size_t)res >= next->iov_len)
+        {
+            res -= next->iov_len;
+            ++next;
+        }
+        
+        if (next != iov.end())
+        {
+            next->iov_base = (char *)next->iov_base + res;
+            next->iov_len -= res;
+        }
+    }
+    
+    return true;
+}
+
+namespace
+{
+    // copy 'size' bytes at 'offset' in 'in' to the end of 'out', which is
+    // where its position is. returns how much was copied, the caller writes
+    // whatever is left the ordinary way.
+    size_t copyRange(int in, off_t offset, int out, size_t size)
+    {
+        size_t copied = 0;
+        
+#ifdef __linux__
+        struct stat st;
+        auto position = lseek(out, 0, SEEK_CUR);
+        
+        // sharing blocks needs both ends on the same block boundary, the
+        // tail can be partial because it runs to the end of the input
+        if (position >= 0 && fstat(out, &st) == 0 && st.st_blksize > 0 && offset % st.st_blksize == 0 && position % st.st_blksize == 0)
+        {
+            file_clone_range range;
+            range.src_fd = in;
+            range.src_offset = offset;
+            range.src_length = size;
+            range.dest_offset = position;
+            
+            if (ioctl(out, FICLONERANGE, &range) == 0 && lseek(out, position + size, SEEK_SET) >= 0)
+            {
+                return size;
+            }
+        }
+        
+#ifdef SYS_copy_file_range
+        // in-kernel copy, which some filesystems turn into a reflink or a
+        // server side copy themselves
+        while (copied < size)
+        {
+            loff_t from = offset + copied;
+            auto res = syscall(SYS_copy_file_range, in, &from, out, nullptr, size - copied, 0);
+            
+            if (res <= 0)
+            {
+                if (res < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                
+                break;
+            }
+            
+            copied += res;
+        }
+#endif
+        
+        // older kernels and copies across filesystems
+        while (copied < size)
+        {
+            off_t from = offset + copied;
+            auto res = sendfile(out, in, &from, size - copied);
+            
+            if (res <= 0)
+            {
+                if (res < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                
+                break;
+            }
+            
+            copied += res;
+        }
+#endif
+        
+        return copied;
+    }
+    
+    // write the segments, copying the ones in 'source' straight from its file
+    bool writeSegmentsFrom(int fd, const std::vector<ExecView>& segments, const MappedFile *source)
+    {
+        if (source == nullptr || source->fd() < 0)
+        {
+            return writeSegments(fd, segments);
+        }
+        
+        auto begin = source->data();
+        std::vector<ExecView> pending;
+        
+        for (auto& segment : segments)
+        {
+            if (segment.size < COPY_RANGE_MIN || segment.data < begin || segment.data + segment.size > begin + source->size())
+            {
+                pending.push_back(segment);
+                continue;
+            }
+            
+            if (!writeSegments(fd, pending))
+            {
+                return false;
+            }
+            
+            pending.clear();
+            
+            auto copied = copyRange(source->fd(), segment.data - begin, fd, segment.size);
+            pending.push_back({ segment.data + copied, segment.size - copied });
+        }
+        
+        return writeSegments(fd, pending);
+    }
+    
+    // create a file next to 'path' under a name nothing else is using. unlike
+    // mkstemp's 0600 it gets 0666 less the umask, as any new file would.
+    int openTemp(const std::string& path, std::string& temp)
+    {
+        static const char digits[] = "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+        static std::atomic<u32> counter(0);
+        
+        for (auto attempt = 0; attempt < 100; ++attempt)
+        {
+            auto value = ((u64)getpid() << 32 | counter++) ^ (u64)std::chrono::steady_clock::now().time_since_epoch().count();
+            value *= 0x9E3779B97F4A7C15ull;
+            temp = path + ".";
+            
+            for (auto i = 0; i < 6; ++i)
+            {
+                temp += digits[(value >> 58) % 62];
+                value <<= 6;
+            }
+            
+            auto fd = ::open(temp.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+            
+            if (fd >= 0 || errno != EEXIST)
+            {
+                return fd;
+            }
+        }
+        
+        return -1;
+    }
+    
+    // copy the first 'size' bytes of 'in' over 'out' and cut it off there
+    bool copyOver(int in, int out, size_t size)
+    {
+        if (lseek(out, 0, SEEK_SET) < 0)
+        {
+            return false;
+        }
+        
+        auto copied = copyRange(in, 0, out, size);
+        char buffer[64 * 1024];
+        
+        while (copied < size)
+        {
+            auto res = pread(in, buffer, std::min(sizeof(buffer), size - copied), copied);
+            
+            if (res <= 0)
+            {
+                if (res < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                
+                return false;
+            }
+            
+            if (!writeSegments(out, { { buffer, (size_t)res } }))
+            {
+                return false;
+            }
+            
+            copied += res;
+        }
+        
+        return ftruncate(out, size) == 0;
+    }
+}
+#endif
+
+bool writeFileAtomic(const std::string& path, const std::vector<ExecView>& segments, const MappedFile *source)
+{
+#ifdef _WIN32
+    auto temp = path + ".tmp";
+    
+    {
+        std::ofstream file(temp, std::ios::binary);
+        
+        for (auto& segment : segments)
+        {
+            file.write(segment.data, segment.size);
+        }
+        
+        if (!file)
+        {
+            std::remove(temp.c_str());
+            return false;
+        }
+    }
+    
+    if (!MoveFileExA(temp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING))
+    {
+        std::remove(temp.c_str());
+        return false;
+    }
+    
+    return true;
+#else
+    FileReplacement file;
+    
+    if (!file.open(path))
+    {
+        return false;
+    }
+    
+    return file.commit(writeSegmentsFrom(file.fd(), segments, source));
+#endif
+}
+
+#ifndef _WIN32
+bool FileReplacement::open(const std::string& path)
+{
+    commit(false);
+    
+    // replace what a symlink points to rather than the link
+    char resolved[PATH_MAX];
+    m_target = (realpath(path.c_str(), resolved) != nullptr) ? (std::string(resolved)) : (path);
+    m_exists = (stat(m_target.c_str(), &m_original) == 0 && S_ISREG(m_original.st_mode));
+    m_fd = openTemp(m_target, m_temp);
+    return m_fd >= 0;
+}
+
+bool FileReplacement::commit(bool ok)
+{
+    if (m_fd < 0)
+    {
+        return false;
+    }
+    
+    auto fd = m_fd;
+    m_fd = -1;
+    
+    // renaming would split a file with other hard links from its other names,
+    // so it is written over in place. only once the new contents are complete
+    // in the temp file, since they may have come from the original.
+    if (m_exists && m_original.st_nlink > 1)
+    {
+        struct stat written;
+        auto out = (ok && fstat(fd, &written) == 0) ? (::open(m_target.c_str(), O_WRONLY | O_CLOEXEC)) : (-1);
+        ok = (out >= 0) && copyOver(fd, out, (size_t)written.st_size);
+        
+        if (out >= 0)
+        {
+            ok = (::close(out) == 0) && ok;
+        }
+        
+        ::close(fd);
+        unlink(m_temp.c_str());
+        return ok;
+    }
+    
+    // keep the owner and permissions of the file being replaced. only root
+    // can give a file away, but its group may still be one of ours.
+    if (ok && m_exists)
+    {
+        if (fchown(fd, m_original.st_uid, m_original.st_gid) != 0)
+        {
+            auto res = fchown(fd, (uid_t)-1, m_original.st_gid);
+            (void)res;
+        }
+        
+        fchmod(fd, m_original.st_mode & 07777);
+    }
+    
+    ok = (::close(fd) == 0) && ok;
+    
+    if (!ok || rename(m_temp.c_str(), m_target.c_str()) != 0)
+    {
+        unlink(m_temp.c_str());
+        return false;
+    }
+    
+    return true;
+}
+#endif
@@ -0,0 +1,115 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#ifndef FILEIO_H_
+#define FILEIO_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "packexec.h"
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+// a whole file in memory. where possible the file is mapped copy-on-write, so
+// nothing is read until it is touched and writes never reach the file.
+// otherwise it is read into a buffer with pread. the file stays open so that
+// untouched ranges can be copied from it directly, see writeFileAtomic.
+class MappedFile
+{
+public:
+    MappedFile() : m_data(nullptr), m_size(0), m_mapped(false), m_fd(-1) {}
+    ~MappedFile() { close(); }
+    
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    
+    bool open(const std::string& path);
+    void close(void);
+    
+    char *data(void) { return m_data; }
+    const char *data(void) const { return m_data; }
+    size_t size(void) const { return m_size; }
+    bool mapped(void) const { return m_mapped; }
+    
+    // -1 where files aren't kept open
+    int fd(void) const { return m_fd; }
+    
+private:
+    char *m_data;
+    size_t m_size;
+    bool m_mapped;
+    int m_fd;
+    std::unique_ptr<char[]> m_buffer;
+};
+
+// write the segments to a temporary file next to 'path' and rename it over
+// the original, so readers never see a half written file and the input can
+// stay mapped while the output is written. large segments that point into
+// 'source' are copied file to file (a reflink where the filesystem can share
+// the blocks) without passing through memory, so they must not have been
+// modified. symlinks are followed and kept, and the owner and permissions
+// carry over where allowed. a file with other hard links is written over in
+// place instead, which isn't atomic but keeps the links together.
+bool writeFileAtomic(const std::string& path, const std::vector<ExecView>& segments, const MappedFile *source = nullptr);
+
+#ifndef _WIN32
+// write every segment to 'fd' in order with writev
+bool writeSegments(int fd, const std::vector<ExecView>& segments);
+
+// how writeFileAtomic replaces a file, for writers that fill the temporary
+// file themselves. open() creates it next to what 'path' resolves to, and
+// commit() puts it in place with the original's owner and permissions, or
+// writes over the original if it has other hard links. a replacement that
+// isn't committed is thrown away.
+class FileReplacement
+{
+public:
+    FileReplacement() : m_fd(-1), m_exists(false) {}
+    ~FileReplacement() { commit(false); }
+    
+    FileReplacement(const FileReplacement&) = delete;
+    FileReplacement& operator=(const FileReplacement&) = delete;
+    
+    bool open(const std::string& path);
+    
+    // closes the file either way. 'ok' is whether everything was written.
+    bool commit(bool ok);
+    
+    int fd(void) const { return m_fd; }
+    
+private:
+    int m_fd;
+    std::string m_target;
+    std::string m_temp;
+    bool m_exists;
+    struct stat m_original;
+};
+#endif
+
+#endif // FILEIO_H_
@@ -0,0 +1,208 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#include "filelist.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <dirent.h>
+#include <glob.h>
+#endif
+
+namespace
+{
+    bool hasWildcard(const std::string& path)
+    {
+        return path.find_first_of("*?[") != std::string::npos;
+    }
+    
+    bool statPath(const std::string& path, bool& isDirectory, unsigned long long& size)
+    {
+        struct stat st;
+        
+        if (stat(path.c_str(), &st) != 0)
+        {
+            return false;
+        }
+        
+        isDirectory = ((st.st_mode & S_IFMT) == S_IFDIR);
+        size = st.st_size;
+        return true;
+    }
+    
+    // list the entries of a directory, or the matches of a pattern in its
+    // last component, excluding "." and ".."
+    void listDirectory(const std::string& pattern, const std::string& directory, std::vector<std::string>& entries)
+    {
+#ifdef _WIN32
+        _finddata_t data;
+        auto handle = _findfirst(pattern.c_str(), &data);
+        
+        if (handle == -1)
+        {
+            return;
+        }
+        
+        do
+        {
+            std::string name = data.name;
+            
+            if (name != "." && name != "..")
+            {
+                entries.push_back(directory + "/" + name);
+            }
+        } while (_findnext(handle, &data) == 0);
+        
+        _findclose(handle);
+#else
+        (void)pattern;
+        auto dir = opendir(directory.c_str());
+        
+        if (dir == nullptr)
+        {
+            return;
+        }
+        
+        while (auto entry = readdir(dir))
+        {
+            std::string name = entry->d_name;
+            
+            if (name != "." && name != "..")
+            {
+                entries.push_back(directory + "/" + name);
+            }
+        }
+        
+        closedir(dir);
+#endif
+    }
+    
+    void expandGlob(const std::string& pattern, std::vector<std::string>& matches)
+    {
+#ifdef _WIN32
+        auto slash = pattern.find_last_of("/\\");
+        auto directory = (slash == std::string::npos) ? std::string(".") : pattern.substr(0, slash);
+        listDirectory(pattern, directory, matches);
+#else
+        glob_t results;
+        
+        if (glob(pattern.c_str(), 0, nullptr, &results) == 0)
+        {
+            for (auto i = 0u; i < results.gl_pathc; ++i)
+            {
+                matches.push_back(results.gl_pathv[i]);
+            }
+        }
+        
+        globfree(&results);
+#endif
+    }
+    
+    void walkDirectory(const std::string& directory, std::vector<InputFile>& files)
+    {
+        std::vector<std::string> entries;
+        listDirectory(directory + "/*", directory, entries);
+        
+        for (auto& entry : entries)
+        {
+            auto isDirectory = false;
+            auto size = 0ull;
+            
+#ifndef _WIN32
+            struct stat st;
+            
+            // don't follow symlinks into other trees, or around in circles
+            if (lstat(entry.c_str(), &st) != 0 || (st.st_mode & S_IFMT) == S_IFLNK)
+            {
+                continue;
+            }
+#endif
+            
+            if (!statPath(entry, isDirectory, size))
+            {
+                continue;
+            }
+            
+            if (isDirectory)
+            {
+                walkDirectory(entry, files);
+            }
+            else
+            {
+                files.push_back({ entry, size, true });
+            }
+        }
+    }
+}
+
+void expandInputPaths(const std::vector<std::string>& paths, bool recursive, std::vector<InputFile>& files, std::vector<std::string>& errors)
+{
+    for (auto& path : paths)
+    {
+        std::vector<std::string> matches;
+        
+        if (hasWildcard(path))
+        {
+            expandGlob(path, matches);
+            
+            if (matches.empty())
+            {
+                errors.push_back("no files match \"" + path + "\".");
+                continue;
+            }
+        }
+        else
+        {
+            matches.push_back(path);
+        }
+        
+        for (auto& match : matches)
+        {
+            auto isDirectory = false;
+            auto size = 0ull;
+            
+            if (!statPath(match, isDirectory, size))
+            {
+                errors.push_back("could not open file: \"" + match + "\".");
+            }
+            else if (!isDirectory)
+            {
+                files.push_back({ match, size, false });
+            }
+            else if (recursive)
+            {
+                walkDirectory(match, files);
+            }
+            else
+            {
+                errors.push_back("\"" + match + "\" is a directory (use -r).");
+            }
+        }
+    }
+}
@@ -0,0 +1,46 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#ifndef FILELIST_H_
+#define FILELIST_H_
+
+#include <string>
+#include <vector>
+
+struct InputFile
+{
+    std::string path;
+    unsigned long long size;
+    
+    // true if found by walking a directory rather than named directly
+    bool discovered;
+};
+
+// expand the paths given on the command line into a list of files. entries
+// may name files, glob patterns or, when recursive, directories to walk.
+// problems are appended to 'errors' and the offending entry is dropped.
+void expandInputPaths(const std::vector<std::string>& paths, bool recursive, std::vector<InputFile>& files, std::vector<std::string>& errors);
+
+#endif // FILELIST_H_
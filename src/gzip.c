@@ -25,130 +25,504 @@ DEALINGS IN THE SOFTWARE.
 
 #include <zlib.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 
-typedef uint64_t u64;
-typedef uint32_t u32;
-typedef uint16_t u16;
-typedef uint8_t u8;
+#include "gzip.h"
+#include "crc32.h"
+#include "deflateopt.h"
 
-z_stream z;
+/* input fed to deflate per step, checksummed while it is still in cache */
+#define DEFLATE_CHUNK_SIZE (64 * 1024)
 
-/* Table of CRCs of all 8-bit messages. */
-unsigned long crc_table[256];
+/* zlib asks for at most five blocks per stream, with room for a second set
+ * when the parameters change */
+#define ARENA_BLOCKS (12)
 
-/* Flag: has the table been computed? Initially false. */
-int crc_table_computed = 0;
+#if defined(_MSC_VER)
+#include <intrin.h>
+static volatile long g_heapAllocations;
+#define COUNT_HEAP_ALLOCATION() _InterlockedIncrement(&g_heapAllocations)
+#define READ_HEAP_ALLOCATIONS() ((unsigned long)g_heapAllocations)
+#else
+static unsigned long g_heapAllocations;
+#define COUNT_HEAP_ALLOCATION() __atomic_fetch_add(&g_heapAllocations, 1, __ATOMIC_RELAXED)
+#define READ_HEAP_ALLOCATIONS() __atomic_load_n(&g_heapAllocations, __ATOMIC_RELAXED)
+#endif
 
-/* Make the table for a fast CRC. */
-void make_crc_table(void)
+int gzipGetMaxCompressedSize( int nLenSrc ) 
+{
+    int n16kBlocks = (nLenSrc+16383) / 16384;
+    
+    /* each parallel block can end in a sync flush and a partial byte */
+    int nParallelBlocks = (nLenSrc+GZIP_PARALLEL_BLOCK_SIZE-1) / GZIP_PARALLEL_BLOCK_SIZE;
+    return ( nLenSrc + 6 + (n16kBlocks*5) + (nParallelBlocks*16) + 18);
+}
+
+void gzipWriteHeader(void *outbuffer)
 {
-  unsigned long c;
-  int n, k;
+	u8 *outdata = (u8 *)outbuffer;
+	
+	/* fill in structure */
+	memset(outdata, 0, GZIP_HEADER_SIZE);
+	
+	/* default gzip info */
+	outdata[0] = 0x1F;
+	outdata[1] = 0x8B;
+	outdata[2] = 0x08;
+	outdata[8] = 0x02;
+	outdata[9] = 0x0B;
+}
 
-  for (n = 0; n < 256; n++) {
-    c = (unsigned long) n;
-    for (k = 0; k < 8; k++) {
-      if (c & 1) {
-        c = 0xedb88320L ^ (c >> 1);
-      } else {
-        c = c >> 1;
-      }
-    }
-    crc_table[n] = c;
-  }
-  crc_table_computed = 1;
+void gzipWriteTrailer(void *outbuffer, u32 crc32, u32 insize)
+{
+	u8 *outdata = (u8 *)outbuffer;
+	
+	memcpy(outdata, &crc32, 4);
+	memcpy(outdata + 4, &insize, 4);
 }
 
-/*
-   Update a running crc with the bytes buf[0..len-1] and return
- the updated crc. The crc should be initialized to zero. Pre- and
- post-conditioning (one's complement) is performed within this
- function so it shouldn't be done by the caller. Usage example:
+void gzipDefaultParams(GzipParams *params)
+{
+	params->level = 9;
+	params->memLevel = 8;
+	params->strategy = Z_DEFAULT_STRATEGY;
+	params->encoder = GZIP_ENCODER_ZLIB;
+}
 
-   unsigned long crc = 0L;
+/* what zlib allocated for a context's streams, kept when they end so the
+ * next stream with the same sizes doesn't go back to the heap */
+typedef struct
+{
+	void *ptr;
+	size_t size;
+	int used;
+} ArenaBlock;
 
-   while (read_buffer(buffer, length) != EOF) {
-     crc = update_crc(crc, buffer, length);
-   }
-   if (crc != original_crc) error();
-*/
-unsigned long update_crc(unsigned long crc,
-                unsigned char *buf, int len)
+typedef struct
 {
-  unsigned long c = crc ^ 0xffffffffL;
-  int n;
+	ArenaBlock blocks[ARENA_BLOCKS];
+} GzipArena;
 
-  if (!crc_table_computed)
-    make_crc_table();
-  for (n = 0; n < len; n++) {
-    c = crc_table[(c ^ buf[n]) & 0xff] ^ (c >> 8);
-  }
-  return c ^ 0xffffffffL;
+struct GzipContext
+{
+	z_stream z;
+	int initialised;
+	GzipParams params;
+	
+	/* gzipDecompressContext's stream, rewound between calls */
+	z_stream inflater;
+	int inflaterReady;
+	
+	GzipArena arena;
+};
+
+static voidpf ArenaAlloc(voidpf opaque, uInt items, uInt size)
+{
+	GzipArena *arena = (GzipArena *)opaque;
+	size_t bytes = (size_t)items * size;
+	ArenaBlock *fit = NULL, *spare = NULL;
+	int i;
+	
+	/* the smallest free block that is big enough */
+	for (i = 0; i < ARENA_BLOCKS; ++i)
+	{
+		ArenaBlock *block = &arena->blocks[i];
+		
+		if (block->used)
+			continue;
+		
+		if (block->size >= bytes && (fit == NULL || block->size < fit->size))
+			fit = block;
+		
+		if (spare == NULL || block->size < spare->size)
+			spare = block;
+	}
+	
+	if (fit)
+	{
+		fit->used = 1;
+		return fit->ptr;
+	}
+	
+	COUNT_HEAP_ALLOCATION();
+	
+	/* every block in use is a stream we don't keep track of */
+	if (spare == NULL)
+		return malloc(bytes);
+	
+	/* otherwise the smallest free block makes way */
+	free(spare->ptr);
+	spare->ptr = malloc(bytes);
+	spare->size = (spare->ptr) ? (bytes) : (0);
+	spare->used = (spare->ptr != NULL);
+	return spare->ptr;
 }
 
-/* Return the CRC of the bytes buf[0..len-1]. */
-unsigned long getCrc32(unsigned char *buf, int len)
+static void ArenaFree(voidpf opaque, voidpf ptr)
 {
-  return update_crc(0L, buf, len);
+	GzipArena *arena = (GzipArena *)opaque;
+	int i;
+	
+	for (i = 0; i < ARENA_BLOCKS; ++i)
+	{
+		if (arena->blocks[i].ptr == ptr)
+		{
+			arena->blocks[i].used = 0;
+			return;
+		}
+	}
+	
+	free(ptr);
 }
 
-int gzipGetMaxCompressedSize( int nLenSrc ) 
+GzipContext *gzipCreateContext(void)
 {
-    int n16kBlocks = (nLenSrc+16383) / 16384;
-    return ( nLenSrc + 6 + (n16kBlocks*5) + 18);
+	GzipContext *ctx = (GzipContext *)malloc(sizeof(GzipContext));
+	
+	if (ctx)
+	{
+		memset(ctx, 0, sizeof(GzipContext));
+	}
+	
+	return ctx;
 }
 
-int DeflateCompress(void *outbuf, int outsize, void *inbuf, int insize)
+void gzipDestroyContext(GzipContext *ctx)
+{
+	int i;
+	
+	if (ctx == NULL)
+	{
+		return;
+	}
+	
+	if (ctx->initialised)
+	{
+		deflateEnd(&ctx->z);
+	}
+	
+	if (ctx->inflaterReady)
+	{
+		inflateEnd(&ctx->inflater);
+	}
+	
+	for (i = 0; i < ARENA_BLOCKS; ++i)
+	{
+		free(ctx->arena.blocks[i].ptr);
+	}
+	
+	free(ctx);
+}
+
+unsigned long gzipHeapAllocations(void)
+{
+	return READ_HEAP_ALLOCATIONS();
+}
+
+/* get the deflate state ready for a new raw stream */
+int PrepareDeflate(GzipContext *ctx, const GzipParams *params)
+{
+	/* same parameters, just rewind the state we already have */
+	if (ctx->initialised 
+	&& ctx->params.level == params->level 
+	&& ctx->params.memLevel == params->memLevel 
+	&& ctx->params.strategy == params->strategy)
+	{
+		return (deflateReset(&ctx->z) == Z_OK) ? (0) : (-1);
+	}
+	
+	if (ctx->initialised)
+	{
+		deflateEnd(&ctx->z);
+		ctx->initialised = 0;
+	}
+	
+	memset(&ctx->z, 0, sizeof(z_stream));
+
+	ctx->z.zalloc = ArenaAlloc;
+	ctx->z.zfree  = ArenaFree;
+	ctx->z.opaque = &ctx->arena;
+
+	if (deflateInit2(&ctx->z, params->level, Z_DEFLATED, -15, params->memLevel, params->strategy) != Z_OK)
+		return -1;
+	
+	ctx->initialised = 1;
+	ctx->params = *params;
+	return 0;
+}
+
+static int DeflateZlib(GzipContext *ctx, void *outbuf, u32 outsize, const void *inbuf, u32 insize, const void *dict, u32 dictsize, int finish, const GzipParams *params, u32 *crc)
 {
 	int res;
-	memset(&z, 0, sizeof(z_stream));
+	z_stream *z = &ctx->z;
+	u8 *in = (u8 *)inbuf;
 
-	z.zalloc = Z_NULL;
-	z.zfree  = Z_NULL;
-	z.opaque = Z_NULL;
+	if (PrepareDeflate(ctx, params) < 0)
+		return -1;
 
-	if (deflateInit2(&z, 9, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+	if (dictsize && deflateSetDictionary(z, (const Bytef *)dict, dictsize) != Z_OK)
 		return -1;
 
-	z.next_out  = outbuf;
-	z.avail_out = outsize;
-	z.next_in   = inbuf;
-	z.avail_in  = insize;
+	z->next_out  = outbuf;
+	z->avail_out = outsize;
+	*crc = 0;
 
-	if (deflate(&z, Z_FINISH) != Z_STREAM_END)
-		return -2;
+	/* checksum each chunk just before deflate reads it */
+	do
+	{
+		u32 chunk = (insize < DEFLATE_CHUNK_SIZE) ? (insize) : (DEFLATE_CHUNK_SIZE);
+		int last = (chunk == insize);
+		int flush = (!last) ? (Z_NO_FLUSH) : ((finish) ? (Z_FINISH) : (Z_SYNC_FLUSH));
 
-	res = outsize - z.avail_out;
+		*crc = crc32Update(*crc, in, chunk);
+
+		z->next_in  = in;
+		z->avail_in = chunk;
+
+		res = deflate(z, flush);
+
+		if ((flush == Z_FINISH && res != Z_STREAM_END) || (flush != Z_FINISH && (res != Z_OK || z->avail_in != 0 || z->avail_out == 0)))
+		{
+			/* the state is rewound by the next job, nothing to clean up */
+			return -2;
+		}
+
+		in += chunk;
+		insize -= chunk;
+	} while (insize > 0);
+
+	return outsize - z->avail_out;
+}
+
+/* keeps no state between jobs, the context is left alone */
+static int DeflateOptimal(GzipContext *ctx, void *outbuf, u32 outsize, const void *inbuf, u32 insize, const void *dict, u32 dictsize, int finish, const GzipParams *params, u32 *crc)
+{
+	(void)ctx;
+	(void)params;
+	
+	*crc = crc32Update(0, inbuf, insize);
+	return deflateOptimal(outbuf, outsize, inbuf, insize, dict, dictsize, finish);
+}
+
+typedef int (*DeflateEncoder)(GzipContext *ctx, void *outbuf, u32 outsize, const void *inbuf, u32 insize, const void *dict, u32 dictsize, int finish, const GzipParams *params, u32 *crc);
+
+/* indexed by GZIP_ENCODER_* */
+static const struct
+{
+	const char *name;
+	DeflateEncoder deflate;
+} encoders[GZIP_ENCODER_COUNT] =
+{
+	{ "zlib", DeflateZlib },
+	{ "optimal", DeflateOptimal },
+};
+
+const char *gzipEncoderName(int encoder)
+{
+	return (encoder >= 0 && encoder < GZIP_ENCODER_COUNT) ? (encoders[encoder].name) : (NULL);
+}
+
+int gzipDeflateRaw(GzipContext *ctx, void *outbuf, u32 outsize, const void *inbuf, u32 insize, const void *dict, u32 dictsize, int finish, const GzipParams *params, u32 *crc)
+{
+	if (gzipEncoderName(params->encoder) == NULL)
+		return -1;
+	
+	return encoders[params->encoder].deflate(ctx, outbuf, outsize, inbuf, insize, dict, dictsize, finish, params, crc);
+}
+
+int gzipCompressStream(GzipContext *ctx, void *outbuffer, u32 outsize, const void *inbuffer, u32 insize, const GzipParams *params, GzipSink sink, void *opaque)
+{
+	int res;
+	z_stream *z = &ctx->z;
+	u8 *in = (u8 *)inbuffer;
+	u8 header[GZIP_HEADER_SIZE], trailer[GZIP_TRAILER_SIZE];
+	u32 crc = 0, remaining = insize;
+	u32 total = GZIP_HEADER_SIZE + GZIP_TRAILER_SIZE;
 
-	if (deflateEnd(&z) != Z_OK)
+	if (outsize == 0 || params->encoder != GZIP_ENCODER_ZLIB || PrepareDeflate(ctx, params) < 0)
+		return -1;
+
+	gzipWriteHeader(header);
+
+	if (sink(opaque, header, GZIP_HEADER_SIZE) != 0)
 		return -3;
 
+	z->next_out  = outbuffer;
+	z->avail_out = outsize;
+
+	do
+	{
+		u32 chunk = (remaining < DEFLATE_CHUNK_SIZE) ? (remaining) : (DEFLATE_CHUNK_SIZE);
+		int flush = (chunk == remaining) ? (Z_FINISH) : (Z_NO_FLUSH);
+
+		crc = crc32Update(crc, in, chunk);
+
+		z->next_in  = in;
+		z->avail_in = chunk;
+
+		/* drain the output buffer as often as deflate needs */
+		do
+		{
+			res = deflate(z, flush);
+
+			if (res != Z_OK && res != Z_STREAM_END && res != Z_BUF_ERROR)
+				return -2;
+
+			if (z->avail_out == 0 || res == Z_STREAM_END)
+			{
+				u32 produced = outsize - z->avail_out;
+
+				if (produced && sink(opaque, outbuffer, produced) != 0)
+					return -3;
+
+				total += produced;
+				z->next_out  = outbuffer;
+				z->avail_out = outsize;
+			}
+		} while (z->avail_in != 0 || (flush == Z_FINISH && res != Z_STREAM_END));
+
+		in += chunk;
+		remaining -= chunk;
+	} while (remaining > 0);
+
+	gzipWriteTrailer(trailer, crc, insize);
+
+	if (sink(opaque, trailer, GZIP_TRAILER_SIZE) != 0)
+		return -3;
+
+	return total;
+}
+
+int gzipDecompressStream(void *outbuffer, u32 outsize, const void *inbuffer, u32 insize, GzipSink sink, void *opaque)
+{
+	int res;
+	u32 produced, total = 0;
+	z_stream z;
+	memset(&z, 0, sizeof(z_stream));
+	
+	/* let zlib parse the header and check the crc32 and size */
+	if (outsize == 0 || inflateInit2(&z, 16 + 15) != Z_OK)
+		return -1;
+	
+	z.next_in  = (Bytef *)inbuffer;
+	z.avail_in = insize;
+	
+	do
+	{
+		z.next_out  = outbuffer;
+		z.avail_out = outsize;
+		
+		/* running out of input before the end is a truncated member */
+		res = inflate(&z, Z_NO_FLUSH);
+		
+		if (res != Z_OK && res != Z_STREAM_END)
+		{
+			inflateEnd(&z);
+			return -2;
+		}
+		
+		produced = outsize - z.avail_out;
+		
+		if (produced && sink(opaque, outbuffer, produced) != 0)
+		{
+			inflateEnd(&z);
+			return -3;
+		}
+		
+		total += produced;
+	} while (res != Z_STREAM_END);
+	
+	inflateEnd(&z);
+	
+	/* the member has to fill the input exactly */
+	return (z.avail_in == 0) ? ((int)total) : (-2);
+}
+
+int gzipDecompress(void *outbuffer, u32 outsize, const void *inbuffer, u32 insize)
+{
+	int res;
+	z_stream z;
+	memset(&z, 0, sizeof(z_stream));
+	
+	/* let zlib parse the header and check the crc32 and size */
+	if (inflateInit2(&z, 16 + 15) != Z_OK)
+		return -1;
+	
+	z.next_out  = outbuffer;
+	z.avail_out = outsize;
+	z.next_in   = (Bytef *)inbuffer;
+	z.avail_in  = insize;
+	
+	if (inflate(&z, Z_FINISH) != Z_STREAM_END)
+	{
+		inflateEnd(&z);
+		return -2;
+	}
+	
+	res = outsize - z.avail_out;
+	inflateEnd(&z);
 	return res;
 }
 
-int UncompressData( const u8* abSrc, int nLenSrc, u8* abDst, int nLenDst )
+int gzipDecompressContext(GzipContext *ctx, void *outbuffer, u32 outsize, const void *inbuffer, u32 insize)
+{
+	z_stream *z = &ctx->inflater;
+	
+	if (ctx->inflaterReady)
+	{
+		if (inflateReset(z) != Z_OK)
+			return -1;
+	}
+	else
+	{
+		memset(z, 0, sizeof(z_stream));
+		z->zalloc = ArenaAlloc;
+		z->zfree  = ArenaFree;
+		z->opaque = &ctx->arena;
+		
+		/* let zlib parse the header and check the crc32 and size */
+		if (inflateInit2(z, 16 + 15) != Z_OK)
+			return -1;
+		
+		ctx->inflaterReady = 1;
+	}
+	
+	z->next_out  = outbuffer;
+	z->avail_out = outsize;
+	z->next_in   = (Bytef *)inbuffer;
+	z->avail_in  = insize;
+	
+	if (inflate(z, Z_FINISH) != Z_STREAM_END)
+		return -2;
+	
+	return outsize - z->avail_out;
+}
+
+int gzipCompress(void *outbuffer, u32 outsize, const void *inbuffer, u32 insize)
 {
-    z_stream zInfo ={0};
-    zInfo.total_in=  zInfo.avail_in=  nLenSrc;
-    zInfo.total_out= zInfo.avail_out= nLenDst;
-    zInfo.next_in= (u8*)abSrc;
-    zInfo.next_out= abDst;
+	GzipParams params;
+	gzipDefaultParams(&params);
+	return gzipCompressWithParams(outbuffer, outsize, inbuffer, insize, &params);
+}
 
-    int nErr, nRet= -1;
-    nErr= inflateInit( &zInfo );            
-    if ( nErr == Z_OK ) {
-        nErr= inflate( &zInfo, Z_FINISH );    
-        if ( nErr == Z_STREAM_END ) {
-            nRet= zInfo.total_out;
-        }
-    }
-    deflateEnd( &zInfo );   
-    return( nRet );
+int gzipCompressWithParams(void *outbuffer, u32 outsize, const void *inbuffer, u32 insize, const GzipParams *params)
+{
+	GzipContext *ctx = gzipCreateContext();
+	int res;
+	
+	if (ctx == NULL)
+	{
+		return -1;
+	}
+	
+	res = gzipCompressContext(ctx, outbuffer, outsize, inbuffer, insize, params);
+	gzipDestroyContext(ctx);
+	return res;
 }
 
-int gzipCompress(void *outbuffer, u32 outsize, void *inbuffer, u32 insize)
+int gzipCompressContext(GzipContext *ctx, void *outbuffer, u32 outsize, const void *inbuffer, u32 insize, const GzipParams *params)
 {
 	/* cast variables */
 	u8 *outdata = (u8 *)outbuffer;
@@ -159,21 +533,11 @@ int gzipCompress(void *outbuffer, u32 outsize, void *inbuffer, u32 insize)
 		return -1;
 	}
 	
-	/* fill in structure */
-	memset(outdata, 0, 10);
-	
-	/* default gzip info */
-	outdata[0] = 0x1F;
-	outdata[1] = 0x8B;
-	outdata[2] = 0x08;
-	outdata[8] = 0x02;
-	outdata[9] = 0x0B;
-	
-	/* get the crc32 */
-	u32 crc32 = getCrc32(inbuffer, insize);
+	gzipWriteHeader(outdata);
 	
-	/* deflate compress */
-	int res = DeflateCompress(outdata + 10, outsize - 18, inbuffer, insize);
+	/* deflate compress, computing the crc32 on the way */
+	u32 crc32;
+	int res = gzipDeflateRaw(ctx, outdata + 10, outsize - 18, inbuffer, insize, NULL, 0, 1, params, &crc32);
 	
 	/* check for error */
 	if (res < 0)
@@ -189,8 +553,7 @@ int gzipCompress(void *outbuffer, u32 outsize, void *inbuffer, u32 insize)
 	}
 	
 	/* pwn */
-	memcpy(outdata + 10 + res, &crc32, 4);
-	memcpy(outdata + 10 + res + 4, &insize, 4);
+	gzipWriteTrailer(outdata + 10 + res, crc32, insize);
 	
 	/* return size */
 	return res + 18;
@@ -26,11 +26,98 @@ DEALINGS IN THE SOFTWARE.
 #ifndef GZIP_H_
 #define GZIP_H_
 
+#include <stdint.h>
+
+typedef uint64_t u64;
+typedef uint32_t u32;
+typedef uint16_t u16;
+typedef uint8_t u8;
+
+#define GZIP_HEADER_SIZE            (10)
+#define GZIP_TRAILER_SIZE           (8)
+
+// input size of each independently compressed block in parallel mode
+#define GZIP_PARALLEL_BLOCK_SIZE    (128 * 1024)
+
+// encoders gzipDeflateRaw can use. both write plain deflate that any inflate
+// can read.
+enum
+{
+    // zlib's hash chains and lazy matching
+    GZIP_ENCODER_ZLIB,
+    
+    // iterated optimal parsing, smaller but many times slower
+    GZIP_ENCODER_OPTIMAL,
+    
+    GZIP_ENCODER_COUNT
+};
+
+typedef struct
+{
+    // zlib only
+    int level;
+    int memLevel;
+    int strategy;
+    
+    int encoder;
+} GzipParams;
+
+// deflate state that is kept between jobs and rewound rather than rebuilt.
+// a context may only be used by one thread at a time.
+typedef struct GzipContext GzipContext;
+
+// receives streamed output, returns 0 to carry on
+typedef int (*GzipSink)(void *opaque, const void *data, u32 size);
+
 #ifdef __cplusplus
 extern "C" {
 #endif // __cplusplus
 int gzipGetMaxCompressedSize( int nLenSrc );
-int gzipCompress(char *outbuffer, u32 outsize, const char *inbuffer, u32 insize);
+int gzipCompress(void *outbuffer, u32 outsize, const void *inbuffer, u32 insize);
+int gzipCompressWithParams(void *outbuffer, u32 outsize, const void *inbuffer, u32 insize, const GzipParams *params);
+int gzipDecompress(void *outbuffer, u32 outsize, const void *inbuffer, u32 insize);
+
+// level 9, memLevel 8, default strategy on zlib
+void gzipDefaultParams(GzipParams *params);
+
+// "zlib" or "optimal", null for anything else
+const char *gzipEncoderName(int encoder);
+
+GzipContext *gzipCreateContext(void);
+void gzipDestroyContext(GzipContext *ctx);
+
+// gzipCompressWithParams without setting up zlib on every call
+int gzipCompressContext(GzipContext *ctx, void *outbuffer, u32 outsize, const void *inbuffer, u32 insize, const GzipParams *params);
+
+// raw deflate of inbuffer primed with an optional dictionary. the stream is
+// finished if 'finish' is set, otherwise it ends byte aligned on a sync flush
+// so more raw streams can follow it. the crc32 of the input is returned in
+// 'crc'. returns the compressed size or a negative error.
+int gzipDeflateRaw(GzipContext *ctx, void *outbuffer, u32 outsize, const void *inbuffer, u32 insize, const void *dict, u32 dictsize, int finish, const GzipParams *params, u32 *crc);
+
+// gzipCompressContext for output that doesn't have to fit in memory. the
+// gzip member is built up in outbuffer and handed to 'sink' every time it
+// fills, so any outsize works. only zlib can deflate a chunk at a time, so
+// other encoders fail. returns the compressed size or a negative error.
+int gzipCompressStream(GzipContext *ctx, void *outbuffer, u32 outsize, const void *inbuffer, u32 insize, const GzipParams *params, GzipSink sink, void *opaque);
+
+// inflate a single gzip member that fills inbuffer exactly, handing the
+// output to 'sink' through outbuffer every time it fills. zlib checks the
+// crc32 and size in the trailer. returns the decompressed size, -2 if the
+// member is damaged, truncated or followed by anything, or -3 if the sink
+// stopped it.
+int gzipDecompressStream(void *outbuffer, u32 outsize, const void *inbuffer, u32 insize, GzipSink sink, void *opaque);
+
+// gzipDecompress on a stream the context keeps between calls
+int gzipDecompressContext(GzipContext *ctx, void *outbuffer, u32 outsize, const void *inbuffer, u32 insize);
+
+// blocks contexts have had to get from the heap for zlib's state so far.
+// zlib allocates through the context, which keeps the blocks when a stream
+// ends, so this stops growing once every thread has packed a module.
+unsigned long gzipHeapAllocations(void);
+
+void gzipWriteHeader(void *outbuffer);
+void gzipWriteTrailer(void *outbuffer, u32 crc32, u32 insize);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,135 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#include "hash.h"
+
+#include <cstring>
+
+namespace
+{
+    const u64 PRIME1 = 0x9E3779B185EBCA87ULL;
+    const u64 PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+    const u64 PRIME3 = 0x165667B19E3779F9ULL;
+    const u64 PRIME4 = 0x85EBCA77C2B2AE63ULL;
+    const u64 PRIME5 = 0x27D4EB2F165667C5ULL;
+    
+    inline u64 rotl(u64 x, int r)
+    {
+        return (x << r) | (x >> (64 - r));
+    }
+    
+    // unaligned little endian loads, the inputs are ELFs from anywhere in a file
+    inline u64 read64(const u8 *p)
+    {
+        u64 v;
+        std::memcpy(&v, p, sizeof(v));
+        return v;
+    }
+    
+    inline u32 read32(const u8 *p)
+    {
+        u32 v;
+        std::memcpy(&v, p, sizeof(v));
+        return v;
+    }
+    
+    inline u64 mixRound(u64 acc, u64 input)
+    {
+        acc += input * PRIME2;
+        acc = rotl(acc, 31);
+        return acc * PRIME1;
+    }
+    
+    inline u64 mergeRound(u64 acc, u64 val)
+    {
+        acc ^= mixRound(0, val);
+        return acc * PRIME1 + PRIME4;
+    }
+}
+
+u64 hash64(const void *data, size_t size, u64 seed)
+{
+    auto p = (const u8 *)data;
+    auto end = p + size;
+    u64 h;
+    
+    if (size >= 32)
+    {
+        // four independent lanes over 32 byte stripes
+        u64 v1 = seed + PRIME1 + PRIME2;
+        u64 v2 = seed + PRIME2;
+        u64 v3 = seed;
+        u64 v4 = seed - PRIME1;
+        
+        do
+        {
+            v1 = mixRound(v1, read64(p));
+            v2 = mixRound(v2, read64(p + 8));
+            v3 = mixRound(v3, read64(p + 16));
+            v4 = mixRound(v4, read64(p + 24));
+            p += 32;
+        } while (end - p >= 32);
+        
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = mergeRound(h, v1);
+        h = mergeRound(h, v2);
+        h = mergeRound(h, v3);
+        h = mergeRound(h, v4);
+    }
+    else
+    {
+        h = seed + PRIME5;
+    }
+    
+    h += (u64)size;
+    
+    // whatever is left after the stripes
+    for (; end - p >= 8; p += 8)
+    {
+        h ^= mixRound(0, read64(p));
+        h = rotl(h, 27) * PRIME1 + PRIME4;
+    }
+    
+    if (end - p >= 4)
+    {
+        h ^= (u64)read32(p) * PRIME1;
+        h = rotl(h, 23) * PRIME2 + PRIME3;
+        p += 4;
+    }
+    
+    for (; p < end; ++p)
+    {
+        h ^= (*p) * PRIME5;
+        h = rotl(h, 11) * PRIME1;
+    }
+    
+    // avalanche
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME3;
+    h ^= h >> 32;
+    return h;
+}
@@ -0,0 +1,693 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#include "iopipeline.h"
+#include "fileio.h"
+#include "tracelog.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <climits>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define IOPIPELINE_HAVE_URING
+#endif
+#endif
+
+#ifdef IOPIPELINE_HAVE_URING
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+// requests in flight at once through the ring
+#define IOPIPELINE_RING_ENTRIES (64)
+
+struct IoPipeline::Request
+{
+    Request() : write(false), fd(-1), started(false), complete(false), ok(false), wanted(false), posted(false), size(0), offset(0), next(0) {}
+    
+    bool write;
+    std::string path;
+    int fd;
+    
+    bool started;
+    bool complete;
+    bool ok;
+    
+    // a worker is waiting for this read, so it goes ahead of the rest
+    bool wanted;
+    
+    // finished before reaching the disk, with 'ok' as the result
+    bool posted;
+    
+    size_t size;
+    size_t offset;
+    
+    // what is left to transfer starts at iov[next]
+    std::vector<iovec> iov;
+    size_t next;
+    
+    ModuleBuffer data;
+    
+    // writes go to a temporary file that replaces 'path' at the end
+    FileReplacement replacement;
+    std::shared_ptr<void> owner;
+    std::function<void(bool)> finished;
+    
+    // from start() to finish(), overlapping the rest in flight
+    std::unique_ptr<TraceSpan> span;
+};
+
+#ifdef IOPIPELINE_HAVE_URING
+// just enough of an io_uring to queue reads and writes and reap them. the
+// ring signals an eventfd as requests complete, which is also what wakes the
+// I/O thread for new work.
+struct IoPipeline::Ring
+{
+    Ring() : fd(-1), event(-1), sqRing(MAP_FAILED), cqRing(MAP_FAILED), sqes(MAP_FAILED), sqRingSize(0), cqRingSize(0), sqesSize(0), pending(0) {}
+    
+    ~Ring()
+    {
+        if (sqes != MAP_FAILED)
+        {
+            munmap(sqes, sqesSize);
+        }
+        
+        if (cqRing != MAP_FAILED && cqRing != sqRing)
+        {
+            munmap(cqRing, cqRingSize);
+        }
+        
+        if (sqRing != MAP_FAILED)
+        {
+            munmap(sqRing, sqRingSize);
+        }
+        
+        if (fd >= 0)
+        {
+            ::close(fd);
+        }
+        
+        if (event >= 0)
+        {
+            ::close(event);
+        }
+    }
+    
+    bool open(unsigned int entries)
+    {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        
+        fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+        event = eventfd(0, EFD_CLOEXEC);
+        
+        if (fd < 0 || event < 0)
+        {
+            return false;
+        }
+        
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        
+        // newer kernels map both rings at once
+        if (params.features & IORING_FEAT_SINGLE_MMAP)
+        {
+            sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+        }
+        
+        sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        
+        if (sqRing == MAP_FAILED)
+        {
+            return false;
+        }
+        
+        cqRing = (params.features & IORING_FEAT_SINGLE_MMAP) ? (sqRing) : (mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING));
+        sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        
+        if (cqRing == MAP_FAILED || sqes == MAP_FAILED)
+        {
+            return false;
+        }
+        
+        auto sq = (char *)sqRing;
+        sqTail = (unsigned *)(sq + params.sq_off.tail);
+        sqMask = *(unsigned *)(sq + params.sq_off.ring_mask);
+        sqArray = (unsigned *)(sq + params.sq_off.array);
+        
+        auto cq = (char *)cqRing;
+        cqHead = (unsigned *)(cq + params.cq_off.head);
+        cqTail = (unsigned *)(cq + params.cq_off.tail);
+        cqMask = *(unsigned *)(cq + params.cq_off.ring_mask);
+        cqes = (io_uring_cqe *)(cq + params.cq_off.cqes);
+        
+        return syscall(__NR_io_uring_register, fd, IORING_REGISTER_EVENTFD, &event, 1) == 0;
+    }
+    
+    // the caller keeps no more requests in flight than the ring has entries,
+    // so there is always room
+    io_uring_sqe *next(void)
+    {
+        auto tail = *sqTail + pending;
+        auto index = tail & sqMask;
+        auto sqe = (io_uring_sqe *)sqes + index;
+        
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqArray[index] = index;
+        ++pending;
+        return sqe;
+    }
+    
+    bool submit(void)
+    {
+        if (pending == 0)
+        {
+            return true;
+        }
+        
+        __atomic_store_n(sqTail, *sqTail + pending, __ATOMIC_RELEASE);
+        auto count = pending;
+        pending = 0;
+        
+        while (count != 0)
+        {
+            auto res = syscall(__NR_io_uring_enter, fd, count, 0, 0, nullptr, 0);
+            
+            if (res < 0 && errno != EINTR)
+            {
+                return false;
+            }
+            
+            count -= (res > 0) ? ((unsigned)res) : (0);
+        }
+        
+        return true;
+    }
+    
+    bool reap(io_uring_cqe& cqe)
+    {
+        auto head = *cqHead;
+        
+        if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+        {
+            return false;
+        }
+        
+        cqe = cqes[head & cqMask];
+        __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+    
+    void wait(void)
+    {
+        eventfd_t value;
+        eventfd_read(event, &value);
+    }
+    
+    void signal(void)
+    {
+        eventfd_write(event, 1);
+    }
+    
+    int fd;
+    int event;
+    
+    void *sqRing;
+    void *cqRing;
+    void *sqes;
+    size_t sqRingSize;
+    size_t cqRingSize;
+    size_t sqesSize;
+    
+    unsigned *sqTail;
+    unsigned sqMask;
+    unsigned *sqArray;
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned cqMask;
+    io_uring_cqe *cqes;
+    
+    // queued since the last submit
+    unsigned pending;
+};
+#else
+struct IoPipeline::Ring
+{
+    bool open(unsigned int entries) { return false; }
+    void signal(void) {}
+};
+#endif
+
+IoPipeline::IoPipeline(size_t maxBytes, bool useRing)
+    : m_maxBytes(maxBytes)
+    , m_readBytes(0)
+    , m_writeBytes(0)
+    , m_writes(0)
+    , m_inFlight(0)
+    , m_limit(1)
+    , m_stop(false)
+{
+    if (useRing)
+    {
+        m_ring.reset(new Ring);
+        
+        // seccomp filters and old kernels refuse, so fall back quietly
+        if (m_ring->open(IOPIPELINE_RING_ENTRIES))
+        {
+            m_limit = IOPIPELINE_RING_ENTRIES;
+        }
+        else
+        {
+            m_ring.reset();
+        }
+    }
+    
+    m_thread = std::thread(&IoPipeline::run, this);
+}
+
+IoPipeline::~IoPipeline()
+{
+    flush();
+    
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_stop = true;
+    }
+    
+    wake();
+    m_thread.join();
+}
+
+const char *IoPipeline::backend(void) const
+{
+    return (m_ring) ? ("io_uring") : ("pread");
+}
+
+void IoPipeline::prefetch(const std::vector<std::string>& paths)
+{
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        
+        for (auto& path : paths)
+        {
+            struct stat st;
+            
+            // anything big is better off mapped by the caller
+            if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode) || (size_t)st.st_size > m_maxBytes / 4)
+            {
+                continue;
+            }
+            
+            std::unique_ptr<Request> request(new Request);
+            request->path = path;
+            request->size = st.st_size;
+            
+            auto added = m_reads.emplace(path, std::move(request));
+            
+            if (added.second)
+            {
+                m_readQueue.push_back(added.first->second.get());
+            }
+        }
+    }
+    
+    wake();
+}
+
+bool IoPipeline::read(const std::string& path, ModuleBuffer& data)
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+    auto it = m_reads.find(path);
+    
+    if (it == m_reads.end())
+    {
+        return false;
+    }
+    
+    auto request = it->second.get();
+    
+    if (!request->started)
+    {
+        request->wanted = true;
+        wake();
+    }
+    
+    m_changed.wait(lock, [request] { return request->complete; });
+    
+    auto ok = request->ok;
+    
+    if (ok)
+    {
+        data.swap(request->data);
+        m_readBytes -= request->size;
+    }
+    
+    m_reads.erase(it);
+    lock.unlock();
+    
+    // there may be room to read further ahead now
+    wake();
+    return ok;
+}
+
+void IoPipeline::write(const std::string& path, const std::vector<ExecView>& segments, std::shared_ptr<void> owner, std::function<void(bool)> done)
+{
+    std::unique_ptr<Request> request(new Request);
+    request->write = true;
+    request->path = path;
+    request->owner = std::move(owner);
+    request->finished = std::move(done);
+    
+    for (auto& segment : segments)
+    {
+        if (segment.size != 0)
+        {
+            request->iov.push_back({ (void *)segment.data, segment.size });
+            request->size += segment.size;
+        }
+    }
+    
+    {
+        std::unique_lock<std::mutex> lock(m_lock);
+        auto size = request->size;
+        
+        // one write is always let through, however big
+        m_changed.wait(lock, [this, size] { return m_writeBytes == 0 || m_writeBytes + size <= m_maxBytes; });
+        
+        m_writeBytes += size;
+        ++m_writes;
+        m_writeQueue.push_back(std::move(request));
+    }
+    
+    wake();
+}
+
+void IoPipeline::flush(void)
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+    m_changed.wait(lock, [this] { return m_writes == 0; });
+}
+
+void IoPipeline::wake(void)
+{
+    m_changed.notify_all();
+    
+    if (m_ring)
+    {
+        m_ring->signal();
+    }
+}
+
+// with the lock held
+void IoPipeline::collect(std::vector<Request *>& starting)
+{
+    // writes free memory, so they go first
+    while (!m_writeQueue.empty() && m_inFlight < m_limit)
+    {
+        starting.push_back(m_writeQueue.front().release());
+        m_writeQueue.pop_front();
+        ++m_inFlight;
+    }
+    
+    // then anything a worker is already waiting for, then reads in order
+    // for as long as there is room
+    for (auto it = m_readQueue.begin(); it != m_readQueue.end() && m_inFlight < m_limit; )
+    {
+        auto request = *it;
+        
+        if (!request->wanted && (it != m_readQueue.begin() || m_readBytes >= m_maxBytes))
+        {
+            ++it;
+            continue;
+        }
+        
+        request->started = true;
+        m_readBytes += request->size;
+        starting.push_back(request);
+        it = m_readQueue.erase(it);
+        ++m_inFlight;
+    }
+}
+
+void IoPipeline::run(void)
+{
+    traceThreadName("io");
+    std::vector<Request *> starting;
+    
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_lock);
+            collect(starting);
+            
+            // without a ring there is nothing else to wait for
+            while (!m_ring && starting.empty() && !(m_stop && m_inFlight == 0))
+            {
+                m_changed.wait(lock);
+                collect(starting);
+            }
+            
+            if (starting.empty() && m_stop && m_inFlight == 0)
+            {
+                return;
+            }
+        }
+        
+        for (auto request : starting)
+        {
+            start(request);
+        }
+        
+        starting.clear();
+        
+#ifdef IOPIPELINE_HAVE_URING
+        if (m_ring)
+        {
+            // a ring that stops taking requests is fatal, nothing would ever
+            // complete otherwise
+            if (!m_ring->submit())
+            {
+                std::abort();
+            }
+            
+            m_ring->wait();
+            io_uring_cqe cqe;
+            
+            // resubmissions from advance() go out on the next round
+            while (m_ring->reap(cqe))
+            {
+                advance((Request *)(uintptr_t)cqe.user_data, cqe.res);
+            }
+        }
+#endif
+    }
+}
+
+void IoPipeline::start(Request *request)
+{
+    request->span.reset(new TraceSpan((request->write) ? ("io write") : ("io read"), "io", (uintptr_t)request));
+    request->span->arg("file", request->path);
+    request->span->arg("bytes", request->size);
+    
+    if (request->write)
+    {
+        if (!request->replacement.open(request->path))
+        {
+            post(request, false);
+            return;
+        }
+        
+        request->fd = request->replacement.fd();
+    }
+    else
+    {
+        struct stat st;
+        request->fd = ::open(request->path.c_str(), O_RDONLY | O_CLOEXEC);
+        
+        // the size was counted against the budget when it was prefetched, so
+        // a file that has changed since is left to the caller
+        if (request->fd < 0 || fstat(request->fd, &st) != 0 || (size_t)st.st_size != request->size)
+        {
+            post(request, false);
+            return;
+        }
+        
+        request->data.resize(request->size);
+        request->iov.push_back({ request->data.data(), request->size });
+    }
+    
+    if (request->size == 0)
+    {
+        post(request, true);
+        return;
+    }
+    
+    issue(request);
+}
+
+// a request that is over before any I/O still completes through the ring,
+// or the loop would sleep on it with nothing else to wake it
+void IoPipeline::post(Request *request, bool ok)
+{
+#ifdef IOPIPELINE_HAVE_URING
+    if (m_ring)
+    {
+        request->posted = true;
+        request->ok = ok;
+        
+        auto sqe = m_ring->next();
+        sqe->opcode = IORING_OP_NOP;
+        sqe->fd = -1;
+        sqe->user_data = (u64)(uintptr_t)request;
+        return;
+    }
+#endif
+    
+    finish(request, ok);
+}
+
+void IoPipeline::issue(Request *request)
+{
+    auto iov = request->iov.data() + request->next;
+    auto count = std::min<size_t>(request->iov.size() - request->next, IOV_MAX);
+    
+#ifdef IOPIPELINE_HAVE_URING
+    if (m_ring)
+    {
+        auto sqe = m_ring->next();
+        sqe->opcode = (request->write) ? (IORING_OP_WRITEV) : (IORING_OP_READV);
+        sqe->fd = request->fd;
+        sqe->addr = (u64)(uintptr_t)iov;
+        sqe->len = (u32)count;
+        sqe->off = request->offset;
+        sqe->user_data = (u64)(uintptr_t)request;
+        return;
+    }
+#endif
+    
+    long res;
+    
+    do
+    {
+        res = (request->write) ? (pwritev(request->fd, iov, (int)count, request->offset)) : (preadv(request->fd, iov, (int)count, request->offset));
+    } while (res < 0 && errno == EINTR);
+    
+    advance(request, (res < 0) ? (-errno) : (res));
+}
+
+void IoPipeline::advance(Request *request, long result)
+{
+    if (request->posted)
+    {
+        finish(request, request->ok);
+        return;
+    }
+    
+    if (result == -EINTR || result == -EAGAIN)
+    {
+        issue(request);
+        return;
+    }
+    
+    // a read that ends early means the file shrank under us
+    if (result <= 0)
+    {
+        finish(request, false);
+        return;
+    }
+    
+    request->offset += result;
+    
+    while (request->next < request->iov.size() && (size_t)result >= request->iov[request->next].iov_len)
+    {
+        result -= request->iov[request->next].iov_len;
+        ++request->next;
+    }
+    
+    if (request->next == request->iov.size())
+    {
+        finish(request, true);
+        return;
+    }
+    
+    auto& partial = request->iov[request->next];
+    partial.iov_base = (char *)partial.iov_base + result;
+    partial.iov_len -= result;
+    issue(request);
+}
+
+void IoPipeline::finish(Request *request, bool ok)
+{
+    request->span.reset();
+    
+    if (!request->write)
+    {
+        if (request->fd >= 0)
+        {
+            ::close(request->fd);
+        }
+        
+        std::lock_guard<std::mutex> guard(m_lock);
+        
+        if (!ok)
+        {
+            m_readBytes -= request->size;
+            ModuleBuffer().swap(request->data);
+        }
+        
+        request->complete = true;
+        request->ok = ok;
+        --m_inFlight;
+        m_changed.notify_all();
+        return;
+    }
+    
+    ok = request->replacement.commit(ok);
+    request->finished(ok);
+    
+    std::unique_ptr<Request> done(request);
+    done->owner.reset();
+    
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_writeBytes -= done->size;
+    --m_writes;
+    --m_inFlight;
+    m_changed.notify_all();
+}
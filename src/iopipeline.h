@@ -0,0 +1,114 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#ifndef IOPIPELINE_H_
+#define IOPIPELINE_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "packexec.h"
+#include "buffer.h"
+
+// reads the files of a batch ahead of the workers packing them, and writes
+// the packed files behind them, on a thread of its own. the workers then only
+// wait on the disk when they get ahead of it. on linux the I/O goes through
+// io_uring with many requests in flight, otherwise (or if the kernel won't
+// set up a ring) it is pread and pwritev, one request at a time.
+class IoPipeline
+{
+public:
+    // at most 'maxBytes' of files read ahead, and as much again waiting to
+    // be written. files bigger than a quarter of that are left to the caller.
+    explicit IoPipeline(size_t maxBytes, bool useRing = true);
+    ~IoPipeline();
+    
+    IoPipeline(const IoPipeline&) = delete;
+    IoPipeline& operator=(const IoPipeline&) = delete;
+    
+    // "io_uring" or "pread"
+    const char *backend(void) const;
+    
+    // files to read, in the order they are likely to be asked for
+    void prefetch(const std::vector<std::string>& paths);
+    
+    // wait for a prefetched file and take its contents. false if it wasn't
+    // prefetched, was too big or couldn't be read, and the caller should
+    // read it itself.
+    bool read(const std::string& path, ModuleBuffer& data);
+    
+    // replace 'path' with the segments, as writeFileAtomic does. 'owner'
+    // keeps what they point at alive until then, and 'done' is called on
+    // the I/O thread with the result. blocks while too much is waiting.
+    void write(const std::string& path, const std::vector<ExecView>& segments, std::shared_ptr<void> owner, std::function<void(bool)> done);
+    
+    // wait for every write to finish
+    void flush(void);
+    
+private:
+    struct Request;
+    struct Ring;
+    
+    void run(void);
+    void collect(std::vector<Request *>& starting);
+    void start(Request *request);
+    void post(Request *request, bool ok);
+    void issue(Request *request);
+    void advance(Request *request, long result);
+    void finish(Request *request, bool ok);
+    void wake(void);
+    
+    size_t m_maxBytes;
+    std::unique_ptr<Ring> m_ring;
+    
+    std::mutex m_lock;
+    std::condition_variable m_changed;
+    
+    // reads by path, and the order to start them in
+    std::map<std::string, std::unique_ptr<Request>> m_reads;
+    std::deque<Request *> m_readQueue;
+    std::deque<std::unique_ptr<Request>> m_writeQueue;
+    
+    // bytes read but not taken, and written but not finished
+    size_t m_readBytes;
+    size_t m_writeBytes;
+    unsigned int m_writes;
+    
+    // started and not finished, up to the ring size or one without a ring
+    unsigned int m_inFlight;
+    unsigned int m_limit;
+    bool m_stop;
+    
+    std::thread m_thread;
+};
+
+#endif // IOPIPELINE_H_
@@ -0,0 +1,776 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#include "isoimage.h"
+#include "elf.h"
+#include "psp.h"
+#include "fileio.h"
+#include "threadpool.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <map>
+#include <new>
+#include <set>
+#include <stdexcept>
+
+#define ISO_SECTOR_SIZE         (2048)
+#define ISO_FIRST_DESCRIPTOR    (16)
+#define ISO_MAX_DESCRIPTORS     (64)
+#define ISO_MAX_DEPTH           (64)
+
+#define ISO_DESCRIPTOR_PRIMARY      (1)
+#define ISO_DESCRIPTOR_SUPPLEMENTARY (2)
+#define ISO_DESCRIPTOR_END          (255)
+
+#define ISO_FLAG_DIRECTORY      (0x02)
+#define ISO_FLAG_MULTI_EXTENT   (0x80)
+
+// "CISO"
+#define CSO_MAGIC               (0x4F534943)
+#define CSO_PLAIN               (0x80000000)
+
+// blocks a CSO task inflates or deflates at once
+#define CSO_TASK_BLOCKS         (256)
+
+// the largest block size read, far above what any tool writes
+#define CSO_MAX_BLOCK_SIZE      (0x100000)
+
+namespace
+{
+    struct CsoHeader
+    {
+        u32 magic;
+        u32 headerSize;
+        u64 totalBytes;
+        u32 blockSize;
+        u8 version;
+        u8 align;
+        u8 reserved[2];
+    };
+    
+    static_assert(sizeof(CsoHeader) == 0x18, "CSO header has the wrong size");
+    
+    // a file as the directory records describe it. the same extent can be
+    // named more than once, by a Joliet tree for one.
+    struct ImageEntry
+    {
+        std::string path;
+        u32 extent;
+        u32 size;
+        bool usable;
+        
+        // where the records naming it are in the image
+        std::vector<size_t> records;
+    };
+    
+    struct ImageIndex
+    {
+        std::map<u32, ImageEntry> files;
+        
+        // volume descriptors, which hold the size of the volume
+        std::vector<size_t> descriptors;
+        std::set<u32> directories;
+    };
+    
+    // part of the image replaced by new data, zero filled past 'dataSize'
+    struct Replacement
+    {
+        u64 offset;
+        u64 size;
+        const char *data;
+        u64 dataSize;
+    };
+    
+    u32 read32(const char *p)
+    {
+        return (u8)p[0] | ((u8)p[1] << 8) | ((u8)p[2] << 16) | ((u32)(u8)p[3] << 24);
+    }
+    
+    // ISO9660 stores numbers little endian followed by big endian
+    void writeBoth32(char *p, u32 value)
+    {
+        for (int i = 0; i < 4; ++i)
+        {
+            p[i] = (char)(value >> (8 * i));
+            p[7 - i] = (char)(value >> (8 * i));
+        }
+    }
+    
+    std::string recordName(const char *name, u8 length, bool joliet)
+    {
+        std::string decoded;
+        
+        // Joliet names are UCS-2, big endian
+        if (joliet)
+        {
+            for (auto i = 0; i + 1 < length; i += 2)
+            {
+                decoded += (name[i] == 0) ? (name[i + 1]) : ('?');
+            }
+        }
+        else
+        {
+            decoded.assign(name, length);
+        }
+        
+        // drop the version, and the dot of names without an extension
+        auto version = decoded.find(';');
+        
+        if (version != std::string::npos)
+        {
+            decoded.resize(version);
+        }
+        
+        if (!decoded.empty() && decoded.back() == '.')
+        {
+            decoded.pop_back();
+        }
+        
+        return decoded;
+    }
+    
+    bool walkDirectory(const char *image, size_t size, u32 extent, u32 length, const std::string& prefix, bool joliet, int depth, ImageIndex& index)
+    {
+        // directories that loop back are left alone
+        if (depth > ISO_MAX_DEPTH || !index.directories.insert(extent).second)
+        {
+            return true;
+        }
+        
+        auto start = (u64)extent * ISO_SECTOR_SIZE;
+        
+        if (start > size || length > size - start)
+        {
+            return false;
+        }
+        
+        auto continued = false;
+        
+        for (u32 offset = 0; offset < length; )
+        {
+            auto record = image + start + offset;
+            auto recordLength = (u8)record[0];
+            
+            // records don't cross sectors, the rest of this one is padding
+            if (recordLength == 0)
+            {
+                offset = (offset / ISO_SECTOR_SIZE + 1) * ISO_SECTOR_SIZE;
+                continue;
+            }
+            
+            auto nameLength = (u8)record[32];
+            
+            if (recordLength < 34 || recordLength > length - offset || 33u + nameLength > recordLength)
+            {
+                return false;
+            }
+            
+            auto flags = (u8)record[25];
+            auto childExtent = read32(record + 2);
+            auto childSize = read32(record + 10);
+            offset += recordLength;
+            
+            // "." and ".."
+            if (nameLength == 1 && (record[33] == 0 || record[33] == 1))
+            {
+                continue;
+            }
+            
+            auto path = prefix + "/" + recordName(record + 33, nameLength, joliet);
+            
+            if (flags & ISO_FLAG_DIRECTORY)
+            {
+                if (!walkDirectory(image, size, childExtent, childSize, path, joliet, depth + 1, index))
+                {
+                    return false;
+                }
+                
+                continue;
+            }
+            
+            auto& file = index.files[childExtent];
+            
+            if (file.records.empty())
+            {
+                file.path = path;
+                file.extent = childExtent;
+                file.size = childSize;
+                file.usable = true;
+            }
+            
+            // files in pieces, and extents shared by files of different
+            // sizes, are never touched
+            if (file.size != childSize || (flags & ISO_FLAG_MULTI_EXTENT) || continued)
+            {
+                file.usable = false;
+            }
+            
+            continued = (flags & ISO_FLAG_MULTI_EXTENT) != 0;
+            file.records.push_back(record - image);
+        }
+        
+        return true;
+    }
+    
+    bool indexImage(const char *image, size_t size, ImageIndex& index)
+    {
+        auto found = false;
+        
+        for (u32 sector = ISO_FIRST_DESCRIPTOR; sector < ISO_FIRST_DESCRIPTOR + ISO_MAX_DESCRIPTORS; ++sector)
+        {
+            auto offset = (u64)sector * ISO_SECTOR_SIZE;
+            
+            if (offset + ISO_SECTOR_SIZE > size)
+            {
+                return false;
+            }
+            
+            auto descriptor = image + offset;
+            auto type = (u8)descriptor[0];
+            
+            if (std::memcmp(descriptor + 1, "CD001", 5) != 0)
+            {
+                return false;
+            }
+            
+            if (type == ISO_DESCRIPTOR_END)
+            {
+                break;
+            }
+            
+            if (type != ISO_DESCRIPTOR_PRIMARY && type != ISO_DESCRIPTOR_SUPPLEMENTARY)
+            {
+                continue;
+            }
+            
+            // the primary volume has to come first, and Joliet names its
+            // escape sequences in the supplementary one
+            if (type == ISO_DESCRIPTOR_PRIMARY)
+            {
+                found = true;
+            }
+            
+            if (!found)
+            {
+                return false;
+            }
+            
+            auto joliet = (type == ISO_DESCRIPTOR_SUPPLEMENTARY && descriptor[88] == '%' && descriptor[89] == '/');
+            auto root = descriptor + 156;
+            
+            if (!walkDirectory(image, size, read32(root + 2), read32(root + 10), "", joliet, 0, index))
+            {
+                return false;
+            }
+            
+            index.descriptors.push_back(offset);
+        }
+        
+        return found;
+    }
+    
+    bool looksPackable(const char *image, size_t size, const ImageEntry& file)
+    {
+        auto offset = (u64)file.extent * ISO_SECTOR_SIZE;
+        
+        if (!file.usable || file.size < sizeof(Elf32_Ehdr) || offset > size || file.size > size - offset)
+        {
+            return false;
+        }
+        
+        auto magic = read32(image + offset);
+        return magic == ELF_MAGIC || magic == PBP_HEADER_MAGIC;
+    }
+    
+    ErrorTypes readCso(const char *data, size_t size, ThreadPool& pool, ModuleBuffer& image, u32& blockSize)
+    {
+        CsoHeader header;
+        
+        if (size < sizeof(CsoHeader))
+        {
+            return ERROR_BAD_IMAGE;
+        }
+        
+        std::memcpy(&header, data, sizeof(CsoHeader));
+        blockSize = header.blockSize;
+        
+        if (header.magic != CSO_MAGIC || blockSize < ISO_SECTOR_SIZE || blockSize > CSO_MAX_BLOCK_SIZE || (blockSize & (blockSize - 1)) != 0 || header.align > 16)
+        {
+            return ERROR_BAD_IMAGE;
+        }
+        
+        auto index = data + sizeof(CsoHeader);
+        
+        if (size < sizeof(CsoHeader) + sizeof(u32))
+        {
+            return ERROR_BAD_IMAGE;
+        }
+        
+        // the index has an entry per block and one past the last, and ends
+        // where the first block starts, which bounds the image it describes
+        auto indexEnd = std::min<u64>((u64)(read32(index) & ~CSO_PLAIN) << header.align, size);
+        auto indexed = (indexEnd > sizeof(CsoHeader)) ? ((indexEnd - sizeof(CsoHeader)) / sizeof(u32)) : (0);
+        
+        if (indexed < 1 || header.totalBytes > (indexed - 1) * blockSize)
+        {
+            return ERROR_BAD_IMAGE;
+        }
+        
+        auto blocks = (header.totalBytes + blockSize - 1) / blockSize;
+        
+        try
+        {
+            image.resize(header.totalBytes);
+        }
+        catch (const std::bad_alloc&)
+        {
+            return ERROR_OUT_OF_MEMORY;
+        }
+        catch (const std::length_error&)
+        {
+            return ERROR_OUT_OF_MEMORY;
+        }
+        
+        std::atomic<bool> ok(true);
+        TaskGroup group(pool);
+        
+        for (u64 first = 0; first < blocks; first += CSO_TASK_BLOCKS)
+        {
+            group.run([&, first]()
+            {
+                z_stream stream;
+                std::memset(&stream, 0, sizeof(stream));
+                
+                if (inflateInit2(&stream, -15) != Z_OK)
+                {
+                    ok = false;
+                    return;
+                }
+                
+                for (auto block = first; block < std::min<u64>(first + CSO_TASK_BLOCKS, blocks) && ok; ++block)
+                {
+                    auto entry = read32(index + block * sizeof(u32));
+                    auto start = (u64)(entry & ~CSO_PLAIN) << header.align;
+                    auto end = (u64)(read32(index + (block + 1) * sizeof(u32)) & ~CSO_PLAIN) << header.align;
+                    auto output = image.data() + block * blockSize;
+                    auto outputSize = (u32)std::min<u64>(blockSize, header.totalBytes - block * blockSize);
+                    
+                    // the last block may be followed by padding, so its end is
+                    // only a bound
+                    if (start > end || end > size)
+                    {
+                        ok = false;
+                        break;
+                    }
+                    
+                    if (entry & CSO_PLAIN)
+                    {
+                        if (end - start < outputSize)
+                        {
+                            ok = false;
+                            break;
+                        }
+                        
+                        std::memcpy(output, data + start, outputSize);
+                        continue;
+                    }
+                    
+                    inflateReset(&stream);
+                    stream.next_in = (Bytef *)(data + start);
+                    stream.avail_in = (uInt)(end - start);
+                    stream.next_out = (Bytef *)output;
+                    stream.avail_out = outputSize;
+                    
+                    auto res = inflate(&stream, Z_FINISH);
+                    
+                    if ((res != Z_STREAM_END && res != Z_BUF_ERROR) || stream.avail_out != 0)
+                    {
+                        ok = false;
+                    }
+                }
+                
+                inflateEnd(&stream);
+            });
+        }
+        
+        group.wait();
+        return (ok) ? (NO_ERROR) : (ERROR_BAD_IMAGE);
+    }
+    
+    // compress the image the segments make up back into a CSO
+    bool writeCso(const std::vector<ExecView>& segments, u64 totalBytes, u32 blockSize, int level, ThreadPool& pool, ModuleBuffer& output)
+    {
+        auto blocks = (totalBytes + blockSize - 1) / blockSize;
+        auto dataStart = sizeof(CsoHeader) + (blocks + 1) * sizeof(u32);
+        
+        // offsets only have 31 bits, so large images align their blocks
+        u8 align = 0;
+        
+        while (((dataStart + blocks * (blockSize + ((u64)1 << align))) >> align) > 0x7FFFFFFF)
+        {
+            ++align;
+        }
+        
+        CsoHeader header;
+        std::memset(&header, 0, sizeof(header));
+        header.magic = CSO_MAGIC;
+        header.headerSize = sizeof(CsoHeader);
+        header.totalBytes = totalBytes;
+        header.blockSize = blockSize;
+        header.version = 1;
+        header.align = align;
+        
+        output.resize(dataStart);
+        std::memcpy(output.data(), &header, sizeof(header));
+        std::vector<u32> index;
+        
+        // a batch of blocks is gathered from the segments, compressed on the
+        // pool and appended in order
+        auto batchBlocks = (u64)CSO_TASK_BLOCKS * std::max(pool.size(), 1u);
+        ModuleBuffer batch(batchBlocks * blockSize);
+        ModuleBuffer compressed(batchBlocks * (blockSize + 64));
+        std::vector<u32> compressedSizes(batchBlocks);
+        auto segment = segments.begin();
+        u64 segmentOffset = 0;
+        
+        for (u64 first = 0; first < blocks; first += batchBlocks)
+        {
+            auto count = std::min(batchBlocks, blocks - first);
+            auto batchBytes = std::min<u64>(count * blockSize, totalBytes - first * blockSize);
+            
+            for (u64 filled = 0; filled < batchBytes; )
+            {
+                auto take = std::min<u64>(segment->size - segmentOffset, batchBytes - filled);
+                std::memcpy(batch.data() + filled, segment->data + segmentOffset, take);
+                filled += take;
+                segmentOffset += take;
+                
+                if (segmentOffset == segment->size)
+                {
+                    ++segment;
+                    segmentOffset = 0;
+                }
+            }
+            
+            std::atomic<bool> ok(true);
+            TaskGroup group(pool);
+            
+            for (u64 task = 0; task < count; task += CSO_TASK_BLOCKS)
+            {
+                group.run([&, task]()
+                {
+                    z_stream stream;
+                    std::memset(&stream, 0, sizeof(stream));
+                    
+                    if (deflateInit2(&stream, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+                    {
+                        ok = false;
+                        return;
+                    }
+                    
+                    for (auto block = task; block < std::min<u64>(task + CSO_TASK_BLOCKS, count); ++block)
+                    {
+                        deflateReset(&stream);
+                        stream.next_in = (Bytef *)(batch.data() + block * blockSize);
+                        stream.avail_in = (uInt)std::min<u64>(blockSize, batchBytes - block * blockSize);
+                        stream.next_out = (Bytef *)(compressed.data() + block * (blockSize + 64));
+                        stream.avail_out = blockSize + 64;
+                        
+                        // blocks that don't shrink are stored as they are
+                        auto res = deflate(&stream, Z_FINISH);
+                        compressedSizes[block] = (res == Z_STREAM_END && stream.total_out < stream.total_in) ? ((u32)stream.total_out) : (0);
+                    }
+                    
+                    deflateEnd(&stream);
+                });
+            }
+            
+            group.wait();
+            
+            if (!ok)
+            {
+                return false;
+            }
+            
+            for (u64 block = 0; block < count; ++block)
+            {
+                // blocks start on the alignment, padded with zeros
+                output.resize(((output.size() + ((size_t)1 << align) - 1) >> align) << align, 0);
+                auto plain = (compressedSizes[block] == 0);
+                index.push_back((u32)(output.size() >> align) | ((plain) ? (CSO_PLAIN) : (0)));
+                
+                auto data = (plain) ? (batch.data() + block * blockSize) : (compressed.data() + block * (blockSize + 64));
+                auto dataSize = (plain) ? (std::min<u64>(blockSize, batchBytes - block * blockSize)) : (compressedSizes[block]);
+                output.insert(output.end(), data, data + dataSize);
+            }
+        }
+        
+        index.push_back((u32)(((output.size() + ((size_t)1 << align) - 1) >> align)));
+        std::memcpy(output.data() + sizeof(CsoHeader), index.data(), index.size() * sizeof(u32));
+        return true;
+    }
+    
+    void addZeros(std::vector<ExecView>& segments, u64 size)
+    {
+        static const char zeros[64 * 1024] = {};
+        
+        while (size != 0)
+        {
+            auto count = std::min<u64>(size, sizeof(zeros));
+            segments.push_back({ zeros, (size_t)count });
+            size -= count;
+        }
+    }
+}
+
+int pack_image(const std::string& path, ThreadPool& pool, TagHandler psptagHandler, TagHandler oetagHandler, const PackOptions& options, ImageResult& result)
+{
+    MappedFile file;
+    
+    if (!file.open(path))
+    {
+        return ERROR_STREAM_READ;
+    }
+    
+    result.inputSize = file.size();
+    
+    // a CSO is inflated whole, an ISO is used where it is
+    const char *image = file.data();
+    size_t size = file.size();
+    ModuleBuffer inflated;
+    u32 blockSize = ISO_SECTOR_SIZE;
+    
+    if (size >= sizeof(u32) && read32(image) == CSO_MAGIC)
+    {
+        auto res = readCso(file.data(), file.size(), pool, inflated, blockSize);
+        
+        if (res != NO_ERROR)
+        {
+            return res;
+        }
+        
+        result.compressed = true;
+        image = inflated.data();
+        size = inflated.size();
+    }
+    
+    ImageIndex index;
+    
+    if (!indexImage(image, size, index))
+    {
+        return ERROR_BAD_IMAGE;
+    }
+    
+    std::vector<const ImageEntry *> candidates;
+    
+    for (auto& file : index.files)
+    {
+        if (looksPackable(image, size, file.second))
+        {
+            candidates.push_back(&file.second);
+        }
+    }
+    
+    // largest first, like a batch of files
+    std::stable_sort(candidates.begin(), candidates.end(), [](const ImageEntry *a, const ImageEntry *b)
+    {
+        return a->size > b->size;
+    });
+    
+    result.modules.resize(candidates.size());
+    std::vector<ExecBuffer> packed(candidates.size());
+    
+    {
+        TaskGroup group(pool);
+        
+        for (auto i = 0u; i < candidates.size(); ++i)
+        {
+            group.run([&, i]()
+            {
+                auto& entry = *candidates[i];
+                auto& module = result.modules[i];
+                auto data = image + (u64)entry.extent * ISO_SECTOR_SIZE;
+                
+                module.path = entry.path;
+                module.inputSize = entry.size;
+                module.info.times = &module.times;
+                
+                // packing patches its input, and the image has to stay as it is
+                packed[i].assign(data, data + entry.size);
+                module.error = pack_executable(packed[i], psptagHandler, oetagHandler, options, &module.info);
+                module.skipped = (module.error == ERROR_NOT_PRX || module.error == ERROR_ALREADY_PACKED);
+                module.packedSize = (module.error == NO_ERROR) ? (packed[i].size()) : (0);
+                
+                if (module.error != NO_ERROR)
+                {
+                    ExecBuffer().swap(packed[i]);
+                }
+            });
+        }
+        
+        group.wait();
+    }
+    
+    // modules go back over their old extents, or past the end of the image
+    // if they don't fit. the records naming them and the volume size are
+    // patched in copies of their sectors.
+    std::vector<Replacement> replacements;
+    std::map<u64, ExecBuffer> patched;
+    auto sectors = (u32)((size + ISO_SECTOR_SIZE - 1) / ISO_SECTOR_SIZE);
+    auto end = sectors;
+    std::vector<u32> moved;
+    
+    auto patch = [&](size_t offset) -> char *
+    {
+        auto sector = offset - offset % ISO_SECTOR_SIZE;
+        auto& copy = patched[sector];
+        
+        if (copy.empty())
+        {
+            copy.assign(image + sector, image + sector + ISO_SECTOR_SIZE);
+        }
+        
+        return copy.data() + offset - sector;
+    };
+    
+    for (auto i = 0u; i < candidates.size(); ++i)
+    {
+        auto& entry = *candidates[i];
+        auto& module = result.modules[i];
+        
+        if (module.error != NO_ERROR)
+        {
+            continue;
+        }
+        
+        auto offset = (u64)entry.extent * ISO_SECTOR_SIZE;
+        auto room = std::min<u64>(((u64)entry.size + ISO_SECTOR_SIZE - 1) / ISO_SECTOR_SIZE * ISO_SECTOR_SIZE, size - offset);
+        auto extent = entry.extent;
+        
+        if (module.packedSize <= room)
+        {
+            replacements.push_back({ offset, room, packed[i].data(), module.packedSize });
+        }
+        else
+        {
+            replacements.push_back({ offset, room, nullptr, 0 });
+            module.relocated = true;
+            moved.push_back(i);
+            extent = end;
+            end += (u32)((module.packedSize + ISO_SECTOR_SIZE - 1) / ISO_SECTOR_SIZE);
+        }
+        
+        for (auto record : entry.records)
+        {
+            auto p = patch(record);
+            writeBoth32(p + 2, extent);
+            writeBoth32(p + 10, (u32)module.packedSize);
+        }
+    }
+    
+    if (end != sectors)
+    {
+        for (auto descriptor : index.descriptors)
+        {
+            writeBoth32(patch(descriptor) + 80, end);
+        }
+    }
+    
+    for (auto& sector : patched)
+    {
+        replacements.push_back({ sector.first, ISO_SECTOR_SIZE, sector.second.data(), ISO_SECTOR_SIZE });
+    }
+    
+    // nothing packed, so the image stays as it is
+    if (replacements.empty())
+    {
+        result.outputSize = result.inputSize;
+        return NO_ERROR;
+    }
+    
+    std::sort(replacements.begin(), replacements.end(), [](const Replacement& a, const Replacement& b)
+    {
+        return a.offset < b.offset;
+    });
+    
+    // everything between the replacements comes straight from the image
+    std::vector<ExecView> segments;
+    u64 cursor = 0;
+    
+    for (auto& replacement : replacements)
+    {
+        // a module extent overlapping a directory
+        if (replacement.offset < cursor)
+        {
+            return ERROR_BAD_IMAGE;
+        }
+        
+        segments.push_back({ image + cursor, (size_t)(replacement.offset - cursor) });
+        segments.push_back({ replacement.data, (size_t)replacement.dataSize });
+        addZeros(segments, replacement.size - replacement.dataSize);
+        cursor = replacement.offset + replacement.size;
+    }
+    
+    segments.push_back({ image + cursor, size - cursor });
+    
+    if (!moved.empty())
+    {
+        addZeros(segments, (u64)sectors * ISO_SECTOR_SIZE - size);
+        
+        for (auto i : moved)
+        {
+            auto& module = result.modules[i];
+            segments.push_back({ packed[i].data(), module.packedSize });
+            addZeros(segments, (ISO_SECTOR_SIZE - module.packedSize % ISO_SECTOR_SIZE) % ISO_SECTOR_SIZE);
+        }
+    }
+    
+    u64 total = 0;
+    
+    for (auto& segment : segments)
+    {
+        total += segment.size;
+    }
+    
+    if (result.compressed)
+    {
+        ModuleBuffer cso;
+        
+        if (!writeCso(segments, total, blockSize, options.params.level, pool, cso))
+        {
+            return ERROR_GZIP_COMPRESSION;
+        }
+        
+        result.outputSize = cso.size();
+        return (writeFileAtomic(path, { { cso.data(), cso.size() } })) ? (NO_ERROR) : (ERROR_STREAM_WRITE);
+    }
+    
+    result.outputSize = total;
+    return (writeFileAtomic(path, segments, &file)) ? (NO_ERROR) : (ERROR_STREAM_WRITE);
+}
@@ -0,0 +1,77 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#ifndef ISOIMAGE_H_
+#define ISOIMAGE_H_
+
+#include <string>
+#include <vector>
+
+#include "packexec.h"
+
+class ThreadPool;
+
+// a file inside an image that looked like a PRX or PBP
+struct ImageModule
+{
+    ImageModule() : error(NO_ERROR), skipped(false), relocated(false), inputSize(0), packedSize(0) {}
+    
+    // path inside the image, eg. "/PSP_GAME/USRDIR/module.prx"
+    std::string path;
+    int error;
+    
+    // not a plain PRX or PBP after all, or already packed
+    bool skipped;
+    
+    // didn't fit its old extent any more and moved to the end of the image
+    bool relocated;
+    
+    size_t inputSize;
+    size_t packedSize;
+    PackInfo info;
+    PhaseTimes times;
+};
+
+struct ImageResult
+{
+    ImageResult() : compressed(false), inputSize(0), outputSize(0) {}
+    
+    // the image was a CSO and was written back as one
+    bool compressed;
+    
+    size_t inputSize;
+    size_t outputSize;
+    
+    std::vector<ImageModule> modules;
+};
+
+// pack every PRX and PBP inside an ISO9660 image, or a CSO of one, in place.
+// the modules are packed on the pool and written over their old extents,
+// and only those that no longer fit move to the end of the image. the rest
+// of the image goes across untouched. errors are for the image as a whole,
+// each module has its own.
+int pack_image(const std::string& path, ThreadPool& pool, TagHandler psptagHandler, TagHandler oetagHandler, const PackOptions& options, ImageResult& result);
+
+#endif // ISOIMAGE_H_
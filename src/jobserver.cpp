@@ -0,0 +1,221 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#include "jobserver.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+Jobserver::~Jobserver()
+{
+    // tokens still held would be lost to the rest of the build
+    while (!m_tokens.empty())
+    {
+        release();
+    }
+    
+#ifndef _WIN32
+    if (m_closeRead)
+    {
+        ::close(m_read);
+    }
+    
+    if (m_closeWrite)
+    {
+        ::close(m_write);
+    }
+#endif
+}
+
+#ifndef _WIN32
+
+namespace
+{
+    // the value of the last option with the given prefix, make appends
+    // newer ones after inherited ones
+    bool findOption(const char *makeflags, const char *option, std::string& value)
+    {
+        auto found = false;
+        auto length = std::strlen(option);
+        
+        for (auto p = std::strstr(makeflags, option); p != nullptr; p = std::strstr(p + length, option))
+        {
+            if (p != makeflags && p[-1] != ' ')
+            {
+                continue;
+            }
+            
+            auto end = p + length;
+            
+            while (*end != '\0' && *end != ' ')
+            {
+                ++end;
+            }
+            
+            value.assign(p + length, end);
+            found = true;
+        }
+        
+        return found;
+    }
+    
+    bool validFd(int fd)
+    {
+        return fd >= 0 && fcntl(fd, F_GETFD) != -1;
+    }
+}
+
+bool Jobserver::open(const char *makeflags)
+{
+    std::string auth;
+    
+    if (makeflags == nullptr || (!findOption(makeflags, "--jobserver-auth=", auth) && !findOption(makeflags, "--jobserver-fds=", auth)))
+    {
+        return false;
+    }
+    
+    // make 4.4 names a fifo, older versions pass down both ends of a pipe
+    if (auth.compare(0, 5, "fifo:") == 0)
+    {
+        auto path = auth.substr(5);
+        auto read = ::open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        
+        if (read < 0)
+        {
+            return false;
+        }
+        
+        auto write = ::open(path.c_str(), O_WRONLY | O_CLOEXEC);
+        
+        if (write < 0)
+        {
+            ::close(read);
+            return false;
+        }
+        
+        m_read = read;
+        m_write = write;
+        m_closeRead = m_closeWrite = true;
+        return true;
+    }
+    
+    int read, write;
+    
+    if (std::sscanf(auth.c_str(), "%d,%d", &read, &write) != 2 || !validFd(read) || !validFd(write))
+    {
+        return false;
+    }
+    
+    // the pipe is shared with make and everything else it runs, so it can't
+    // be made non-blocking. reopening it gives a description of our own that
+    // can, otherwise a token taken between poll and read blocks until the
+    // next one comes back.
+    char self[64];
+    std::snprintf(self, sizeof(self), "/proc/self/fd/%d", read);
+    m_read = ::open(self, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    m_closeRead = (m_read >= 0);
+    
+    if (m_read < 0)
+    {
+        m_read = read;
+    }
+    
+    m_write = write;
+    return true;
+}
+
+bool Jobserver::acquire(int timeout)
+{
+    if (m_read < 0)
+    {
+        return false;
+    }
+    
+    pollfd fd = { m_read, POLLIN, 0 };
+    
+    if (poll(&fd, 1, timeout) <= 0)
+    {
+        return false;
+    }
+    
+    char token;
+    
+    if (::read(m_read, &token, 1) != 1)
+    {
+        return false;
+    }
+    
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_tokens.push_back(token);
+    return true;
+}
+
+void Jobserver::release(void)
+{
+    char token;
+    
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        
+        if (m_tokens.empty())
+        {
+            return;
+        }
+        
+        token = m_tokens.back();
+        m_tokens.pop_back();
+    }
+    
+    while (::write(m_write, &token, 1) < 0 && errno == EINTR)
+    {
+    }
+}
+
+#else
+
+// make on windows hands out a named semaphore, which isn't supported
+bool Jobserver::open(const char *makeflags)
+{
+    return false;
+}
+
+bool Jobserver::acquire(int timeout)
+{
+    return false;
+}
+
+void Jobserver::release(void)
+{
+}
+
+#endif
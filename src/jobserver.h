@@ -0,0 +1,69 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#ifndef JOBSERVER_H_
+#define JOBSERVER_H_
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+// client for the GNU make jobserver. a process gets one job for free, every
+// thread past that has to hold a token read from make's pipe or fifo and
+// write it back when it is done, so the whole build stays within make -j.
+class Jobserver
+{
+public:
+    Jobserver() : m_read(-1), m_write(-1), m_closeRead(false), m_closeWrite(false) {}
+    ~Jobserver();
+    
+    Jobserver(const Jobserver&) = delete;
+    Jobserver& operator=(const Jobserver&) = delete;
+    
+    // connect to the jobserver named by --jobserver-auth (or the older
+    // --jobserver-fds) in 'makeflags'. false if there isn't one, or make
+    // didn't pass it down because the recipe isn't marked as recursive.
+    bool open(const char *makeflags);
+    
+    bool connected(void) const { return m_read >= 0; }
+    
+    // wait up to 'timeout' ms for a token
+    bool acquire(int timeout);
+    
+    // give back a token from acquire()
+    void release(void);
+    
+private:
+    int m_read;
+    int m_write;
+    bool m_closeRead;
+    bool m_closeWrite;
+    
+    // make wants back exactly the bytes it handed out
+    std::mutex m_lock;
+    std::vector<char> m_tokens;
+};
+
+#endif // JOBSERVER_H_
@@ -0,0 +1,122 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#include "libpsppacker.h"
+
+#include "packexec.h"
+
+static_assert(PSPPACKER_OK == NO_ERROR, "C and C++ error codes differ");
+static_assert(PSPPACKER_ERROR_BUFFER_TOO_SMALL == ERROR_BUFFER_TOO_SMALL, "C and C++ error codes differ");
+
+void psppackerDefaultOptions(PspPackerOptions *options)
+{
+    options->useTags = 0;
+    options->pspTag = 0;
+    options->oeTag = 0;
+    gzipDefaultParams(&options->params);
+    options->compressThreads = 0;
+    options->verify = 0;
+    options->searchParams = 0;
+    options->strip = 0;
+    options->reproducible = 0;
+    options->seed = 0;
+    options->budgetSeconds = 0;
+    options->budgetBytesPerSecond = 0;
+    options->ratio = 0;
+}
+
+size_t psppackerPackBound(const void *input, size_t size)
+{
+    return pack_executable_bound((const char *)input, size);
+}
+
+int psppackerPack(const void *input, size_t size, void *output, size_t outsize, size_t *packedSize, const PspPackerOptions *options)
+{
+    PspPackerOptions defaults;
+    size_t localSize;
+    
+    if (options == nullptr)
+    {
+        psppackerDefaultOptions(&defaults);
+        options = &defaults;
+    }
+    
+    if (packedSize == nullptr)
+    {
+        packedSize = &localSize;
+    }
+    
+    PackOptions packOptions;
+    packOptions.params = options->params;
+    packOptions.compressThreads = options->compressThreads;
+    packOptions.verify = (options->verify != 0);
+    packOptions.searchParams = (options->searchParams != 0);
+    packOptions.strip = (options->strip != 0);
+    packOptions.reproducible = (options->reproducible != 0);
+    packOptions.seed = options->seed;
+    packOptions.budget.seconds = options->budgetSeconds;
+    packOptions.budget.bytesPerSecond = options->budgetBytesPerSecond;
+    packOptions.budget.ratio = options->ratio;
+    
+    TagHandler pspTagHandler = default_psp_tag;
+    TagHandler oeTagHandler = default_oe_tag;
+    
+    if (options->useTags)
+    {
+        auto pspTag = options->pspTag;
+        auto oeTag = options->oeTag;
+        
+        pspTagHandler = [=](ExecutableType) -> unsigned int { return pspTag; };
+        oeTagHandler = [=](ExecutableType) -> unsigned int { return oeTag; };
+    }
+    
+    return pack_executable_buffer((const char *)input, size, (char *)output, outsize, *packedSize, pspTagHandler, oeTagHandler, packOptions);
+}
+
+const char *psppackerErrorString(int error)
+{
+    switch (error)
+    {
+        case NO_ERROR:                  return "no error";
+        case ERROR_ALREADY_PACKED:      return "executable is already packed";
+        case ERROR_NOT_PRX:             return "not a PRX or PBP";
+        case ERROR_NO_MODULEINFO:       return "no module info";
+        case ERROR_MIXED_PRIVILEGES:    return "module info and module attributes disagree on kernel mode";
+        case ERROR_KERNEL_PBP:          return "PBPs can't hold kernel modules";
+        case ERROR_NO_SEGMENTS:         return "no segments";
+        case ERROR_NO_BSS_SECTION:      return "no .bss section";
+        case ERROR_GZIP_COMPRESSION:    return "compression failed";
+        case ERROR_GZIP_VERIFICATION:   return "compressed module doesn't match the input";
+        case ERROR_STREAM_READ:         return "could not read input";
+        case ERROR_STREAM_WRITE:        return "could not write output";
+        case ERROR_BUFFER_TOO_SMALL:    return "output buffer too small";
+        case ERROR_OUT_OF_MEMORY:       return "out of memory";
+        case ERROR_NOT_PACKED:          return "executable is not packed";
+        case ERROR_CORRUPT_PACKED:      return "packed executable is damaged";
+        case ERROR_UNSUPPORTED_COMPRESSION: return "packed with something other than gzip";
+        case ERROR_BAD_IMAGE:           return "not an ISO9660 or CSO image";
+        default:                        return "internal error";
+    }
+}
@@ -0,0 +1,91 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#ifndef LIBPSPPACKER_H_
+#define LIBPSPPACKER_H_
+
+#include <stddef.h>
+
+#include "gzip.h"
+
+// return values, anything else is an error psppackerErrorString describes
+#define PSPPACKER_OK                        (0)
+#define PSPPACKER_ERROR_BUFFER_TOO_SMALL    (12)
+
+typedef struct
+{
+    // use pspTag and oeTag instead of the defaults for the executable type
+    int useTags;
+    unsigned int pspTag;
+    unsigned int oeTag;
+    
+    GzipParams params;
+    
+    // 0 compresses as one deflate stream, anything else in parallel blocks
+    unsigned int compressThreads;
+    
+    // inflate the packed module again and compare it against the input
+    int verify;
+    
+    // try a grid of deflate parameters and keep the smallest result
+    int searchParams;
+    
+    // leave out the ELF sections the PSP never loads
+    int strip;
+    
+    // generate the key data from 'seed', or from the input if it is 0, so
+    // the same input always packs to the same bytes
+    int reproducible;
+    unsigned long long seed;
+    
+    // pick the level by sampling the input instead of using params.level:
+    // the cheapest one expected to reach 'ratio' in the time given, either
+    // outright or as a throughput. 0 leaves a limit out.
+    double budgetSeconds;
+    double budgetBytesPerSecond;
+    double ratio;
+} PspPackerOptions;
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+void psppackerDefaultOptions(PspPackerOptions *options);
+
+// the most the packed input can take up, or 0 if it can't be an executable
+size_t psppackerPackBound(const void *input, size_t size);
+
+// pack 'input' into 'output' without touching the input. 'packedSize' gets
+// the packed size, and is still set when PSPPACKER_ERROR_BUFFER_TOO_SMALL is
+// returned. 'options' may be null for the defaults. safe to call from
+// several threads at once.
+int psppackerPack(const void *input, size_t size, void *output, size_t outsize, size_t *packedSize, const PspPackerOptions *options);
+
+const char *psppackerErrorString(int error);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+#endif // LIBPSPPACKER_H_
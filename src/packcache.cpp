@@ -0,0 +1,297 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#include "packcache.h"
+
+#include "packexec.h"
+#include "fileio.h"
+#include "crc32.h"
+#include "hash.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#include <io.h>
+#include <sys/utime.h>
+#else
+#include <dirent.h>
+#include <utime.h>
+#endif
+
+// bump when anything about the entries or the compressor output changes
+#define CACHE_VERSION   (2)
+#define CACHE_MAGIC     (0x434B5050)
+
+// how long a temp file is left alone in case another process is still
+// writing it. anything older was left behind by a crash.
+#define TEMP_GRACE_SECONDS  (60 * 60)
+
+namespace
+{
+    struct CacheEntryHeader
+    {
+        u32 magic;
+        u32 version;
+        u64 key;
+        GzipParams params;
+        u32 compSize;
+        
+        // of the payload, so a damaged entry is a miss rather than a bad module
+        u32 crc;
+        PSP_Header header;
+    };
+    
+    // everything besides the ELF that changes the packed module
+    struct CacheKeyFields
+    {
+        u32 version;
+        u32 type;
+        u32 searched;
+        u32 blocks;
+        u32 stripped;
+        GzipParams params;
+        
+        // a budget settles on its own level
+        double seconds;
+        double bytesPerSecond;
+        double ratio;
+    };
+    
+    struct CacheFile
+    {
+        std::string path;
+        unsigned long long size;
+        std::time_t used;
+    };
+    
+    // entries are only ever renamed into place under this name, anything
+    // else in the directory is a temp file on its way to becoming one
+    bool isEntry(const std::string& path)
+    {
+        const std::string suffix = ".psc";
+        return path.size() >= suffix.size() && path.compare(path.size() - suffix.size(), suffix.size(), suffix) == 0;
+    }
+    
+    void listFiles(const std::string& directory, std::vector<CacheFile>& files)
+    {
+#ifdef _WIN32
+        _finddata_t data;
+        auto handle = _findfirst((directory + "/*").c_str(), &data);
+        
+        if (handle == -1)
+        {
+            return;
+        }
+        
+        do
+        {
+            if ((data.attrib & _A_SUBDIR) == 0)
+            {
+                files.push_back({ directory + "/" + data.name, (unsigned long long)data.size, data.time_write });
+            }
+        } while (_findnext(handle, &data) == 0);
+        
+        _findclose(handle);
+#else
+        auto dir = opendir(directory.c_str());
+        
+        if (dir == nullptr)
+        {
+            return;
+        }
+        
+        while (auto entry = readdir(dir))
+        {
+            auto path = directory + "/" + entry->d_name;
+            struct stat st;
+            
+            if (lstat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode))
+            {
+                files.push_back({ path, (unsigned long long)st.st_size, st.st_mtime });
+            }
+        }
+        
+        closedir(dir);
+#endif
+    }
+}
+
+bool PackCache::open(const std::string& directory, unsigned long long limit)
+{
+    m_directory = directory;
+    m_limit = limit;
+    
+#ifdef _WIN32
+    _mkdir(directory.c_str());
+#else
+    mkdir(directory.c_str(), 0777);
+#endif
+    
+    struct stat st;
+    return stat(directory.c_str(), &st) == 0 && (st.st_mode & S_IFMT) == S_IFDIR;
+}
+
+std::string PackCache::entryPath(u64 key) const
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "/%016llx.psc", (unsigned long long)key);
+    return m_directory + name;
+}
+
+u64 PackCache::key(const PreparedExec& prepared, const char *elf, const PackOptions& options) const
+{
+    CacheKeyFields fields;
+    std::memset(&fields, 0, sizeof(fields));
+    
+    fields.version = CACHE_VERSION;
+    fields.type = prepared.type;
+    fields.searched = options.searchParams;
+    
+    // block output doesn't depend on the thread count, only on using blocks
+    fields.blocks = (options.compressThreads != 0);
+    fields.stripped = options.strip;
+    fields.seconds = options.budget.seconds;
+    fields.bytesPerSecond = options.budget.bytesPerSecond;
+    fields.ratio = options.budget.ratio;
+    
+    // a search settles on its own parameters
+    if (!options.searchParams)
+    {
+        fields.params = options.params;
+    }
+    
+    // the prepared header carries the tags and attributes
+    auto key = hash64(elf, prepared.size);
+    key = hash64(&prepared.header, sizeof(PSP_Header), key);
+    return hash64(&fields, sizeof(fields), key);
+}
+
+int PackCache::load(u64 key, PSP_Header& header, GzipParams& params, char *output, u32 outsize)
+{
+    auto path = entryPath(key);
+    auto file = std::fopen(path.c_str(), "rb");
+    
+    if (file == nullptr)
+    {
+        ++m_misses;
+        return -1;
+    }
+    
+    CacheEntryHeader entry;
+    auto ok = std::fread(&entry, sizeof(entry), 1, file) == 1
+        && entry.magic == CACHE_MAGIC 
+        && entry.version == CACHE_VERSION 
+        && entry.key == key 
+        && entry.compSize <= outsize
+        && std::fread(output, 1, entry.compSize, file) == entry.compSize
+        && crc32Update(0, output, entry.compSize) == entry.crc;
+    
+    std::fclose(file);
+    
+    if (!ok)
+    {
+        ++m_misses;
+        return -1;
+    }
+    
+    // the modification time is the last use as far as trim() is concerned
+#ifdef _WIN32
+    _utime(path.c_str(), nullptr);
+#else
+    utime(path.c_str(), nullptr);
+#endif
+    
+    std::memcpy(&header, &entry.header, sizeof(PSP_Header));
+    params = entry.params;
+    ++m_hits;
+    return entry.compSize;
+}
+
+bool PackCache::store(u64 key, const PSP_Header& header, const GzipParams& params, const char *data, u32 size)
+{
+    CacheEntryHeader entry;
+    std::memset(&entry, 0, sizeof(entry));
+    
+    entry.magic = CACHE_MAGIC;
+    entry.version = CACHE_VERSION;
+    entry.key = key;
+    entry.params = params;
+    entry.compSize = size;
+    entry.crc = crc32Update(0, data, size);
+    std::memcpy(&entry.header, &header, sizeof(PSP_Header));
+    
+    // racing writers of the same entry write the same bytes, last rename wins
+    if (!writeFileAtomic(entryPath(key), { { (const char *)&entry, sizeof(entry) }, { data, size } }))
+    {
+        return false;
+    }
+    
+    ++m_stores;
+    return true;
+}
+
+void PackCache::trim(void)
+{
+    std::vector<CacheFile> files;
+    listFiles(m_directory, files);
+    
+    auto now = std::time(nullptr);
+    
+    files.erase(std::remove_if(files.begin(), files.end(), [now](const CacheFile& file)
+    {
+        return !isEntry(file.path) && now - file.used < TEMP_GRACE_SECONDS;
+    }), files.end());
+    
+    unsigned long long total = 0;
+    
+    for (auto& file : files)
+    {
+        total += file.size;
+    }
+    
+    std::sort(files.begin(), files.end(), [](const CacheFile& a, const CacheFile& b)
+    {
+        return a.used < b.used;
+    });
+    
+    // another process may get to a file first, which is just as good
+    for (auto it = files.begin(); it != files.end() && total > m_limit; ++it)
+    {
+        if (std::remove(it->path.c_str()) == 0)
+        {
+            ++m_evictions;
+        }
+        
+        total -= it->size;
+    }
+}
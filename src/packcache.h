@@ -0,0 +1,77 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#ifndef PACKCACHE_H_
+#define PACKCACHE_H_
+
+#include "gzip.h"
+#include "psp.h"
+
+#include <atomic>
+#include <string>
+
+struct PackOptions;
+struct PreparedExec;
+
+// compressed modules on disk, keyed by a hash of everything that decides
+// what the compressor produces. entries are written to a temporary file and
+// renamed into place, so several processes can share a directory. the least
+// recently used entries are dropped by trim() once it grows past its limit.
+class PackCache
+{
+public:
+    PackCache() : m_limit(0), m_hits(0), m_misses(0), m_stores(0), m_evictions(0) {}
+    
+    // the directory is created if it doesn't exist
+    bool open(const std::string& directory, unsigned long long limit);
+    
+    u64 key(const PreparedExec& prepared, const char *elf, const PackOptions& options) const;
+    
+    // copy a cached module into 'output'. returns the compressed size or -1
+    // if there is no usable entry.
+    int load(u64 key, PSP_Header& header, GzipParams& params, char *output, u32 outsize);
+    
+    bool store(u64 key, const PSP_Header& header, const GzipParams& params, const char *data, u32 size);
+    
+    // evict the oldest entries until the cache fits its limit
+    void trim(void);
+    
+    unsigned int hits(void) const { return m_hits; }
+    unsigned int misses(void) const { return m_misses; }
+    unsigned int stores(void) const { return m_stores; }
+    unsigned int evictions(void) const { return m_evictions; }
+    
+private:
+    std::string entryPath(u64 key) const;
+    
+    std::string m_directory;
+    unsigned long long m_limit;
+    std::atomic<unsigned int> m_hits;
+    std::atomic<unsigned int> m_misses;
+    std::atomic<unsigned int> m_stores;
+    std::atomic<unsigned int> m_evictions;
+};
+
+#endif // PACKCACHE_H_
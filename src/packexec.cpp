@@ -28,10 +28,62 @@ DEALINGS IN THE SOFTWARE.
 #include "elf.h"
 #include "psp.h"
 #include "gzip.h"
+#include "parallelgzip.h"
+#include "threadpool.h"
+#include "paramsearch.h"
+#include "packcache.h"
+#include "elfstrip.h"
+#include "hash.h"
 
+#include <chrono>
+#include <climits>
+#include <memory>
+#include <new>
 #include <random>
 #include <cstring>
 
+const char *executable_type_name(ExecutableType type)
+{
+    switch (type)
+    {
+        default:
+        case EXECUTABLE_TYPE_USER_PRX:
+            return "user-prx";
+        case EXECUTABLE_TYPE_KERNEL_PRX:
+            return "kernel-prx";
+        case EXECUTABLE_TYPE_PBP:
+            return "pbp";
+    }
+}
+
+unsigned int default_psp_tag(ExecutableType type)
+{
+    switch (type)
+    {
+        default:
+        case EXECUTABLE_TYPE_USER_PRX:
+            return 0x457B06F0;
+        case EXECUTABLE_TYPE_KERNEL_PRX:
+            return 0xDADADAF0;
+        case EXECUTABLE_TYPE_PBP:
+            return 0xADF305F0;
+    }
+}
+
+unsigned int default_oe_tag(ExecutableType type)
+{
+    switch (type)
+    {
+        default:
+        case EXECUTABLE_TYPE_USER_PRX:
+            return 0x8555ABF2;
+        case EXECUTABLE_TYPE_KERNEL_PRX:
+            return 0x55668D96;
+        case EXECUTABLE_TYPE_PBP:
+            return 0x7316308C;
+    }
+}
+
 Elf32_Phdr *findModuleInfoHeader(Elf32_Ehdr *elf)
 {
 	auto phdr = (Elf32_Phdr *)((char *)elf + elf->e_phoff);
@@ -158,12 +210,76 @@ void setDecryptMode(PSP_Header *psp_header, bool isPbp)
     }
 }
 
-int pack_executable(ExecBuffer& executable, TagHandler psptagHandler, TagHandler oetagHandler)
+int compressExecutable(char *outbuffer, u32 outsize, const char *inbuffer, u32 insize, const GzipParams& params, unsigned int threads, ThreadPool *pool)
 {
-    auto fileMagic = ((unsigned int *)executable.data())[0];
-    auto execSize = (int)executable.size();
+    if (threads == 0)
+    {
+        auto ctx = gzipThreadContext();
+        return (ctx) ? (gzipCompressContext(ctx, outbuffer, outsize, inbuffer, insize, &params)) : (-1);
+    }
+    
+    return gzipCompressParallel(*pool, outbuffer, outsize, inbuffer, insize, &params);
+}
+
+int compressWithSearch(char *outbuffer, u32 outsize, const char *inbuffer, u32 insize, const std::string& module, const PackOptions& options, ThreadPool *pool, PackInfo& info)
+{
+    // reuse what an earlier build found for this module
+    if (options.paramsDb && options.paramsDb->find(module, info.params))
+    {
+        info.paramsReused = true;
+        return compressExecutable(outbuffer, outsize, inbuffer, insize, info.params, options.compressThreads, pool);
+    }
+    
+    ModuleBuffer best;
+    auto compress = [&](char *candidate, u32 candidateSize, const GzipParams& params)
+    {
+        return compressExecutable(candidate, candidateSize, inbuffer, insize, params, options.compressThreads, pool);
+    };
+    
+    auto size = searchGzipParams(*pool, outsize, compress, best, info.params);
+    
+    if (size < 0)
+    {
+        return size;
+    }
+    
+    info.paramsSearched = true;
+    std::memcpy(outbuffer, best.data(), size);
+    sharedBufferPool().give(best);
+    
+    if (options.paramsDb)
+    {
+        options.paramsDb->store(module, info.params);
+    }
+    
+    return size;
+}
+
+bool verifyCompression(const char *compressed, u32 compressedSize, const char *original, u32 originalSize)
+{
+    ModuleBuffer inflated;
+    sharedBufferPool().take(inflated, originalSize);
+    
+    auto ctx = gzipThreadContext();
+    auto size = (ctx) ? (gzipDecompressContext(ctx, inflated.data(), originalSize, compressed, compressedSize)) : (-1);
+    auto ok = (size == (int)originalSize && std::memcmp(inflated.data(), original, originalSize) == 0);
+    
+    sharedBufferPool().give(inflated);
+    return ok;
+}
+
+int prepare_executable(char *executable, size_t size, PreparedExec& prepared, TagHandler psptagHandler, TagHandler oetagHandler)
+{
+    // too small to hold anything we could pack
+    if (size < sizeof(Elf32_Ehdr))
+    {
+        return ERROR_NOT_PRX;
+    }
+    
+    auto fileMagic = ((unsigned int *)executable)[0];
+    auto execSize = size;
     auto execType = EXECUTABLE_TYPE_USER_PRX;
-    auto execOffset = 0;
+    auto execOffset = (size_t)0;
     
     // check if ~PSP packed
     if (fileMagic == PSP_HEADER_MAGIC)
@@ -173,13 +289,20 @@ int pack_executable(ExecBuffer& executable, TagHandler psptagHandler, TagHandler
     
     if (fileMagic == PBP_HEADER_MAGIC)
     {
-        auto pbp = (PbpHeader *)(executable.data());
+        auto pbp = (PbpHeader *)(executable);
+        
+        // the module has to fit between the header and the end of the file
+        if (pbp->prx_offset < sizeof(PbpHeader) || pbp->psar_offset < pbp->prx_offset + sizeof(Elf32_Ehdr) || pbp->psar_offset > size)
+        {
+            return ERROR_NOT_PRX;
+        }
+        
         execSize = pbp->psar_offset - pbp->prx_offset;
         execType = EXECUTABLE_TYPE_PBP;
         execOffset = pbp->prx_offset;
     }
     
-    auto elfHeader = (Elf32_Ehdr *)(executable.data()+execOffset);
+    auto elfHeader = (Elf32_Ehdr *)(executable+execOffset);
     
     if (elfHeader->e_magic != ELF_MAGIC || elfHeader->e_type != ELF_TYPE_PRX)
     {
@@ -194,7 +317,7 @@ int pack_executable(ExecBuffer& executable, TagHandler psptagHandler, TagHandler
     }
     
     auto isKernelModule = ((modinfoPhdr->p_paddr & 0x80000000) != 0);
-    auto modinfo = (SceModuleInfo *)(executable.data()+execOffset+(modinfoPhdr->p_paddr & 0x7FFFFFFF));
+    auto modinfo = (SceModuleInfo *)(executable+execOffset+(modinfoPhdr->p_paddr & 0x7FFFFFFF));
     
     // check for mixed privileges with kernel module
     if ((isKernelModule && (modinfo->modattribute & 0x1000) == 0) 
@@ -215,12 +338,9 @@ int pack_executable(ExecBuffer& executable, TagHandler psptagHandler, TagHandler
         execType = EXECUTABLE_TYPE_KERNEL_PRX;
     }
     
-    
-    // prepare for gzip compression
-    auto predictSize = gzipGetMaxCompressedSize(execSize);
-    ExecBuffer compressedExec(predictSize + sizeof(PSP_Header));
-    
-    auto psp_header = (PSP_Header *)(compressedExec.data());
+    // everything but the sizes and key data is known from the headers
+    auto psp_header = &prepared.header;
+    std::memset(psp_header, 0, sizeof(PSP_Header));
     
     psp_header->signature = PSP_HEADER_MAGIC;
     psp_header->attribute = modinfo->modattribute;
@@ -262,50 +382,430 @@ int pack_executable(ExecBuffer& executable, TagHandler psptagHandler, TagHandler
     psp_header->tag = psptagHandler(execType);
     psp_header->oe_tag = oetagHandler(execType);
     
-    // compress executable
-    auto compExecSize = gzipCompress(compressedExec.data()+sizeof(PSP_Header), predictSize, executable.data()+execOffset, execSize);
+    prepared.type = execType;
+    prepared.offset = execOffset;
+    prepared.size = execSize;
+    return NO_ERROR;
+}
+
+// splitmix64, plenty for filler that only has to look random
+u8 nextKeyByte(u64& state, u64& bits, int& left)
+{
+    if (left == 0)
+    {
+        state += 0x9E3779B97F4A7C15ull;
+        bits = state;
+        bits = (bits ^ (bits >> 30)) * 0xBF58476D1CE4E5B9ull;
+        bits = (bits ^ (bits >> 27)) * 0x94D049BB133111EBull;
+        bits ^= bits >> 31;
+        left = 8;
+    }
     
-    if (compExecSize < 0)
+    auto byte = (u8)bits;
+    bits >>= 8;
+    --left;
+    return byte;
+}
+
+u64 key_data_seed(const PreparedExec& prepared, const char *elf, size_t size, const PackOptions& options)
+{
+    if (!options.reproducible)
     {
-        return ERROR_GZIP_COMPRESSION;
+        std::random_device rd;
+        return ((u64)rd() << 32) ^ rd();
     }
     
-    // resize the container
-    compressedExec.resize(compExecSize+sizeof(PSP_Header));
+    if (options.seed != 0)
+    {
+        return options.seed;
+    }
     
-    // update psp header
-    psp_header->comp_size = compExecSize;
-    psp_header->psp_size = compExecSize + sizeof(PSP_Header);
+    // the header carries the tags, module name and sizes
+    return hash64(elf, size, hash64(&prepared.header, sizeof(PSP_Header)));
+}
+
+void finish_psp_header(PSP_Header& header, u32 compressedSize, u64 seed)
+{
+    header.comp_size = compressedSize;
+    header.psp_size = compressedSize + sizeof(PSP_Header);
     
     // fill key data with random data
-    std::random_device rd;
+    u64 bits = 0;
+    int left = 0;
     
     for (int i = 0; i < 0x30; ++i)
     {
-        psp_header->key_data0[i] = rd();
+        header.key_data0[i] = nextKeyByte(seed, bits, left);
     }
     
     for (int i = 0; i < 0x10; ++i)
     {
-        psp_header->key_data1[i] = rd();
+        header.key_data1[i] = nextKeyByte(seed, bits, left);
     }
     
     for (int i = 0; i < 0x1C; ++i)
     {
-        psp_header->key_data3[i] = rd();
+        header.key_data3[i] = nextKeyByte(seed, bits, left);
     }
+}
+
+void assemble_executable(const char *executable, size_t size, const PreparedExec& prepared, PackedExec& output)
+{
+    TraceSpan span("assemble", "phase");
+    auto execOffset = prepared.offset;
+    auto execSize = prepared.size;
     
-    // if PBP we need to insert the PBP header/icons etc
-    if (execType == EXECUTABLE_TYPE_PBP)
+    output.segments.clear();
+    
+    // PBP layout: header, SFO/ICON/PIC/SND, packed module, PSAR. only the
+    // header changes, everything else is written straight from the input.
+    if (prepared.type == EXECUTABLE_TYPE_PBP)
     {
-        compressedExec.insert(compressedExec.end(), executable.begin()+execOffset+execSize, executable.end());
-        compressedExec.insert(compressedExec.begin(), executable.begin(), executable.begin()+execOffset);
+        output.header.assign(executable, executable+sizeof(PbpHeader));
         
         // set the psar offset
-        auto pbp = (PbpHeader *)(compressedExec.data());
-        pbp->psar_offset = execOffset+compExecSize;
+        auto pbp = (PbpHeader *)(output.header.data());
+        pbp->psar_offset = execOffset+output.module.size();
+        
+        output.segments.push_back({ output.header.data(), output.header.size() });
+        output.segments.push_back({ executable+sizeof(PbpHeader), execOffset-sizeof(PbpHeader) });
+    }
+    
+    output.segments.push_back({ output.module.data(), output.module.size() });
+    
+    if (prepared.type == EXECUTABLE_TYPE_PBP)
+    {
+        output.segments.push_back({ executable+execOffset+execSize, size-execOffset-execSize });
+    }
+}
+
+// prepare_executable and stripping, filling in what 'info' says about the
+// module. 'elf' is left pointing at what gets compressed, which is in the
+// input unless stripped.
+int prepare_module(char *executable, size_t size, PreparedExec& prepared, const char *&elf, u32& elfSize, ExecBuffer& stripped, TagHandler psptagHandler, TagHandler oetagHandler, const PackOptions& options, PackInfo& info)
+{
+    auto res = prepare_executable(executable, size, prepared, psptagHandler, oetagHandler);
+    
+    if (res != NO_ERROR)
+    {
+        return res;
+    }
+    
+    elf = executable+prepared.offset;
+    elfSize = prepared.size;
+    
+    if (options.strip && !strip_prepared_elf(prepared, elf, elfSize, stripped))
+    {
+        return ERROR_NOT_PRX;
+    }
+    
+    info.type = prepared.type;
+    info.elfSize = elfSize;
+    info.strippedSize = prepared.size - elfSize;
+    info.decryptMode = prepared.header.decrypt_mode;
+    info.tag = prepared.header.tag;
+    info.oeTag = prepared.header.oe_tag;
+    return NO_ERROR;
+}
+
+int pack_executable(char *executable, size_t size, PackedExec& output, TagHandler psptagHandler, TagHandler oetagHandler, const PackOptions& options, PackInfo *info)
+{
+    PackInfo localInfo;
+    
+    if (info == nullptr)
+    {
+        info = &localInfo;
+    }
+    
+    PhaseTimer prepareTimer(info->times, PHASE_PREPARE);
+    PreparedExec prepared;
+    const char *elf;
+    u32 elfSize;
+    ExecBuffer stripped;
+    auto res = prepare_module(executable, size, prepared, elf, elfSize, stripped, psptagHandler, oetagHandler, options, *info);
+    
+    if (res != NO_ERROR)
+    {
+        return res;
     }
     
-    executable.swap(compressedExec);
+    auto execOffset = prepared.offset;
+    
+    // prepare for gzip compression
+    auto predictSize = gzipGetMaxCompressedSize(elfSize);
+    ModuleBuffer& compressedExec = output.module;
+    sharedBufferPool().take(compressedExec, predictSize + sizeof(PSP_Header));
+    
+    // the compressor fills everything after the header
+    auto psp_header = (PSP_Header *)(compressedExec.data());
+    std::memcpy(psp_header, &prepared.header, sizeof(PSP_Header));
+    
+    prepareTimer.stop();
+    
+    // an earlier run may already have compressed exactly this
+    PhaseTimer compressTimer(info->times, PHASE_COMPRESS);
+    auto cache = options.cache;
+    u64 cacheKey = 0;
+    int compExecSize = -1;
+    info->params = options.params;
+    
+    if (cache != nullptr)
+    {
+        cacheKey = cache->key(prepared, executable+execOffset, options);
+        compExecSize = cache->load(cacheKey, *psp_header, info->params, compressedExec.data()+sizeof(PSP_Header), predictSize);
+        info->cacheHit = (compExecSize >= 0);
+    }
+    
+    if (!info->cacheHit)
+    {
+        // blocks and parameter searches need somewhere to run
+        std::unique_ptr<ThreadPool> localPool;
+        auto pool = options.pool;
+        
+        if (pool == nullptr && (options.compressThreads != 0 || options.searchParams))
+        {
+            localPool.reset(new ThreadPool(options.compressThreads));
+            pool = localPool.get();
+        }
+        
+        // compress executable
+        if (options.searchParams)
+        {
+            compExecSize = compressWithSearch(compressedExec.data()+sizeof(PSP_Header), predictSize, elf, elfSize, psp_header->modname, options, pool, *info);
+        }
+        else
+        {
+            if (options.budget.active())
+            {
+                info->levelChosen = chooseGzipLevel(elf, elfSize, options.params, options.budget, options.compressThreads, info->estimate);
+                
+                if (info->levelChosen)
+                {
+                    info->params.level = info->estimate.level;
+                }
+            }
+            
+            auto start = std::chrono::steady_clock::now();
+            compExecSize = compressExecutable(compressedExec.data()+sizeof(PSP_Header), predictSize, elf, elfSize, info->params, options.compressThreads, pool);
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            info->compressSeconds = elapsed.count();
+        }
+        
+        if (compExecSize < 0)
+        {
+            return ERROR_GZIP_COMPRESSION;
+        }
+    }
+    
+    compressTimer.stop();
+    info->compressedSize = compExecSize;
+    
+    PhaseTimer verifyTimer(info->times, PHASE_VERIFY);
+    
+    if (options.verify && !verifyCompression(compressedExec.data()+sizeof(PSP_Header), compExecSize, elf, elfSize))
+    {
+        return ERROR_GZIP_VERIFICATION;
+    }
+    
+    verifyTimer.stop();
+    
+    if (cache != nullptr && !info->cacheHit)
+    {
+        cache->store(cacheKey, *psp_header, info->params, compressedExec.data()+sizeof(PSP_Header), compExecSize);
+    }
+    
+    // resize the container
+    compressedExec.resize(compExecSize+sizeof(PSP_Header));
+    
+    // update psp header
+    finish_psp_header(*psp_header, compExecSize, key_data_seed(prepared, elf, elfSize, options));
+    
+    assemble_executable(executable, size, prepared, output);
+    return NO_ERROR;
+}
+
+int pack_executable(ExecBuffer& executable, TagHandler psptagHandler, TagHandler oetagHandler, const PackOptions& options, PackInfo *info)
+{
+    PackedExec packed;
+    auto res = pack_executable(executable.data(), executable.size(), packed, psptagHandler, oetagHandler, options, info);
+    
+    if (res != NO_ERROR)
+    {
+        return res;
+    }
+    
+    // flatten before swapping, the segments point into the input
+    ExecBuffer flat;
+    flat.reserve(packed.size());
+    
+    for (auto& segment : packed.segments)
+    {
+        flat.insert(flat.end(), segment.data, segment.data+segment.size);
+    }
+    
+    executable.swap(flat);
+    return NO_ERROR;
+}
+
+// where the ELF is, which is the whole input unless it is a sane PBP
+void findModule(const char *executable, size_t size, size_t& start, size_t& end)
+{
+    auto pbp = (const PbpHeader *)executable;
+    start = 0;
+    end = size;
+    
+    if (size >= sizeof(PbpHeader) && pbp->magic == PBP_HEADER_MAGIC && pbp->prx_offset >= sizeof(PbpHeader) && pbp->prx_offset <= pbp->psar_offset && pbp->psar_offset <= size)
+    {
+        start = pbp->prx_offset;
+        end = pbp->psar_offset;
+    }
+}
+
+size_t pack_executable_bound(const char *executable, size_t size)
+{
+    size_t start, end;
+    
+    if (size < sizeof(Elf32_Ehdr))
+    {
+        return 0;
+    }
+    
+    findModule(executable, size, start, end);
+    
+    if (end - start > INT_MAX / 2)
+    {
+        return 0;
+    }
+    
+    // everything but the ELF is copied through, plus the ~PSP header
+    return size - (end - start) + sizeof(PSP_Header) + gzipGetMaxCompressedSize((int)(end - start));
+}
+
+int pack_executable_buffer(const char *executable, size_t size, char *output, size_t outsize, size_t& packedSize, TagHandler psptagHandler, TagHandler oetagHandler, const PackOptions& options, PackInfo *info)
+{
+    packedSize = 0;
+    
+    try
+    {
+        // packing patches the module info, so it works on a copy of
+        // everything up to the end of the ELF. a PSAR goes straight across.
+        size_t start, end;
+        findModule(executable, size, start, end);
+        
+        ModuleBuffer input(executable, executable+end);
+        PackedExec packed;
+        
+        auto res = pack_executable(input.data(), input.size(), packed, psptagHandler, oetagHandler, options, info);
+        
+        if (res != NO_ERROR)
+        {
+            return res;
+        }
+        
+        packedSize = packed.size() + (size - end);
+        
+        if (packedSize > outsize)
+        {
+            return ERROR_BUFFER_TOO_SMALL;
+        }
+        
+        for (auto& segment : packed.segments)
+        {
+            std::memcpy(output, segment.data, segment.size);
+            output += segment.size;
+        }
+        
+        std::memcpy(output, executable+end, size-end);
+        return NO_ERROR;
+    }
+    catch (const std::bad_alloc&)
+    {
+        return ERROR_OUT_OF_MEMORY;
+    }
+    catch (...)
+    {
+        return ERROR_INTERNAL;
+    }
+}
+
+int estimate_executable(char *executable, size_t size, SizeEstimate& estimate, TagHandler psptagHandler, TagHandler oetagHandler, const PackOptions& options, PackInfo *info)
+{
+    PackInfo localInfo;
+    
+    if (info == nullptr)
+    {
+        info = &localInfo;
+    }
+    
+    PhaseTimer prepareTimer(info->times, PHASE_PREPARE);
+    PreparedExec prepared;
+    const char *elf;
+    u32 elfSize;
+    ExecBuffer stripped;
+    auto res = prepare_module(executable, size, prepared, elf, elfSize, stripped, psptagHandler, oetagHandler, options, *info);
+    
+    if (res != NO_ERROR)
+    {
+        return res;
+    }
+    
+    prepareTimer.stop();
+    
+    PhaseTimer compressTimer(info->times, PHASE_COMPRESS);
+    SizeEstimate compressed;
+    info->params = options.params;
+    
+    // a cached module is the real thing
+    if (options.cache != nullptr)
+    {
+        ModuleBuffer cached;
+        sharedBufferPool().take(cached, gzipGetMaxCompressedSize(elfSize));
+        
+        PSP_Header header = prepared.header;
+        auto cacheKey = options.cache->key(prepared, executable+prepared.offset, options);
+        auto cachedSize = options.cache->load(cacheKey, header, info->params, cached.data(), (u32)cached.size());
+        sharedBufferPool().give(cached);
+        
+        if (cachedSize >= 0)
+        {
+            info->cacheHit = true;
+            compressed.size = compressed.low = compressed.high = cachedSize;
+            compressed.exact = true;
+        }
+    }
+    
+    if (!info->cacheHit)
+    {
+        // a search can only do better than the parameters it would start
+        // from, so without a recorded winner this is an upper bound
+        if (options.searchParams && options.paramsDb && options.paramsDb->find(prepared.header.modname, info->params))
+        {
+            info->paramsReused = true;
+        }
+        
+        if (options.budget.active())
+        {
+            info->levelChosen = chooseGzipLevel(elf, elfSize, options.params, options.budget, options.compressThreads, info->estimate);
+            
+            if (info->levelChosen)
+            {
+                info->params.level = info->estimate.level;
+            }
+        }
+        
+        if (!estimateCompressedSize(elf, elfSize, info->params, options.compressThreads, compressed))
+        {
+            return ERROR_GZIP_COMPRESSION;
+        }
+    }
+    
+    info->compressedSize = (size_t)(compressed.size + 0.5);
+    
+    // everything around the module is copied as it is
+    auto rest = (double)(size - prepared.size + sizeof(PSP_Header));
+    estimate.size = compressed.size + rest;
+    estimate.low = compressed.low + rest;
+    estimate.high = compressed.high + rest;
+    estimate.exact = compressed.exact;
     return NO_ERROR;
 }
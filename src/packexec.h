@@ -26,9 +26,17 @@ DEALINGS IN THE SOFTWARE.
 #ifndef PACKEXEC_H_
 #define PACKEXEC_H_
 
+#include <cstddef>
 #include <functional>
 #include <vector>
 
+#include "gzip.h"
+#include "psp.h"
+#include "buffer.h"
+#include "bufferpool.h"
+#include "packstats.h"
+#include "paramsearch.h"
+
 enum ExecutableType
 {
     EXECUTABLE_TYPE_USER_PRX,
@@ -46,12 +54,203 @@ enum ErrorTypes
     ERROR_KERNEL_PBP,
     ERROR_NO_SEGMENTS,
     ERROR_NO_BSS_SECTION,
-    ERROR_GZIP_COMPRESSION
+    ERROR_GZIP_COMPRESSION,
+    ERROR_GZIP_VERIFICATION,
+    ERROR_STREAM_READ,
+    ERROR_STREAM_WRITE,
+    ERROR_BUFFER_TOO_SMALL,
+    ERROR_OUT_OF_MEMORY,
+    ERROR_INTERNAL,
+    ERROR_NOT_PACKED,
+    ERROR_CORRUPT_PACKED,
+    ERROR_UNSUPPORTED_COMPRESSION,
+    ERROR_BAD_IMAGE
 };
 
 using ExecBuffer = std::vector<char>;
+
+// bytes owned by someone else
+struct ExecView
+{
+    const char *data;
+    size_t size;
+};
+
+// a packed executable as the segments to write out, in order. segments can
+// point into the input, which has to outlive them. the module buffer goes
+// back to the shared pool afterwards.
+struct PackedExec
+{
+    PackedExec() = default;
+    PackedExec(PackedExec&&) = default;
+    PackedExec& operator=(PackedExec&&) = default;
+    
+    ~PackedExec()
+    {
+        sharedBufferPool().give(module);
+    }
+    
+    // patched copy of the PBP header, empty for PRXs
+    ExecBuffer header;
+    
+    // ~PSP header and compressed ELF
+    ModuleBuffer module;
+    
+    std::vector<ExecView> segments;
+    
+    size_t size(void) const
+    {
+        size_t total = 0;
+        
+        for (auto& segment : segments)
+        {
+            total += segment.size;
+        }
+        
+        return total;
+    }
+};
 using TagHandler = std::function<unsigned int(ExecutableType type)>;
 
-int pack_executable(ExecBuffer& executable, TagHandler psptagHandler, TagHandler oetagHandler);
+// "user-prx", "kernel-prx" or "pbp"
+const char *executable_type_name(ExecutableType type);
+
+// the tags psp-packer uses when none are given
+unsigned int default_psp_tag(ExecutableType type);
+unsigned int default_oe_tag(ExecutableType type);
+
+class ThreadPool;
+class ParamsDatabase;
+class PackCache;
+
+struct PackOptions
+{
+    PackOptions() : compressThreads(0), pool(nullptr), verify(false), searchParams(false), paramsDb(nullptr), cache(nullptr), strip(false), reproducible(false), seed(0)
+    {
+        gzipDefaultParams(&params);
+    }
+    
+    // number of threads to compress on. 0 compresses as one deflate stream,
+    // anything else uses independent blocks.
+    unsigned int compressThreads;
+    
+    // pool to run compression blocks on, or null to make one per call
+    ThreadPool *pool;
+    
+    // inflate the packed module again and compare it against the input
+    bool verify;
+    
+    // deflate parameters, unless searching
+    GzipParams params;
+    
+    // try a grid of deflate parameters and keep the smallest result
+    bool searchParams;
+    
+    // where searched parameters are looked up and recorded, may be null
+    ParamsDatabase *paramsDb;
+    
+    // compressed modules from earlier runs, may be null
+    PackCache *cache;
+    
+    // leave out the parts of the ELF the loader never reads, see strip_elf
+    bool strip;
+    
+    // generate the key data from a seed instead of the system's random
+    // source, so the same input and options always pack to the same bytes
+    bool reproducible;
+    
+    // the seed when reproducible, 0 derives it from the module
+    u64 seed;
+    
+    // pick params.level by sampling the module against a budget, see
+    // chooseGzipLevel
+    LevelBudget budget;
+};
+
+// what pack_executable decided on the way
+struct PackInfo
+{
+    PackInfo() : paramsSearched(false), paramsReused(false), cacheHit(false), levelChosen(false), compressSeconds(0), type(EXECUTABLE_TYPE_USER_PRX), elfSize(0), strippedSize(0), compressedSize(0), decryptMode(0), tag(0), oeTag(0), times(nullptr)
+    {
+        gzipDefaultParams(&params);
+    }
+    
+    // deflate parameters the module was packed with
+    GzipParams params;
+    bool paramsSearched;
+    bool paramsReused;
+    bool cacheHit;
+    
+    // what the level was picked on when there was a budget, and how long
+    // compressing then actually took
+    bool levelChosen;
+    LevelEstimate estimate;
+    double compressSeconds;
+    
+    ExecutableType type;
+    
+    // of the ELF that was compressed, after stripping 'strippedSize' bytes
+    size_t elfSize;
+    size_t strippedSize;
+    
+    size_t compressedSize;
+    unsigned int decryptMode;
+    unsigned int tag;
+    unsigned int oeTag;
+    
+    // where to add the time spent in each phase, null to not time anything
+    PhaseTimes *times;
+};
+
+// an executable that has been checked and is ready to compress
+struct PreparedExec
+{
+    ExecutableType type;
+    
+    // where the ELF is in the input
+    size_t offset;
+    size_t size;
+    
+    // everything but the sizes and key data
+    PSP_Header header;
+};
+
+// check the executable and fill in its ~PSP header, patching the module info
+// in place. nothing past the ELF is looked at, so for a PBP the input only
+// needs to run up to the PSAR.
+int prepare_executable(char *executable, size_t size, PreparedExec& prepared, TagHandler psptagHandler, TagHandler oetagHandler);
+
+// what the key data is generated from, see PackOptions::reproducible. 'elf'
+// is the module that gets compressed.
+u64 key_data_seed(const PreparedExec& prepared, const char *elf, size_t size, const PackOptions& options);
+
+// fill in the sizes and key data once the compressed size is known
+void finish_psp_header(PSP_Header& header, u32 compressedSize, u64 seed);
+
+// lay out the packed executable around output.module, which has to hold the
+// finished ~PSP header and compressed ELF
+void assemble_executable(const char *executable, size_t size, const PreparedExec& prepared, PackedExec& output);
+
+// pack the executable in place. the input is modified and must be writable,
+// but only the module info is touched, so a copy-on-write mapping is enough.
+int pack_executable(char *executable, size_t size, PackedExec& output, TagHandler psptagHandler, TagHandler oetagHandler, const PackOptions& options = PackOptions(), PackInfo *info = nullptr);
+
+// as above, replacing the buffer with the packed executable
+int pack_executable(ExecBuffer& executable, TagHandler psptagHandler, TagHandler oetagHandler, const PackOptions& options = PackOptions(), PackInfo *info = nullptr);
+
+// the most a packed 'executable' can take up, or 0 if it is too small to be
+// one. the exact size is only known once it is compressed.
+size_t pack_executable_bound(const char *executable, size_t size);
+
+// pack a read-only input into the caller's buffer. if the buffer is too small
+// ERROR_BUFFER_TOO_SMALL is returned with the exact size in 'packedSize'.
+// never throws, and is safe to call from several threads at once as long as
+// the tag handlers are.
+int pack_executable_buffer(const char *executable, size_t size, char *output, size_t outsize, size_t& packedSize, TagHandler psptagHandler = default_psp_tag, TagHandler oetagHandler = default_oe_tag, const PackOptions& options = PackOptions(), PackInfo *info = nullptr);
+
+// check the executable as pack_executable does and predict its packed size
+// from a sample of the module instead of compressing all of it. the input is
+// modified the same way.
+int estimate_executable(char *executable, size_t size, SizeEstimate& estimate, TagHandler psptagHandler, TagHandler oetagHandler, const PackOptions& options = PackOptions(), PackInfo *info = nullptr);
 
 #endif // PACKEXEC_H_
@@ -0,0 +1,855 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#include "packserver.h"
+#include "fileio.h"
+#include "packcache.h"
+#include "threadpool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#define SERVE_MAGIC     (0x56525350)
+#define SERVE_VERSION   (4)
+
+// the most a request or response can carry. packed output is never much
+// bigger than the input, and a file packed by path sends nothing back.
+#define SERVE_MAX_PATH      (4096)
+#define SERVE_MAX_MESSAGE   (4096)
+#define SERVE_MAX_DATA      (SERVE_MAX_INLINE + (1 << 20))
+
+// how often threads blocked on a socket or the queue check for a shutdown
+#define SERVE_POLL_MS       (250)
+
+// how often an idle server trims the cache
+#define SERVE_TRIM_SECONDS  (60)
+
+namespace
+{
+    enum ServeCommand
+    {
+        SERVE_PACK,
+        SERVE_SHUTDOWN
+    };
+    
+    enum RequestFlags
+    {
+        REQUEST_TAGS = 1,
+        REQUEST_VERIFY = 2,
+        REQUEST_SEARCH = 4,
+        REQUEST_STRIP = 8,
+        REQUEST_REPRODUCIBLE = 16
+    };
+    
+    enum ResponseFlags
+    {
+        RESPONSE_PARAMS_SEARCHED = 1,
+        RESPONSE_PARAMS_REUSED = 2,
+        RESPONSE_CACHE_HIT = 4,
+        RESPONSE_LEVEL_CHOSEN = 8
+    };
+    
+    // both ends are the same build on the same machine, so headers go over
+    // the socket as they are laid out in memory. the path and the inline
+    // executable follow.
+    struct RequestHeader
+    {
+        u32 magic;
+        u32 version;
+        u32 command;
+        u32 flags;
+        u32 pspTag;
+        u32 oeTag;
+        u32 compressThreads;
+        GzipParams params;
+        u64 seed;
+        LevelBudget budget;
+        u32 pathSize;
+        u64 dataSize;
+    };
+    
+    // followed by the message and the packed executable
+    struct ResponseHeader
+    {
+        u32 magic;
+        u32 version;
+        int error;
+        u32 flags;
+        u32 messageSize;
+        u32 type;
+        u32 decryptMode;
+        u32 tag;
+        u32 oeTag;
+        GzipParams params;
+        u64 elfSize;
+        u64 strippedSize;
+        LevelEstimate estimate;
+        double compressSeconds;
+        u64 compressedSize;
+        u64 packedSize;
+        u64 dataSize;
+        double wall[PHASE_COUNT];
+        double cpu[PHASE_COUNT];
+    };
+}
+
+#ifndef _WIN32
+namespace
+{
+#ifdef MSG_NOSIGNAL
+    const int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+    const int SEND_FLAGS = 0;
+#endif
+    
+    volatile sig_atomic_t g_interrupted = 0;
+    
+    void onInterrupt(int)
+    {
+        g_interrupted = 1;
+    }
+    
+    bool readFull(int fd, void *data, size_t size)
+    {
+        auto out = (char *)data;
+        
+        while (size > 0)
+        {
+            auto res = recv(fd, out, size, 0);
+            
+            if (res < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            
+            if (res <= 0)
+            {
+                return false;
+            }
+            
+            out += res;
+            size -= res;
+        }
+        
+        return true;
+    }
+    
+    bool writeFull(int fd, const void *data, size_t size)
+    {
+        auto in = (const char *)data;
+        
+        while (size > 0)
+        {
+            auto res = send(fd, in, size, SEND_FLAGS);
+            
+            if (res < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            
+            if (res <= 0)
+            {
+                return false;
+            }
+            
+            in += res;
+            size -= res;
+        }
+        
+        return true;
+    }
+    
+    void setCloseOnExec(int fd)
+    {
+        fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) | FD_CLOEXEC);
+    }
+    
+    bool socketAddress(const std::string& path, sockaddr_un& address)
+    {
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        
+        if (path.empty() || path.size() >= sizeof(address.sun_path))
+        {
+            return false;
+        }
+        
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        return true;
+    }
+    
+    int connectSocket(const std::string& path)
+    {
+        sockaddr_un address;
+        
+        if (!socketAddress(path, address))
+        {
+            return -1;
+        }
+        
+        auto fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        
+        if (fd < 0)
+        {
+            return -1;
+        }
+        
+        setCloseOnExec(fd);
+        
+        if (connect(fd, (sockaddr *)&address, sizeof(address)) != 0)
+        {
+            ::close(fd);
+            return -1;
+        }
+        
+        return fd;
+    }
+    
+    // whether the other end of a connection runs as this user. either end
+    // could otherwise be someone else's: a server told which files to
+    // overwrite, or a client handed back what it asked to have packed.
+    bool peerIsUser(int fd)
+    {
+#ifdef SO_PEERCRED
+        ucred credentials;
+        socklen_t size = sizeof(credentials);
+        return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &size) == 0 && credentials.uid == geteuid();
+#else
+        uid_t uid;
+        gid_t gid;
+        return getpeereid(fd, &uid, &gid) == 0 && uid == geteuid();
+#endif
+    }
+    
+    // where the default socket goes without $XDG_RUNTIME_DIR
+    std::string privateDirectory(void)
+    {
+        return "/tmp/psp-packer-" + std::to_string(geteuid());
+    }
+    
+    // make a directory only this user can get into, or check one from an
+    // earlier server still is. /tmp is shared, so anyone could have made it.
+    bool makePrivateDirectory(const std::string& path)
+    {
+        if (mkdir(path.c_str(), S_IRWXU) != 0 && errno != EEXIST)
+        {
+            return false;
+        }
+        
+        struct stat status;
+        return lstat(path.c_str(), &status) == 0 && S_ISDIR(status.st_mode) && status.st_uid == geteuid() && (status.st_mode & (S_IRWXG | S_IRWXO)) == 0;
+    }
+    
+    // accepted connections waiting for a worker
+    class ConnectionQueue
+    {
+    public:
+        explicit ConnectionQueue(size_t capacity) : m_capacity(capacity), m_stop(false) {}
+        
+        // false if there was no room within 'ms'
+        bool push(int fd, unsigned int ms)
+        {
+            std::unique_lock<std::mutex> lock(m_lock);
+            
+            if (!m_notFull.wait_for(lock, std::chrono::milliseconds(ms), [this]() { return m_fds.size() < m_capacity; }))
+            {
+                return false;
+            }
+            
+            m_fds.push_back(fd);
+            m_notEmpty.notify_one();
+            return true;
+        }
+        
+        // the next connection, or -1 once stopped and empty
+        int pop(void)
+        {
+            std::unique_lock<std::mutex> lock(m_lock);
+            m_notEmpty.wait(lock, [this]() { return m_stop || !m_fds.empty(); });
+            
+            if (m_fds.empty())
+            {
+                return -1;
+            }
+            
+            auto fd = m_fds.front();
+            m_fds.pop_front();
+            m_notFull.notify_one();
+            return fd;
+        }
+        
+        void stop(void)
+        {
+            std::lock_guard<std::mutex> guard(m_lock);
+            m_stop = true;
+            m_notEmpty.notify_all();
+        }
+        
+    private:
+        std::mutex m_lock;
+        std::condition_variable m_notFull;
+        std::condition_variable m_notEmpty;
+        std::deque<int> m_fds;
+        size_t m_capacity;
+        bool m_stop;
+    };
+    
+    struct Server
+    {
+        Server(const ServerOptions& options, unsigned int workers, size_t queueSize) : options(options), pool(workers), queue(queueSize), stopping(false) {}
+        
+        bool shouldStop(void) const { return stopping || g_interrupted; }
+        
+        const ServerOptions& options;
+        
+        // runs the blocks of jobs that compress in parallel
+        ThreadPool pool;
+        
+        ConnectionQueue queue;
+        std::atomic<bool> stopping;
+    };
+    
+    int packRequest(Server& server, const RequestHeader& request, const std::string& path, ExecBuffer& data, PackedExec& packed, PackInfo& info, std::string& message)
+    {
+        PackOptions options;
+        options.compressThreads = request.compressThreads;
+        options.pool = &server.pool;
+        options.verify = (request.flags & REQUEST_VERIFY) != 0;
+        options.params = request.params;
+        options.searchParams = (request.flags & REQUEST_SEARCH) != 0;
+        options.paramsDb = server.options.paramsDb;
+        options.cache = server.options.cache;
+        options.strip = (request.flags & REQUEST_STRIP) != 0;
+        options.reproducible = (request.flags & REQUEST_REPRODUCIBLE) != 0;
+        options.seed = request.seed;
+        options.budget = request.budget;
+        
+        TagHandler pspTagHandler = default_psp_tag;
+        TagHandler oeTagHandler = default_oe_tag;
+        
+        if (request.flags & REQUEST_TAGS)
+        {
+            auto psptag = request.pspTag;
+            auto oetag = request.oeTag;
+            
+            pspTagHandler = [=](ExecutableType) -> unsigned int { return psptag; };
+            oeTagHandler = [=](ExecutableType) -> unsigned int { return oetag; };
+        }
+        
+        if (path.empty())
+        {
+            return pack_executable(data.data(), data.size(), packed, pspTagHandler, oeTagHandler, options, &info);
+        }
+        
+        MappedFile file;
+        PhaseTimer readTimer(info.times, PHASE_READ);
+        
+        if (!file.open(path))
+        {
+            message = "could not open file: \"" + path + "\".";
+            return ERROR_STREAM_READ;
+        }
+        
+        readTimer.stop();
+        
+        auto res = pack_executable(file.data(), file.size(), packed, pspTagHandler, oeTagHandler, options, &info);
+        
+        if (res != NO_ERROR)
+        {
+            return res;
+        }
+        
+        PhaseTimer writeTimer(info.times, PHASE_WRITE);
+        
+        if (!writeFileAtomic(path, packed.segments, &file))
+        {
+            message = "could not write file: \"" + path + "\".";
+            return ERROR_STREAM_WRITE;
+        }
+        
+        return NO_ERROR;
+    }
+    
+    // run one job and send back the result. false if the connection broke.
+    bool serveRequest(Server& server, int fd, const RequestHeader& request, const std::string& path, ExecBuffer& data)
+    {
+        PackedExec packed;
+        PackInfo info;
+        PhaseTimes times;
+        std::string message;
+        int res;
+        
+        info.times = &times;
+        
+        try
+        {
+            res = packRequest(server, request, path, data, packed, info, message);
+        }
+        catch (const std::bad_alloc&)
+        {
+            res = ERROR_OUT_OF_MEMORY;
+        }
+        catch (...)
+        {
+            res = ERROR_INTERNAL;
+        }
+        
+        if (res != NO_ERROR && message.empty())
+        {
+            char text[256];
+            std::snprintf(text, sizeof(text), "Error 0x%08X packing executable %s.", res, (path.empty()) ? ("from the client") : (path.c_str()));
+            message = text;
+        }
+        
+        ResponseHeader response{};
+        response.magic = SERVE_MAGIC;
+        response.version = SERVE_VERSION;
+        response.error = res;
+        response.flags = ((info.paramsSearched) ? (RESPONSE_PARAMS_SEARCHED) : (0)) | ((info.paramsReused) ? (RESPONSE_PARAMS_REUSED) : (0)) | ((info.cacheHit) ? (RESPONSE_CACHE_HIT) : (0)) | ((info.levelChosen) ? (RESPONSE_LEVEL_CHOSEN) : (0));
+        response.messageSize = (u32)std::min<size_t>(message.size(), SERVE_MAX_MESSAGE);
+        response.type = info.type;
+        response.decryptMode = info.decryptMode;
+        response.tag = info.tag;
+        response.oeTag = info.oeTag;
+        response.params = info.params;
+        response.elfSize = info.elfSize;
+        response.strippedSize = info.strippedSize;
+        response.estimate = info.estimate;
+        response.compressSeconds = info.compressSeconds;
+        response.compressedSize = info.compressedSize;
+        response.packedSize = (res == NO_ERROR) ? (packed.size()) : (0);
+        response.dataSize = (path.empty()) ? (response.packedSize) : (0);
+        std::memcpy(response.wall, times.wall, sizeof(response.wall));
+        std::memcpy(response.cpu, times.cpu, sizeof(response.cpu));
+        
+        if (!writeFull(fd, &response, sizeof(response)) || !writeFull(fd, message.data(), response.messageSize))
+        {
+            return false;
+        }
+        
+        return response.dataSize == 0 || writeSegments(fd, packed.segments);
+    }
+    
+    void serveConnection(Server& server, int fd)
+    {
+        for (;;)
+        {
+            // idle connections are dropped once the server is stopping
+            pollfd poller = { fd, POLLIN, 0 };
+            auto ready = poll(&poller, 1, SERVE_POLL_MS);
+            
+            if (ready < 0 && errno != EINTR)
+            {
+                return;
+            }
+            
+            if (ready <= 0)
+            {
+                if (server.shouldStop())
+                {
+                    return;
+                }
+                
+                continue;
+            }
+            
+            RequestHeader request;
+            
+            if (!readFull(fd, &request, sizeof(request)) || request.magic != SERVE_MAGIC || request.version != SERVE_VERSION)
+            {
+                return;
+            }
+            
+            if (request.command == SERVE_SHUTDOWN)
+            {
+                server.stopping = true;
+                
+                ResponseHeader response{};
+                response.magic = SERVE_MAGIC;
+                response.version = SERVE_VERSION;
+                writeFull(fd, &response, sizeof(response));
+                return;
+            }
+            
+            if (request.command != SERVE_PACK || request.pathSize > SERVE_MAX_PATH || request.dataSize > SERVE_MAX_INLINE)
+            {
+                return;
+            }
+            
+            std::string path(request.pathSize, '\0');
+            ExecBuffer data;
+            
+            try
+            {
+                data.resize((size_t)request.dataSize);
+            }
+            catch (const std::bad_alloc&)
+            {
+                return;
+            }
+            
+            if (!readFull(fd, &path[0], path.size()) || !readFull(fd, data.data(), data.size()))
+            {
+                return;
+            }
+            
+            if (!serveRequest(server, fd, request, path, data))
+            {
+                return;
+            }
+        }
+    }
+    
+    void serveConnections(Server& server)
+    {
+        int fd;
+        
+        while ((fd = server.queue.pop()) >= 0)
+        {
+            serveConnection(server, fd);
+            ::close(fd);
+        }
+    }
+    
+    int listenSocket(const std::string& path, std::ostream& log)
+    {
+        sockaddr_un address;
+        
+        if (!socketAddress(path, address))
+        {
+            log << "bad socket path: \"" << path << "\"." << std::endl;
+            return -1;
+        }
+        
+        auto fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        
+        if (fd < 0)
+        {
+            log << "could not create socket." << std::endl;
+            return -1;
+        }
+        
+        setCloseOnExec(fd);
+        
+        auto slash = path.find_last_of('/');
+        
+        if (slash != std::string::npos && path.substr(0, slash) == privateDirectory() && !makePrivateDirectory(path.substr(0, slash)))
+        {
+            ::close(fd);
+            log << "\"" << path.substr(0, slash) << "\" is not a directory only this user can use." << std::endl;
+            return -1;
+        }
+        
+        auto bound = (bind(fd, (sockaddr *)&address, sizeof(address)) == 0);
+        
+        if (!bound && errno == EADDRINUSE)
+        {
+            // a socket nobody answers on is left over from a server that died
+            auto other = connectSocket(path);
+            
+            if (other >= 0)
+            {
+                ::close(other);
+                ::close(fd);
+                log << "a server is already running on \"" << path << "\"." << std::endl;
+                return -1;
+            }
+            
+            unlink(path.c_str());
+            bound = (bind(fd, (sockaddr *)&address, sizeof(address)) == 0);
+        }
+        
+        // jobs name files to overwrite, so only this user gets to connect.
+        // connections are checked as well, as other paths may be anywhere.
+        if (!bound || chmod(path.c_str(), S_IRUSR | S_IWUSR) != 0 || listen(fd, SOMAXCONN) != 0)
+        {
+            ::close(fd);
+            log << "could not listen on \"" << path << "\"." << std::endl;
+            return -1;
+        }
+        
+        return fd;
+    }
+}
+
+std::string default_server_socket(void)
+{
+    auto runtime = std::getenv("XDG_RUNTIME_DIR");
+    
+    if (runtime != nullptr && runtime[0] != '\0')
+    {
+        return std::string(runtime) + "/psp-packer.sock";
+    }
+    
+    return privateDirectory() + "/server.sock";
+}
+
+bool run_pack_server(const ServerOptions& options, std::ostream& log)
+{
+    auto workers = (options.workers) ? (options.workers) : (std::max(std::thread::hardware_concurrency(), 1u));
+    auto queueSize = (options.queueSize) ? (options.queueSize) : (workers * 4);
+    
+    auto fd = listenSocket(options.socketPath, log);
+    
+    if (fd < 0)
+    {
+        return false;
+    }
+    
+    struct sigaction interrupt, ignore, oldInt, oldTerm, oldPipe;
+    std::memset(&interrupt, 0, sizeof(interrupt));
+    std::memset(&ignore, 0, sizeof(ignore));
+    interrupt.sa_handler = onInterrupt;
+    ignore.sa_handler = SIG_IGN;
+    
+    // stop cleanly on ^C, and let writes to clients that went away fail
+    // rather than kill the server
+    g_interrupted = 0;
+    sigaction(SIGINT, &interrupt, &oldInt);
+    sigaction(SIGTERM, &interrupt, &oldTerm);
+    sigaction(SIGPIPE, &ignore, &oldPipe);
+    
+    Server server(options, workers, queueSize);
+    std::vector<std::thread> threads;
+    
+    for (auto i = 0u; i < workers; ++i)
+    {
+        threads.emplace_back(serveConnections, std::ref(server));
+    }
+    
+    log << "serving on \"" << options.socketPath << "\" with " << workers << " workers." << std::endl;
+    
+    auto lastTrim = std::chrono::steady_clock::now();
+    
+    while (!server.shouldStop())
+    {
+        pollfd poller = { fd, POLLIN, 0 };
+        
+        if (poll(&poller, 1, SERVE_POLL_MS) <= 0)
+        {
+            if (options.cache != nullptr && std::chrono::steady_clock::now() - lastTrim > std::chrono::seconds(SERVE_TRIM_SECONDS))
+            {
+                options.cache->trim();
+                lastTrim = std::chrono::steady_clock::now();
+            }
+            
+            continue;
+        }
+        
+        auto connection = accept(fd, nullptr, nullptr);
+        
+        if (connection < 0)
+        {
+            continue;
+        }
+        
+        setCloseOnExec(connection);
+        
+        if (!peerIsUser(connection))
+        {
+            ::close(connection);
+            log << "refused a connection from another user." << std::endl;
+            continue;
+        }
+        
+        // with the queue full, leave everyone else in the listen backlog
+        while (!server.queue.push(connection, SERVE_POLL_MS))
+        {
+            if (server.shouldStop())
+            {
+                ::close(connection);
+                break;
+            }
+        }
+    }
+    
+    server.queue.stop();
+    
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+    
+    ::close(fd);
+    unlink(options.socketPath.c_str());
+    
+    sigaction(SIGINT, &oldInt, nullptr);
+    sigaction(SIGTERM, &oldTerm, nullptr);
+    sigaction(SIGPIPE, &oldPipe, nullptr);
+    
+    log << "server stopped." << std::endl;
+    return true;
+}
+
+bool PackClient::connect(const std::string& socketPath)
+{
+    close();
+    m_fd = connectSocket(socketPath);
+    
+    if (m_fd >= 0 && !peerIsUser(m_fd))
+    {
+        close();
+    }
+    
+    return m_fd >= 0;
+}
+
+void PackClient::close(void)
+{
+    if (m_fd >= 0)
+    {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+}
+
+bool PackClient::pack(const ServeRequest& request, ServeResult& result)
+{
+    if (m_fd < 0 || request.path.size() > SERVE_MAX_PATH || request.data.size() > SERVE_MAX_INLINE)
+    {
+        return false;
+    }
+    
+    RequestHeader header{};
+    header.magic = SERVE_MAGIC;
+    header.version = SERVE_VERSION;
+    header.command = SERVE_PACK;
+    header.flags = ((request.useTags) ? (REQUEST_TAGS) : (0)) | ((request.verify) ? (REQUEST_VERIFY) : (0)) | ((request.searchParams) ? (REQUEST_SEARCH) : (0)) | ((request.strip) ? (REQUEST_STRIP) : (0)) | ((request.reproducible) ? (REQUEST_REPRODUCIBLE) : (0));
+    header.pspTag = request.pspTag;
+    header.oeTag = request.oeTag;
+    header.compressThreads = request.compressThreads;
+    header.params = request.params;
+    header.seed = request.seed;
+    header.budget = request.budget;
+    header.pathSize = (u32)request.path.size();
+    header.dataSize = request.data.size();
+    
+    ResponseHeader response;
+    
+    if (!writeFull(m_fd, &header, sizeof(header)) 
+    || !writeFull(m_fd, request.path.data(), request.path.size()) 
+    || !writeFull(m_fd, request.data.data(), request.data.size()) 
+    || !readFull(m_fd, &response, sizeof(response)) 
+    || response.magic != SERVE_MAGIC || response.version != SERVE_VERSION 
+    || response.messageSize > SERVE_MAX_MESSAGE || response.dataSize > SERVE_MAX_DATA)
+    {
+        close();
+        return false;
+    }
+    
+    result.error = response.error;
+    result.message.assign(response.messageSize, '\0');
+    result.data.resize((size_t)response.dataSize);
+    
+    if (!readFull(m_fd, &result.message[0], response.messageSize) || !readFull(m_fd, result.data.data(), result.data.size()))
+    {
+        close();
+        return false;
+    }
+    
+    result.packedSize = (size_t)response.packedSize;
+    result.info.params = response.params;
+    result.info.paramsSearched = (response.flags & RESPONSE_PARAMS_SEARCHED) != 0;
+    result.info.paramsReused = (response.flags & RESPONSE_PARAMS_REUSED) != 0;
+    result.info.cacheHit = (response.flags & RESPONSE_CACHE_HIT) != 0;
+    result.info.type = (ExecutableType)response.type;
+    result.info.elfSize = (size_t)response.elfSize;
+    result.info.strippedSize = (size_t)response.strippedSize;
+    result.info.levelChosen = (response.flags & RESPONSE_LEVEL_CHOSEN) != 0;
+    result.info.estimate = response.estimate;
+    result.info.compressSeconds = response.compressSeconds;
+    result.info.compressedSize = (size_t)response.compressedSize;
+    result.info.decryptMode = response.decryptMode;
+    result.info.tag = response.tag;
+    result.info.oeTag = response.oeTag;
+    std::memcpy(result.times.wall, response.wall, sizeof(response.wall));
+    std::memcpy(result.times.cpu, response.cpu, sizeof(response.cpu));
+    return true;
+}
+
+bool PackClient::shutdown(void)
+{
+    RequestHeader header{};
+    header.magic = SERVE_MAGIC;
+    header.version = SERVE_VERSION;
+    header.command = SERVE_SHUTDOWN;
+    
+    ResponseHeader response;
+    auto ok = m_fd >= 0 && writeFull(m_fd, &header, sizeof(header)) && readFull(m_fd, &response, sizeof(response));
+    close();
+    return ok;
+}
+#else
+std::string default_server_socket(void)
+{
+    return "psp-packer.sock";
+}
+
+bool run_pack_server(const ServerOptions& options, std::ostream& log)
+{
+    log << "serving needs unix domain sockets, which this build doesn't have." << std::endl;
+    return false;
+}
+
+bool PackClient::connect(const std::string& socketPath)
+{
+    return false;
+}
+
+void PackClient::close(void)
+{
+}
+
+bool PackClient::pack(const ServeRequest& request, ServeResult& result)
+{
+    return false;
+}
+
+bool PackClient::shutdown(void)
+{
+    return false;
+}
+#endif
@@ -0,0 +1,138 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#ifndef PACKSERVER_H_
+#define PACKSERVER_H_
+
+#include <ostream>
+#include <string>
+
+#include "packexec.h"
+
+// the largest executable a job can send inline. anything bigger is packed
+// by path, or without the server.
+#define SERVE_MAX_INLINE    (256 << 20)
+
+// a pack job for the server
+struct ServeRequest
+{
+    ServeRequest() : useTags(false), pspTag(0), oeTag(0), compressThreads(0), verify(false), searchParams(false), strip(false), reproducible(false), seed(0)
+    {
+        gzipDefaultParams(&params);
+    }
+    
+    // absolute path of a file to pack in place, or empty to pack 'data' and
+    // send the result back. 'data' is at most SERVE_MAX_INLINE bytes.
+    std::string path;
+    ExecBuffer data;
+    
+    // use pspTag and oeTag instead of the defaults for the executable type
+    bool useTags;
+    unsigned int pspTag;
+    unsigned int oeTag;
+    
+    GzipParams params;
+    unsigned int compressThreads;
+    bool verify;
+    bool searchParams;
+    bool strip;
+    bool reproducible;
+    u64 seed;
+    LevelBudget budget;
+};
+
+struct ServeResult
+{
+    ServeResult() : error(NO_ERROR), packedSize(0) {}
+    
+    int error;
+    
+    // what went wrong, empty if nothing did
+    std::string message;
+    
+    size_t packedSize;
+    
+    // times are in 'times' rather than info.times
+    PackInfo info;
+    PhaseTimes times;
+    
+    // the packed executable, for jobs that sent their input inline
+    ExecBuffer data;
+};
+
+struct ServerOptions
+{
+    ServerOptions() : workers(0), queueSize(0), paramsDb(nullptr), cache(nullptr) {}
+    
+    std::string socketPath;
+    
+    // connections served at once, 0 for one per hardware thread
+    unsigned int workers;
+    
+    // accepted connections waiting for a worker, 0 for four per worker.
+    // past that, connections wait in the listen backlog.
+    unsigned int queueSize;
+    
+    ParamsDatabase *paramsDb;
+    PackCache *cache;
+};
+
+// $XDG_RUNTIME_DIR/psp-packer.sock, or one in a directory in /tmp that only
+// the user can use
+std::string default_server_socket(void);
+
+// serve pack jobs on a unix socket until a client asks it to shut down or
+// the process is interrupted. workers are kept for the life of the server,
+// so their compression contexts stay warm between jobs. returns false if the
+// socket could not be set up.
+bool run_pack_server(const ServerOptions& options, std::ostream& log);
+
+// a connection to the server. jobs on one connection run one after the
+// other, so use a client per thread to have several running at once.
+class PackClient
+{
+public:
+    PackClient() : m_fd(-1) {}
+    ~PackClient() { close(); }
+    
+    PackClient(const PackClient&) = delete;
+    PackClient& operator=(const PackClient&) = delete;
+    
+    bool connect(const std::string& socketPath);
+    void close(void);
+    bool connected(void) const { return m_fd >= 0; }
+    
+    // false if the connection broke, otherwise the job's outcome is in
+    // 'result' whether it packed or not
+    bool pack(const ServeRequest& request, ServeResult& result);
+    
+    // have the server stop once the jobs it is running are done
+    bool shutdown(void);
+    
+private:
+    int m_fd;
+};
+
+#endif // PACKSERVER_H_
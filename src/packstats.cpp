@@ -0,0 +1,71 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#include "packstats.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+const char *phaseName(PackPhase phase)
+{
+    switch (phase)
+    {
+        case PHASE_READ:        return "read";
+        case PHASE_PREPARE:     return "prepare";
+        case PHASE_COMPRESS:    return "compress";
+        case PHASE_VERIFY:      return "verify";
+        case PHASE_WRITE:       return "write";
+        default:                return "unknown";
+    }
+}
+
+double threadCpuTime(void)
+{
+#ifdef _WIN32
+    FILETIME creation, exit, kernel, user;
+    
+    if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user))
+    {
+        return 0.0;
+    }
+    
+    // 100ns ticks
+    auto ticks = ((unsigned long long)kernel.dwHighDateTime << 32 | kernel.dwLowDateTime) 
+        + ((unsigned long long)user.dwHighDateTime << 32 | user.dwLowDateTime);
+    return ticks * 1e-7;
+#else
+    struct timespec ts;
+    
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+    {
+        return 0.0;
+    }
+    
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
@@ -0,0 +1,98 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#ifndef PACKSTATS_H_
+#define PACKSTATS_H_
+
+#include <chrono>
+
+#include "tracelog.h"
+
+enum PackPhase
+{
+    PHASE_READ,
+    PHASE_PREPARE,
+    PHASE_COMPRESS,
+    PHASE_VERIFY,
+    PHASE_WRITE,
+    PHASE_COUNT
+};
+
+// seconds spent in each phase. cpu is the time of the thread running the
+// phase, so blocks compressed on other workers with -t aren't in it.
+struct PhaseTimes
+{
+    PhaseTimes() : wall(), cpu() {}
+    
+    double wall[PHASE_COUNT];
+    double cpu[PHASE_COUNT];
+};
+
+const char *phaseName(PackPhase phase);
+
+// cpu time of the calling thread in seconds
+double threadCpuTime(void);
+
+// adds the time until stop() or the end of the scope to a phase, and to the
+// trace when there is one. does nothing else when 'times' is null.
+class PhaseTimer
+{
+public:
+    PhaseTimer(PhaseTimes *times, PackPhase phase) : m_times(times), m_phase(phase), m_span(phaseName(phase), "phase")
+    {
+        if (m_times)
+        {
+            m_wall = std::chrono::steady_clock::now();
+            m_cpu = threadCpuTime();
+        }
+    }
+    
+    ~PhaseTimer() { stop(); }
+    
+    PhaseTimer(const PhaseTimer&) = delete;
+    PhaseTimer& operator=(const PhaseTimer&) = delete;
+    
+    void stop(void)
+    {
+        m_span.stop();
+        
+        if (m_times)
+        {
+            std::chrono::duration<double> wall = std::chrono::steady_clock::now() - m_wall;
+            m_times->wall[m_phase] += wall.count();
+            m_times->cpu[m_phase] += threadCpuTime() - m_cpu;
+            m_times = nullptr;
+        }
+    }
+    
+private:
+    PhaseTimes *m_times;
+    PackPhase m_phase;
+    std::chrono::steady_clock::time_point m_wall;
+    double m_cpu;
+    TraceSpan m_span;
+};
+
+#endif // PACKSTATS_H_
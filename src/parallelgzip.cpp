@@ -0,0 +1,165 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#include "parallelgzip.h"
+#include "threadpool.h"
+#include "buffer.h"
+#include "bufferpool.h"
+#include "tracelog.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+namespace
+{
+    const u32 DICTIONARY_SIZE = 32 * 1024;
+    
+    struct CompressedBlock
+    {
+        ~CompressedBlock()
+        {
+            sharedBufferPool().give(data);
+        }
+        
+        ModuleBuffer data;
+        u32 crc;
+        int result;
+    };
+    
+    void compressBlock(CompressedBlock& block, const u8 *inbuffer, u32 offset, u32 size, bool last, const GzipParams& params)
+    {
+        block.result = -1;
+        
+        TraceSpan span("deflate block", "compress");
+        span.arg("offset", offset);
+        span.arg("bytes", size);
+        
+        auto ctx = gzipThreadContext();
+        
+        if (ctx == nullptr)
+        {
+            return;
+        }
+        
+        // prime with the tail of the previous block so matches can reach back
+        // across the block boundary just like in a single stream
+        auto dictSize = std::min(offset, DICTIONARY_SIZE);
+        
+        sharedBufferPool().take(block.data, gzipGetMaxCompressedSize(size));
+        
+        // every block but the last ends byte aligned on an empty stored block
+        auto res = gzipDeflateRaw(ctx, block.data.data(), (u32)block.data.size(), inbuffer + offset, size, inbuffer + offset - dictSize, dictSize, last, &params, &block.crc);
+        
+        if (res >= 0)
+        {
+            block.data.resize(res);
+            block.result = 0;
+        }
+    }
+    
+    struct ContextDeleter
+    {
+        void operator()(GzipContext *ctx) const
+        {
+            gzipDestroyContext(ctx);
+        }
+    };
+}
+
+GzipContext *gzipThreadContext(void)
+{
+    thread_local std::unique_ptr<GzipContext, ContextDeleter> context(gzipCreateContext());
+    return context.get();
+}
+
+int gzipCompressParallel(ThreadPool& pool, void *outbuffer, u32 outsize, const void *inbuffer, u32 insize, const GzipParams *params)
+{
+    auto outdata = (u8 *)outbuffer;
+    auto indata = (const u8 *)inbuffer;
+    
+    // minimum size for gzip
+    if (outsize < GZIP_HEADER_SIZE + GZIP_TRAILER_SIZE)
+    {
+        return -1;
+    }
+    
+    auto nblocks = std::max<u32>((insize + GZIP_PARALLEL_BLOCK_SIZE - 1) / GZIP_PARALLEL_BLOCK_SIZE, 1);
+    std::vector<CompressedBlock> blocks(nblocks);
+    
+    {
+        TaskGroup group(pool);
+        
+        for (auto i = 0u; i < nblocks; ++i)
+        {
+            auto offset = i * GZIP_PARALLEL_BLOCK_SIZE;
+            auto size = std::min<u32>(insize - offset, GZIP_PARALLEL_BLOCK_SIZE);
+            auto block = &blocks[i];
+            auto last = (i == nblocks - 1);
+            
+            group.run([=]()
+            {
+                compressBlock(*block, indata, offset, size, last, *params);
+            });
+        }
+        
+        group.wait();
+    }
+    
+    TraceSpan span("stitch blocks", "compress");
+    span.arg("blocks", nblocks);
+    gzipWriteHeader(outdata);
+    
+    // stitch the blocks together and combine their crcs
+    auto crc = crc32(0L, Z_NULL, 0);
+    u32 pos = GZIP_HEADER_SIZE;
+    
+    for (auto i = 0u; i < nblocks; ++i)
+    {
+        auto& block = blocks[i];
+        auto size = std::min<u32>(insize - i * GZIP_PARALLEL_BLOCK_SIZE, GZIP_PARALLEL_BLOCK_SIZE);
+        
+        if (block.result < 0)
+        {
+            return -1;
+        }
+        
+        // check if there is enough size
+        if (outsize - pos < block.data.size() + GZIP_TRAILER_SIZE)
+        {
+            return -2;
+        }
+        
+        std::memcpy(outdata + pos, block.data.data(), block.data.size());
+        pos += (u32)block.data.size();
+        crc = crc32_combine(crc, block.crc, size);
+    }
+    
+    gzipWriteTrailer(outdata + pos, (u32)crc, insize);
+    return pos + GZIP_TRAILER_SIZE;
+}
@@ -0,0 +1,44 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#ifndef PARALLELGZIP_H_
+#define PARALLELGZIP_H_
+
+#include "gzip.h"
+
+class ThreadPool;
+
+// compression context owned by the calling thread, created on first use and
+// reused by every job that thread runs afterwards. null if out of memory.
+GzipContext *gzipThreadContext(void);
+
+// compress into a single gzip member the same way gzipCompress does, but as
+// GZIP_PARALLEL_BLOCK_SIZE blocks spread across the pool. each block is primed
+// with the 32KiB of input before it and ends on a sync flush, so the blocks
+// join into one deflate stream. the output does not depend on the number of
+// threads in the pool.
+int gzipCompressParallel(ThreadPool& pool, void *outbuffer, u32 outsize, const void *inbuffer, u32 insize, const GzipParams *params);
+
+#endif // PARALLELGZIP_H_
@@ -0,0 +1,523 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#include "paramsearch.h"
+#include "threadpool.h"
+#include "parallelgzip.h"
+#include "bufferpool.h"
+#include "tracelog.h"
+#include "fileio.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    std::vector<GzipParams> searchGrid(void)
+    {
+        std::vector<GzipParams> grid;
+        
+        // lower levels and the rle/huffman strategies never win on code
+        for (int strategy : { Z_DEFAULT_STRATEGY, Z_FILTERED })
+        {
+            for (int memLevel : { 8, 9 })
+            {
+                for (int level = 9; level >= 4; --level)
+                {
+                    grid.push_back({ level, memLevel, strategy, GZIP_ENCODER_ZLIB });
+                }
+            }
+        }
+        
+        return grid;
+    }
+    
+    // slices the level chooser compresses, spread over the module. small
+    // enough that sampling stays well under the cost of the real thing.
+    const u32 LEVEL_SAMPLES = 4;
+    const u32 LEVEL_SAMPLE_MIN = 4 * 1024;
+    const u32 LEVEL_SAMPLE_MAX = 64 * 1024;
+    
+    // the size estimate compresses about an eighth of the module in this
+    // many slices. the interval is a t interval, 2.13 being t for 95% at 15
+    // degrees of freedom.
+    const u32 ESTIMATE_SAMPLES = 16;
+    const u32 ESTIMATE_FRACTION = 8;
+    const u32 ESTIMATE_SLICE_MIN = 2 * 1024;
+    const u32 ESTIMATE_SLICE_MAX = 32 * 1024;
+    const double ESTIMATE_T = 2.13;
+    
+    // neighbouring slices compressed together and apart, to see what a
+    // slice pays for being a stream of its own
+    const u32 ESTIMATE_CALIBRATION = 4;
+    
+    // deflate's window, which each slice is primed with
+    const u32 ESTIMATE_WINDOW = 32 * 1024;
+}
+
+namespace
+{
+    // "<level> <memLevel> <strategy> <module name>" per line
+    void readEntries(const std::string& path, std::map<std::string, GzipParams>& entries)
+    {
+        std::ifstream file(path);
+        std::string line;
+        
+        while (std::getline(file, line))
+        {
+            std::istringstream fields(line);
+            GzipParams params;
+            std::string module;
+            gzipDefaultParams(&params);
+            
+            if (!(fields >> params.level >> params.memLevel >> params.strategy))
+            {
+                continue;
+            }
+            
+            std::getline(fields >> std::ws, module);
+            
+            if (!module.empty())
+            {
+                entries[module] = params;
+            }
+        }
+    }
+}
+
+bool ParamsDatabase::load(const std::string& path)
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_path = path;
+    readEntries(path, m_entries);
+    return true;
+}
+
+bool ParamsDatabase::save(void)
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    
+    if (m_stored.empty() || m_path.empty())
+    {
+        return true;
+    }
+    
+#ifndef _WIN32
+    // parallel builds share the file. the lock sits beside it since the
+    // file itself is replaced on every save.
+    auto lockPath = m_path + ".lock";
+    auto lock = ::open(lockPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+    
+    if (lock < 0)
+    {
+        return false;
+    }
+    
+    while (flock(lock, LOCK_EX) != 0)
+    {
+        if (errno != EINTR)
+        {
+            ::close(lock);
+            return false;
+        }
+    }
+#endif
+    
+    // whatever other builds saved since the load, with this build's
+    // results on top
+    std::map<std::string, GzipParams> merged;
+    readEntries(m_path, merged);
+    
+    for (auto& module : m_stored)
+    {
+        merged[module] = m_entries[module];
+    }
+    
+    std::ostringstream text;
+    
+    for (auto& entry : merged)
+    {
+        text << entry.second.level << " " << entry.second.memLevel << " " << entry.second.strategy << " " << entry.first << "\n";
+    }
+    
+    auto contents = text.str();
+    auto written = writeFileAtomic(m_path, { { contents.data(), contents.size() } });
+    
+#ifndef _WIN32
+    ::close(lock);
+#endif
+    
+    if (!written)
+    {
+        return false;
+    }
+    
+    m_entries.swap(merged);
+    m_stored.clear();
+    return true;
+}
+
+bool ParamsDatabase::find(const std::string& module, GzipParams& params) const
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    auto it = m_entries.find(module);
+    
+    if (it == m_entries.end())
+    {
+        return false;
+    }
+    
+    params = it->second;
+    return true;
+}
+
+void ParamsDatabase::store(const std::string& module, const GzipParams& params)
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_entries[module] = params;
+    m_stored.insert(module);
+}
+
+int searchGzipParams(ThreadPool& pool, u32 outsize, const ParamsCompressor& compress, ModuleBuffer& output, GzipParams& best)
+{
+    auto grid = searchGrid();
+    
+    std::mutex lock;
+    auto bestSize = -1;
+    auto bestIndex = grid.size();
+    
+    TaskGroup group(pool);
+    
+    for (auto i = 0u; i < grid.size(); ++i)
+    {
+        group.run([&, i]()
+        {
+            ModuleBuffer candidate;
+            sharedBufferPool().take(candidate, outsize);
+            auto size = compress(candidate.data(), outsize, grid[i]);
+            
+            // only the best stream so far is kept alive. ties go to the
+            // earlier grid entry so the result doesn't depend on timing.
+            if (size >= 0)
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                
+                if (bestSize < 0 || size < bestSize || (size == bestSize && i < bestIndex))
+                {
+                    bestSize = size;
+                    bestIndex = i;
+                    output.swap(candidate);
+                }
+            }
+            
+            sharedBufferPool().give(candidate);
+        });
+    }
+    
+    group.wait();
+    
+    if (bestSize >= 0)
+    {
+        best = grid[bestIndex];
+        output.resize(bestSize);
+    }
+    
+    return bestSize;
+}
+
+bool chooseGzipLevel(const char *input, u32 size, const GzipParams& params, const LevelBudget& budget, unsigned int threads, LevelEstimate& chosen)
+{
+    TraceSpan span("choose level", "compress");
+    auto ctx = gzipThreadContext();
+    
+    if (ctx == nullptr || size == 0)
+    {
+        return false;
+    }
+    
+    auto sliceSize = std::min(std::max(size / (LEVEL_SAMPLES * 4), LEVEL_SAMPLE_MIN), LEVEL_SAMPLE_MAX);
+    std::vector<std::pair<u32, u32>> slices;
+    
+    if (size <= sliceSize * LEVEL_SAMPLES)
+    {
+        slices.push_back({ 0, size });
+    }
+    else
+    {
+        for (auto i = 0u; i < LEVEL_SAMPLES; ++i)
+        {
+            slices.push_back({ (u32)((u64)(size - sliceSize) * i / (LEVEL_SAMPLES - 1)), sliceSize });
+        }
+    }
+    
+    u64 sampled = 0;
+    
+    for (auto& slice : slices)
+    {
+        sampled += slice.second;
+    }
+    
+    ModuleBuffer output;
+    sharedBufferPool().take(output, gzipGetMaxCompressedSize(std::min(size, sliceSize * LEVEL_SAMPLES)));
+    
+    // blocks compress side by side, near enough
+    auto scale = (double)size / sampled / std::max(threads, 1u);
+    
+    // each level is sampled at most once
+    LevelEstimate estimates[10];
+    auto failed = false;
+    
+    auto sample = [&](int level) -> const LevelEstimate&
+    {
+        auto& estimate = estimates[level];
+        
+        if (estimate.level != 0 || failed)
+        {
+            return estimate;
+        }
+        
+        auto candidate = params;
+        candidate.level = level;
+        u64 compressed = 0;
+        
+        auto start = std::chrono::steady_clock::now();
+        
+        for (auto& slice : slices)
+        {
+            auto res = gzipCompressContext(ctx, output.data(), (u32)output.size(), input + slice.first, slice.second, &candidate);
+            
+            if (res < 0)
+            {
+                failed = true;
+                return estimate;
+            }
+            
+            compressed += res;
+        }
+        
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        estimate.level = level;
+        estimate.ratio = (double)compressed / sampled;
+        estimate.seconds = elapsed.count() * scale;
+        return estimate;
+    };
+    
+    auto limit = budget.seconds;
+    
+    if (budget.bytesPerSecond > 0 && (limit <= 0 || size / budget.bytesPerSecond < limit))
+    {
+        limit = size / budget.bytesPerSecond;
+    }
+    
+    // time and size both improve with the level, near enough, so both ends
+    // are binary searches. first the highest level that fits the time...
+    auto fastest = 1, slowest = 9;
+    
+    if (limit > 0)
+    {
+        auto low = 0, high = 9;
+        
+        while (low < high)
+        {
+            auto mid = (low + high + 1) / 2;
+            
+            if (sample(mid).seconds <= limit)
+            {
+                low = mid;
+            }
+            else
+            {
+                high = mid - 1;
+            }
+        }
+        
+        // nothing fits, so go as fast as possible
+        slowest = std::max(low, 1);
+    }
+    
+    // ...then the lowest level under it that reaches the ratio
+    auto level = slowest;
+    
+    if (budget.ratio > 0)
+    {
+        auto low = fastest, high = slowest;
+        
+        while (low < high)
+        {
+            auto mid = (low + high) / 2;
+            
+            if (sample(mid).ratio <= budget.ratio)
+            {
+                high = mid;
+            }
+            else
+            {
+                low = mid + 1;
+            }
+        }
+        
+        level = low;
+    }
+    
+    chosen = sample(level);
+    sharedBufferPool().give(output);
+    return !failed;
+}
+
+bool estimateCompressedSize(const char *input, u32 size, const GzipParams& params, unsigned int threads, SizeEstimate& estimate)
+{
+    TraceSpan span("estimate size", "compress");
+    auto ctx = gzipThreadContext();
+    
+    if (ctx == nullptr)
+    {
+        return false;
+    }
+    
+    auto sliceSize = std::min(std::max(size / (ESTIMATE_SAMPLES * ESTIMATE_FRACTION), ESTIMATE_SLICE_MIN), ESTIMATE_SLICE_MAX);
+    ModuleBuffer output;
+    
+    // sampling wouldn't save much, so get it right instead
+    if (size <= sliceSize * ESTIMATE_SAMPLES * 2)
+    {
+        sharedBufferPool().take(output, gzipGetMaxCompressedSize(size));
+        auto res = gzipCompressContext(ctx, output.data(), (u32)output.size(), input, size, &params);
+        sharedBufferPool().give(output);
+        
+        if (res < 0)
+        {
+            return false;
+        }
+        
+        estimate.size = estimate.low = estimate.high = res;
+        estimate.exact = true;
+        return true;
+    }
+    
+    sharedBufferPool().take(output, gzipGetMaxCompressedSize(sliceSize * ESTIMATE_CALIBRATION));
+    auto failed = false;
+    
+    // compressed size of 'length' bytes at 'offset' as if mid-stream
+    auto sample = [&](u32 offset, u32 length)
+    {
+        auto window = std::min(offset, ESTIMATE_WINDOW);
+        u32 crc;
+        
+        auto res = gzipDeflateRaw(ctx, output.data(), (u32)output.size(), input + offset, length, input + offset - window, window, 1, &params, &crc);
+        failed |= (res < 0);
+        return (double)res;
+    };
+    
+    auto sum = 0.0, sumSquares = 0.0;
+    
+    for (auto i = 0u; i < ESTIMATE_SAMPLES; ++i)
+    {
+        auto ratio = sample((u32)((u64)(size - sliceSize) * i / (ESTIMATE_SAMPLES - 1)), sliceSize) / sliceSize;
+        sum += ratio;
+        sumSquares += ratio * ratio;
+    }
+    
+    // every slice pays for a block header and end of its own, which the real
+    // stream only does every so often
+    auto region = (size - sliceSize * ESTIMATE_CALIBRATION) / 2;
+    auto apart = 0.0;
+    
+    for (auto i = 0u; i < ESTIMATE_CALIBRATION; ++i)
+    {
+        apart += sample(region + i * sliceSize, sliceSize);
+    }
+    
+    auto together = sample(region, sliceSize * ESTIMATE_CALIBRATION);
+    auto perSlice = std::max((apart - together) / (ESTIMATE_CALIBRATION - 1), 0.0);
+    sharedBufferPool().give(output);
+    
+    if (failed)
+    {
+        return false;
+    }
+    
+    // the spread is of the slices as compressed, the correction only moves
+    // the point estimate
+    auto mean = sum / ESTIMATE_SAMPLES;
+    auto variance = std::max((sumSquares - ESTIMATE_SAMPLES * mean * mean) / (ESTIMATE_SAMPLES - 1), 0.0);
+    auto ratio = mean - perSlice / sliceSize;
+    
+    // the slices are a good part of the module, which narrows the interval
+    auto sampled = (double)ESTIMATE_SAMPLES * sliceSize / size;
+    auto margin = ESTIMATE_T * std::sqrt(variance / ESTIMATE_SAMPLES * (1.0 - sampled)) * size;
+    
+    // the gzip wrapper, and the sync flush every parallel block ends on
+    auto overhead = (double)(GZIP_HEADER_SIZE + GZIP_TRAILER_SIZE);
+    
+    if (threads != 0)
+    {
+        overhead += 5.0 * ((size + GZIP_PARALLEL_BLOCK_SIZE - 1) / GZIP_PARALLEL_BLOCK_SIZE);
+    }
+    
+    estimate.size = ratio * size + overhead;
+    estimate.low = std::max(estimate.size - margin, overhead);
+    estimate.high = estimate.size + margin;
+    estimate.exact = false;
+    return true;
+}
+
+std::string describeGzipParams(const GzipParams& params)
+{
+    std::ostringstream description;
+    description << "level " << params.level << ", memLevel " << params.memLevel << ", ";
+    
+    switch (params.strategy)
+    {
+        case Z_DEFAULT_STRATEGY:
+            description << "default";
+            break;
+        case Z_FILTERED:
+            description << "filtered";
+            break;
+        default:
+            description << "strategy " << params.strategy;
+            break;
+    }
+    
+    if (params.encoder != GZIP_ENCODER_ZLIB)
+    {
+        description << ", " << gzipEncoderName(params.encoder) << " encoder";
+    }
+    
+    return description.str();
+}
@@ -0,0 +1,129 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#ifndef PARAMSEARCH_H_
+#define PARAMSEARCH_H_
+
+#include "gzip.h"
+#include "buffer.h"
+
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+class ThreadPool;
+
+// winning gzip parameters per module, kept in a text file between builds so
+// the search only has to run once per module
+class ParamsDatabase
+{
+public:
+    ParamsDatabase() {}
+    
+    // a missing file is an empty database
+    bool load(const std::string& path);
+    
+    // replace the file atomically if anything was added. other builds may have
+    // saved since the load, so under a lock the file is read again and only
+    // the modules stored here are written over its entries.
+    bool save(void);
+    
+    bool find(const std::string& module, GzipParams& params) const;
+    void store(const std::string& module, const GzipParams& params);
+    
+private:
+    std::string m_path;
+    mutable std::mutex m_lock;
+    std::map<std::string, GzipParams> m_entries;
+    std::set<std::string> m_stored;
+};
+
+// compress 'outsize' bytes worth of output with the given parameters,
+// returning the size used or a negative error
+using ParamsCompressor = std::function<int(char *outbuffer, u32 outsize, const GzipParams& params)>;
+
+// try every combination in the search grid on the pool and leave the smallest
+// stream in 'output'. returns its size, or negative if nothing compressed.
+int searchGzipParams(ThreadPool& pool, u32 outsize, const ParamsCompressor& compress, ModuleBuffer& output, GzipParams& best);
+
+// what the level chooser aims for. anything left at 0 doesn't count.
+struct LevelBudget
+{
+    LevelBudget() : seconds(0), bytesPerSecond(0), ratio(0) {}
+    
+    bool active(void) const { return seconds > 0 || bytesPerSecond > 0 || ratio > 0; }
+    
+    // how long compressing the whole module may take, either outright or as
+    // a throughput
+    double seconds;
+    double bytesPerSecond;
+    
+    // compressed size over original size that is small enough
+    double ratio;
+};
+
+// what sampling predicted for the whole module at one level
+struct LevelEstimate
+{
+    LevelEstimate() : level(0), ratio(0), seconds(0) {}
+    
+    int level;
+    double ratio;
+    double seconds;
+};
+
+// compress a few slices of 'input' at different levels with the rest of
+// 'params', and pick the cheapest level expected to reach the ratio within
+// the time. without a ratio that is the highest level that fits the time,
+// and if nothing fits it is level 1. 'threads' is how many compress the
+// module in blocks, 0 for one stream.
+bool chooseGzipLevel(const char *input, u32 size, const GzipParams& params, const LevelBudget& budget, unsigned int threads, LevelEstimate& chosen);
+
+// a predicted size in bytes, with the range the real one is in about 95% of
+// the time
+struct SizeEstimate
+{
+    SizeEstimate() : size(0), low(0), high(0), exact(false) {}
+    
+    double size;
+    double low;
+    double high;
+    
+    // nothing was predicted, the size is what it will be
+    bool exact;
+};
+
+// predict what 'params' compress 'input' to by compressing evenly spaced
+// slices, each primed with the window before it as if it were mid-stream.
+// small inputs are just compressed. 'threads' is as for chooseGzipLevel.
+bool estimateCompressedSize(const char *input, u32 size, const GzipParams& params, unsigned int threads, SizeEstimate& estimate);
+
+// short description for reports, eg. "level 9, memLevel 9, filtered"
+std::string describeGzipParams(const GzipParams& params);
+
+#endif // PARAMSEARCH_H_
@@ -24,103 +24,1154 @@ DEALINGS IN THE SOFTWARE.
  */
 
 #include <iostream>
-#include <fstream>
-#include <iterator>
+#include <iomanip>
+#include <sstream>
+#include <algorithm>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
 
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 
 #include "packexec.h"
+#include "filelist.h"
+#include "fileio.h"
+#include "threadpool.h"
+#include "paramsearch.h"
+#include "streampack.h"
+#include "packcache.h"
+#include "unpack.h"
+#include "packserver.h"
+#include "jobserver.h"
+#include "isoimage.h"
+#include "iopipeline.h"
+#include "tracelog.h"
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+enum RunMode
+{
+    MODE_PACK,
+    MODE_UNPACK,
+    MODE_VERIFY,
+    MODE_ESTIMATE
+};
+
+// how much of a batch is held in memory on its way from and to the disk
+#define IO_PIPELINE_BYTES (256u << 20)
+
+// what a file that went through each mode is
+static const char *modeDone[] = { "packed", "unpacked", "verified", "estimated" };
+
+// the span covering each file in a trace
+static const char *modeSpan[] = { "pack", "unpack", "verify", "estimate" };
+
+enum JobStatus
+{
+    JOB_PACKED,
+    JOB_SKIPPED,
+    JOB_FAILED
+};
+
+struct PackJob
+{
+    InputFile input;
+    JobStatus status;
+    int error;
+    size_t packedSize;
+    std::string message;
+    PackInfo info;
+    PhaseTimes times;
+    SizeEstimate estimate;
+};
 
 void usage(void)
 {
     std::cout << "psp-packer by Davee" << std::endl;
-    std::cout << "usage: psp-packer [-s <tag> <oetag>] file" << std::endl;
+    std::cout << "usage: psp-packer [-s <tag> <oetag>] [-j <jobs>] [-t <threads>] [-r] [-c] [--best|--optimal] [--strip] [--reproducible|--seed <n>] [--budget <ms>|<n>MB/s] [--ratio <r>] [--params <file>] [--cache <dir>] [--stats|--json] [--trace <file>] file..." << std::endl;
+    std::cout << "       psp-packer [-s <tag> <oetag>] - < input > output" << std::endl;
+    std::cout << "       psp-packer --iso [pack options] image..." << std::endl;
+    std::cout << "       psp-packer --unpack|--verify [-j <jobs>] [-r] file..." << std::endl;
+    std::cout << "       psp-packer --estimate [pack options] file..." << std::endl;
+    std::cout << "       psp-packer --serve [--socket <path>] [-j <jobs>] [--params <file>] [--cache <dir>]" << std::endl;
+    std::cout << "       psp-packer --client [--socket <path>] [pack options] file...|-" << std::endl;
+    std::cout << "  -s <tag> <oetag>  use fixed tags instead of the defaults" << std::endl;
+    std::cout << "  -j <jobs>         pack up to <jobs> files at once (default: all cores)" << std::endl;
+    std::cout << "  -t <threads>      compress each file in parallel blocks on <threads> threads" << std::endl;
+    std::cout << "  -r                pack every executable found under directories" << std::endl;
+    std::cout << "  -c                check the packed output decompresses to the input" << std::endl;
+    std::cout << "  --best            search deflate parameters for the smallest output" << std::endl;
+    std::cout << "  --optimal         spend much longer on an optimal parse for the smallest output" << std::endl;
+    std::cout << "  --strip           leave out ELF sections the PSP never loads, like debug info" << std::endl;
+    std::cout << "  --reproducible    derive the key data from the input, so repacking gives the same bytes" << std::endl;
+    std::cout << "  --seed <n>        derive the key data from <n> instead, which can't be 0" << std::endl;
+    std::cout << "  --budget <ms>     pick the highest level that compresses each module in time," << std::endl;
+    std::cout << "                    given in milliseconds or as a throughput like 40MB/s" << std::endl;
+    std::cout << "  --ratio <r>       pick the lowest level that gets compressed/original under <r>" << std::endl;
+    std::cout << "  --params <file>   reuse and record the parameters --best finds per module" << std::endl;
+    std::cout << "  --cache <dir>     keep compressed modules in <dir> and reuse them" << std::endl;
+    std::cout << "  --cache-size <mb> evict the least recently used entries past <mb> (default: 512)" << std::endl;
+    std::cout << "  --stats           print sizes, header fields and time per phase for each file" << std::endl;
+    std::cout << "  --json            the same as one JSON object per line, everything else on stderr" << std::endl;
+    std::cout << "  --trace <file>    record a timeline of every thread for Perfetto or chrome://tracing" << std::endl;
+    std::cout << "  -                 pack stdin to stdout" << std::endl;
+    std::cout << "  --iso             pack every PRX and PBP inside ISO or CSO images" << std::endl;
+    std::cout << "  --unpack          inflate packed files back to plain PRXs and PBPs" << std::endl;
+    std::cout << "  --verify          check packed files inflate to the module their headers describe" << std::endl;
+    std::cout << "  --estimate        predict packed sizes from a sample of each module, leaving files alone" << std::endl;
+    std::cout << "  --serve           keep running and pack the jobs clients send over a unix socket" << std::endl;
+    std::cout << "  --client          have the server pack the files instead of packing them here" << std::endl;
+    std::cout << "  --socket <path>   the server's socket (default: " << default_server_socket() << ")" << std::endl;
+    std::cout << "  --shutdown        ask the server to stop" << std::endl;
 }
 
-int main(int argc, char *argv[])
+void packFile(PackJob& job, const TagHandler& pspTagHandler, const TagHandler& oeTagHandler, const PackOptions& options, IoPipeline *io)
 {
-    const char *filename = argv[1];
-    TagHandler pspTagHandler = [](ExecutableType type) -> unsigned int
+    auto filename = job.input.path.c_str();
+    MappedFile file;
+    ModuleBuffer buffer;
+    PhaseTimer readTimer(job.info.times, PHASE_READ);
+    
+    // the pipeline leaves big files to be mapped as usual
+    auto piped = (io && io->read(job.input.path, buffer));
+    
+    // check if file error
+    if (!piped && !file.open(filename))
+    {
+        job.status = JOB_FAILED;
+        job.message = std::string("could not open file: \"") + filename + "\".";
+        return;
+    }
+    
+    readTimer.stop();
+    
+    PackedExec packed;
+    job.error = (piped) ? (pack_executable(buffer.data(), buffer.size(), packed, pspTagHandler, oeTagHandler, options, &job.info)) : (pack_executable(file.data(), file.size(), packed, pspTagHandler, oeTagHandler, options, &job.info));
+    
+    if (job.error != NO_ERROR)
     {
-        switch (type)
+        // files picked up from a directory walk are allowed to be anything
+        if (job.input.discovered && (job.error == ERROR_NOT_PRX || job.error == ERROR_ALREADY_PACKED))
         {
-            default:
-            case EXECUTABLE_TYPE_USER_PRX:
-                return 0x457B06F0;
-            case EXECUTABLE_TYPE_KERNEL_PRX:
-                return 0xDADADAF0;
-            case EXECUTABLE_TYPE_PBP:
-                return 0xADF305F0;
+            job.status = JOB_SKIPPED;
+            return;
         }
-    };
- 
-    TagHandler oeTagHandler = [](ExecutableType type) -> unsigned int
+        
+        char message[256];
+        std::snprintf(message, sizeof(message), "Error 0x%08X packing executable %s.", job.error, filename);
+        job.status = JOB_FAILED;
+        job.message = message;
+        return;
+    }
+    
+    PhaseTimer writeTimer(job.info.times, PHASE_WRITE);
+    job.packedSize = packed.size();
+    
+    if (piped)
     {
-        switch (type)
+        // the segments point into both, so they go along with the write. the
+        // job is only finished once it lands, and the time here is just how
+        // long the pipeline held this worker back.
+        auto owner = std::make_shared<std::pair<ModuleBuffer, PackedExec>>(std::move(buffer), std::move(packed));
+        auto jobp = &job;
+        
+        io->write(job.input.path, owner->second.segments, owner, [jobp](bool ok)
         {
-            default:
-            case EXECUTABLE_TYPE_USER_PRX:
-                return 0x8555ABF2;
-            case EXECUTABLE_TYPE_KERNEL_PRX:
-                return 0x55668D96;
-            case EXECUTABLE_TYPE_PBP:
-                return 0x7316308C;
+            jobp->status = (ok) ? (JOB_PACKED) : (JOB_FAILED);
+            
+            if (!ok)
+            {
+                jobp->message = std::string("could not write file: \"") + jobp->input.path + "\".";
+            }
+        });
+        
+        return;
+    }
+    
+    if (!writeFileAtomic(filename, packed.segments, &file))
+    {
+        job.status = JOB_FAILED;
+        job.message = std::string("could not write file: \"") + filename + "\".";
+        return;
+    }
+    
+    job.status = JOB_PACKED;
+}
+
+// the image's modules are packed on the pool and come back as jobs of their
+// own, named "<image>:<path inside>"
+void packImage(PackJob& job, ThreadPool& pool, const TagHandler& pspTagHandler, const TagHandler& oeTagHandler, const PackOptions& options, std::ostream& log, std::vector<PackJob>& modules)
+{
+    TraceSpan span("image", "file");
+    span.arg("file", job.input.path);
+    
+    ImageResult result;
+    job.error = pack_image(job.input.path, pool, pspTagHandler, oeTagHandler, options, result);
+    
+    if (job.error != NO_ERROR)
+    {
+        if (job.input.discovered && job.error == ERROR_BAD_IMAGE)
+        {
+            job.status = JOB_SKIPPED;
         }
-    };
+        else
+        {
+            char message[256];
+            std::snprintf(message, sizeof(message), "Error 0x%08X packing image %s.", job.error, job.input.path.c_str());
+            job.status = JOB_FAILED;
+            job.message = message;
+        }
+        
+        modules.push_back(job);
+        return;
+    }
+    
+    auto packed = 0u, moved = 0u;
     
-    if (argc != 2 && argc != 5)
+    for (auto& module : result.modules)
     {
-        usage();
-        return 0;
+        PackJob moduleJob;
+        moduleJob.input = { job.input.path + ":" + module.path, module.inputSize, true };
+        moduleJob.error = module.error;
+        moduleJob.packedSize = module.packedSize;
+        moduleJob.info = module.info;
+        moduleJob.times = module.times;
+        moduleJob.info.times = nullptr;
+        moduleJob.status = (module.error == NO_ERROR) ? (JOB_PACKED) : ((module.skipped) ? (JOB_SKIPPED) : (JOB_FAILED));
+        
+        if (moduleJob.status == JOB_FAILED)
+        {
+            char message[256];
+            std::snprintf(message, sizeof(message), "Error 0x%08X packing executable %s.", module.error, moduleJob.input.path.c_str());
+            moduleJob.message = message;
+        }
+        
+        packed += (module.error == NO_ERROR);
+        moved += module.relocated;
+        modules.push_back(moduleJob);
+    }
+    
+    log << "packed image " << job.input.path << " (" << result.inputSize << " -> " << result.outputSize << " bytes, " << packed << " modules";
+    
+    if (moved)
+    {
+        log << ", " << moved << " moved to the end";
     }
     
-    // check if no options mode
-    if (argc == 2)
+    log << ")" << std::endl;
+}
+
+void unpackFile(PackJob& job)
+{
+    auto filename = job.input.path.c_str();
+    MappedFile file;
+    
+    if (!file.open(filename))
     {
-        filename = argv[1];
+        job.status = JOB_FAILED;
+        job.message = std::string("could not open file: \"") + filename + "\".";
+        return;
     }
-    // check if specified tags
-    else if (argc == 5 && std::strcmp(argv[1], "-s") == 0)
+    
+    PackedExec unpacked;
+    job.error = unpack_executable(file.data(), file.size(), unpacked);
+    
+    if (job.error != NO_ERROR)
     {
-        filename = argv[4];
+        if (job.input.discovered && job.error == ERROR_NOT_PACKED)
+        {
+            job.status = JOB_SKIPPED;
+            return;
+        }
         
-        auto psptag = strtoul(argv[2], NULL, 0);
-        auto oetag = strtoul(argv[3], NULL, 0);
+        char message[256];
+        std::snprintf(message, sizeof(message), "Error 0x%08X unpacking executable %s.", job.error, filename);
+        job.status = JOB_FAILED;
+        job.message = message;
+        return;
+    }
+    
+    if (!writeFileAtomic(filename, unpacked.segments, &file))
+    {
+        job.status = JOB_FAILED;
+        job.message = std::string("could not write file: \"") + filename + "\".";
+        return;
+    }
+    
+    job.status = JOB_PACKED;
+    job.packedSize = unpacked.size();
+}
+
+void verifyFile(PackJob& job)
+{
+    auto filename = job.input.path.c_str();
+    MappedFile file;
+    
+    if (!file.open(filename))
+    {
+        job.status = JOB_FAILED;
+        job.message = std::string("could not open file: \"") + filename + "\".";
+        return;
+    }
+    
+    job.error = verify_packed_executable(file.data(), file.size());
+    
+    if (job.error != NO_ERROR)
+    {
+        if (job.input.discovered && job.error == ERROR_NOT_PACKED)
+        {
+            job.status = JOB_SKIPPED;
+            return;
+        }
+        
+        char message[256];
+        std::snprintf(message, sizeof(message), "Error 0x%08X verifying executable %s.", job.error, filename);
+        job.status = JOB_FAILED;
+        job.message = message;
+        return;
+    }
+    
+    job.status = JOB_PACKED;
+    job.packedSize = file.size();
+}
+
+void estimateFile(PackJob& job, const TagHandler& pspTagHandler, const TagHandler& oeTagHandler, const PackOptions& options)
+{
+    auto filename = job.input.path.c_str();
+    MappedFile file;
+    PhaseTimer readTimer(job.info.times, PHASE_READ);
+    
+    if (!file.open(filename))
+    {
+        job.status = JOB_FAILED;
+        job.message = std::string("could not open file: \"") + filename + "\".";
+        return;
+    }
+    
+    readTimer.stop();
+    
+    // the mapping is private, so the module info is only patched in memory
+    job.error = estimate_executable(file.data(), file.size(), job.estimate, pspTagHandler, oeTagHandler, options, &job.info);
+    
+    if (job.error != NO_ERROR)
+    {
+        if (job.input.discovered && (job.error == ERROR_NOT_PRX || job.error == ERROR_ALREADY_PACKED))
+        {
+            job.status = JOB_SKIPPED;
+            return;
+        }
         
-        pspTagHandler = [=](ExecutableType type) -> unsigned int { return psptag; };
-        oeTagHandler = [=](ExecutableType type) -> unsigned int { return oetag; };
+        char message[256];
+        std::snprintf(message, sizeof(message), "Error 0x%08X estimating executable %s.", job.error, filename);
+        job.status = JOB_FAILED;
+        job.message = message;
+        return;
     }
     
-    // else is error
+    job.status = JOB_PACKED;
+    job.packedSize = (size_t)(job.estimate.size + 0.5);
+}
+
+// the server's defaults for everything a request doesn't set
+ServeRequest clientRequest(const PackOptions& options, bool useTags, unsigned int pspTag, unsigned int oeTag)
+{
+    ServeRequest request;
+    request.useTags = useTags;
+    request.pspTag = pspTag;
+    request.oeTag = oeTag;
+    request.params = options.params;
+    request.compressThreads = options.compressThreads;
+    request.verify = options.verify;
+    request.searchParams = options.searchParams;
+    request.strip = options.strip;
+    request.reproducible = options.reproducible;
+    request.seed = options.seed;
+    request.budget = options.budget;
+    return request;
+}
+
+// send a job, reconnecting once in case the server dropped an idle connection
+bool sendClientJob(PackClient& client, const std::string& socketPath, const ServeRequest& request, ServeResult& result)
+{
+    for (int attempt = 0; attempt < 2; ++attempt)
+    {
+        if ((client.connected() || client.connect(socketPath)) && client.pack(request, result))
+        {
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+void clientPackFile(PackJob& job, const std::string& socketPath, ServeRequest request)
+{
+    // one connection per pool thread, kept for the whole batch
+    thread_local PackClient client;
+    
+    // the server doesn't share our working directory
+#ifndef _WIN32
+    std::unique_ptr<char, decltype(&free)> absolute(realpath(job.input.path.c_str(), nullptr), &free);
+    request.path = (absolute) ? (absolute.get()) : (job.input.path);
+#else
+    request.path = job.input.path;
+#endif
+    
+    ServeResult result;
+    
+    if (!sendClientJob(client, socketPath, request, result))
+    {
+        job.status = JOB_FAILED;
+        job.message = "could not reach server on \"" + socketPath + "\".";
+        return;
+    }
+    
+    job.error = result.error;
+    job.info = result.info;
+    job.times = result.times;
+    job.info.times = &job.times;
+    
+    if (job.error == NO_ERROR)
+    {
+        job.status = JOB_PACKED;
+        job.packedSize = result.packedSize;
+    }
+    else if (job.input.discovered && (job.error == ERROR_NOT_PRX || job.error == ERROR_ALREADY_PACKED))
+    {
+        job.status = JOB_SKIPPED;
+    }
     else
     {
-        usage();
-        return 0;
+        job.status = JOB_FAILED;
+        job.message = result.message;
     }
+}
+
+int clientPackStream(const std::string& socketPath, ServeRequest request)
+{
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
     
-    std::ifstream file(filename, std::ios::binary);
+    char buffer[64 * 1024];
+    size_t read;
     
-    // check if file error
-    if (!file.is_open())
+    while ((read = std::fread(buffer, 1, sizeof(buffer), stdin)) > 0)
     {
-        std::cout << "could not open file: \"" << filename << "\"." << std::endl;
-        return 0;
+        request.data.insert(request.data.end(), buffer, buffer + read);
     }
     
-    // read file into buffer
-    ExecBuffer executable((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
-                 
-    file.close();
+    PackClient client;
+    ServeResult result;
+    
+    if (std::ferror(stdin))
+    {
+        std::fprintf(stderr, "Error 0x%08X packing executable from stdin.\n", ERROR_STREAM_READ);
+        return 1;
+    }
+    
+    if (request.data.size() > SERVE_MAX_INLINE)
+    {
+        std::cerr << "stdin is over the " << (SERVE_MAX_INLINE >> 20) << " MiB a client can send, pack it without --client." << std::endl;
+        return 1;
+    }
+    
+    if (!sendClientJob(client, socketPath, request, result))
+    {
+        std::cerr << "could not reach server on \"" << socketPath << "\"." << std::endl;
+        return 1;
+    }
+    
+    if (result.error != NO_ERROR)
+    {
+        std::fprintf(stderr, "Error 0x%08X packing executable from stdin.\n", result.error);
+        return 1;
+    }
+    
+    if (std::fwrite(result.data.data(), 1, result.data.size(), stdout) != result.data.size() || std::fflush(stdout) != 0)
+    {
+        std::fprintf(stderr, "Error 0x%08X packing executable from stdin.\n", ERROR_STREAM_WRITE);
+        return 1;
+    }
+    
+    return 0;
+}
+
+// the range the real size is likely in, eg. "likely 48210 to 49870 bytes",
+// or "exact" when nothing was predicted
+std::string describeEstimate(const SizeEstimate& estimate)
+{
+    if (estimate.exact)
+    {
+        return "exact";
+    }
+    
+    char text[96];
+    std::snprintf(text, sizeof(text), "likely %.0f to %.0f bytes", estimate.low, estimate.high);
+    return text;
+}
+
+// how the level was picked, eg. "level 6 for the budget, estimated 48.10% in
+// 12.3ms, got 47.95% in 11.0ms"
+std::string describeLevelChoice(const PackInfo& info)
+{
+    char text[128];
+    std::snprintf(text, sizeof(text), "level %d for the budget, estimated %.2f%% in %.1fms, got %.2f%% in %.1fms", 
+        info.estimate.level, info.estimate.ratio * 100.0, info.estimate.seconds * 1e3, 
+        (info.elfSize) ? (100.0 * info.compressedSize / info.elfSize) : (0.0), info.compressSeconds * 1e3);
+    return text;
+}
+
+void printStats(std::ostream& out, const PackJob& job)
+{
+    auto& info = job.info;
+    char line[256];
+    
+    std::snprintf(line, sizeof(line), "%s: %s, %zu -> %zu bytes (%.2f%%), decrypt mode 0x%02X, tags 0x%08X/0x%08X, ", 
+        job.input.path.c_str(), executable_type_name(info.type), info.elfSize, info.compressedSize, 
+        (info.elfSize) ? (100.0 * info.compressedSize / info.elfSize) : (0.0), info.decryptMode, info.tag, info.oeTag);
+    
+    out << line << describeGzipParams(info.params) << ((info.cacheHit) ? (", cached") : (""));
+    
+    if (info.strippedSize)
+    {
+        out << ", " << info.strippedSize << " bytes stripped";
+    }
+    
+    if (info.levelChosen)
+    {
+        out << ", " << describeLevelChoice(info);
+    }
+    
+    out << std::endl << " ";
+    
+    for (int phase = 0; phase < PHASE_COUNT; ++phase)
+    {
+        std::snprintf(line, sizeof(line), " %s %.2fms (cpu %.2fms)", phaseName((PackPhase)phase), job.times.wall[phase] * 1e3, job.times.cpu[phase] * 1e3);
+        out << line;
+    }
+    
+    out << std::endl;
+}
+
+void printJson(std::ostream& out, const PackJob& job, RunMode mode)
+{
+    static const char *statusNames[] = { "", "skipped", "failed" };
+    auto& info = job.info;
+    char tags[64];
+    
+    out << "{\"file\":" << jsonString(job.input.path) << ",\"status\":\"" << ((job.status == JOB_PACKED) ? (modeDone[mode]) : (statusNames[job.status])) << "\"";
+    
+    if (job.status == JOB_FAILED)
+    {
+        out << ",\"error\":" << job.error << ",\"message\":" << jsonString(job.message);
+    }
+    
+    if (job.status == JOB_PACKED && mode != MODE_PACK)
+    {
+        out << ",\"input_bytes\":" << job.input.size << ",\"output_bytes\":" << job.packedSize;
+    }
+    
+    if (job.status == JOB_PACKED && mode == MODE_ESTIMATE)
+    {
+        out << ",\"low_bytes\":" << (size_t)job.estimate.low << ",\"high_bytes\":" << (size_t)job.estimate.high << ",\"exact\":" << ((job.estimate.exact) ? ("true") : ("false"));
+    }
+    
+    if (job.status == JOB_PACKED && mode == MODE_PACK)
+    {
+        std::snprintf(tags, sizeof(tags), "\"tag\":\"0x%08X\",\"oe_tag\":\"0x%08X\"", info.tag, info.oeTag);
+        
+        out << ",\"type\":\"" << executable_type_name(info.type) << "\""
+            << ",\"input_bytes\":" << job.input.size
+            << ",\"elf_bytes\":" << info.elfSize
+            << ",\"stripped_bytes\":" << info.strippedSize
+            << ",\"compressed_bytes\":" << info.compressedSize
+            << ",\"output_bytes\":" << job.packedSize
+            << ",\"ratio\":" << ((info.elfSize) ? ((double)info.compressedSize / info.elfSize) : (0.0))
+            << ",\"decrypt_mode\":" << info.decryptMode
+            << "," << tags
+            << ",\"level\":" << info.params.level
+            << ",\"mem_level\":" << info.params.memLevel
+            << ",\"strategy\":" << info.params.strategy
+            << ",\"encoder\":" << jsonString(gzipEncoderName(info.params.encoder))
+            << ",\"cache_hit\":" << ((info.cacheHit) ? ("true") : ("false"));
+        
+        if (info.levelChosen)
+        {
+            out << ",\"estimated_ratio\":" << info.estimate.ratio
+                << ",\"estimated_seconds\":" << info.estimate.seconds
+                << ",\"compress_seconds\":" << info.compressSeconds;
+        }
+    }
+    
+    out << ",\"phases\":{";
+    
+    for (int phase = 0; phase < PHASE_COUNT; ++phase)
+    {
+        out << ((phase) ? (",") : ("")) << "\"" << phaseName((PackPhase)phase) << "\":{\"wall\":" << job.times.wall[phase] << ",\"cpu\":" << job.times.cpu[phase] << "}";
+    }
+    
+    out << "}}" << std::endl;
+}
+
+int packStream(const TagHandler& pspTagHandler, const TagHandler& oeTagHandler, const PackOptions& options)
+{
+    // these all need the whole packed module in memory
+    if (options.compressThreads != 0 || options.searchParams || options.verify || options.params.encoder != GZIP_ENCODER_ZLIB)
+    {
+        std::cerr << "-t, -c, --best and --optimal can't be used when streaming." << std::endl;
+        return 1;
+    }
     
-    int res = pack_executable(executable, pspTagHandler, oeTagHandler);
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    
+    auto res = pack_stream(stdin, stdout, pspTagHandler, oeTagHandler, options, nullptr);
     
     if (res != NO_ERROR)
     {
-        printf("Error 0x%08X packing executable %s.\n", res, filename);
-        return 0;
+        std::fprintf(stderr, "Error 0x%08X packing executable from stdin.\n", res);
+        return 1;
     }
     
-    std::ofstream ofile(filename, std::ios::binary);
-    ofile.write(executable.data(), executable.size());
     return 0;
 }
+
+int main(int argc, char *argv[])
+{
+    TagHandler pspTagHandler = default_psp_tag;
+    TagHandler oeTagHandler = default_oe_tag;
+    
+    std::vector<std::string> paths;
+    PackOptions options;
+    ParamsDatabase paramsDb;
+    std::string paramsPath;
+    PackCache cache;
+    std::string cachePath;
+    auto cacheSize = 512ull;
+    auto jobs = 0u;
+    auto recursive = false;
+    auto stats = false;
+    auto json = false;
+    std::string tracePath;
+    auto mode = MODE_PACK;
+    auto serve = false;
+    auto client = false;
+    auto images = false;
+    auto shutdown = false;
+    auto socketPath = default_server_socket();
+    auto useTags = false;
+    auto pspTag = 0u, oeTag = 0u;
+    
+    for (int i = 1; i < argc; ++i)
+    {
+        // check if specified tags
+        if (std::strcmp(argv[i], "-s") == 0 && i + 2 < argc)
+        {
+            auto psptag = strtoul(argv[i+1], NULL, 0);
+            auto oetag = strtoul(argv[i+2], NULL, 0);
+            
+            useTags = true;
+            pspTag = psptag;
+            oeTag = oetag;
+            pspTagHandler = [=](ExecutableType) -> unsigned int { return psptag; };
+            oeTagHandler = [=](ExecutableType) -> unsigned int { return oetag; };
+            i += 2;
+        }
+        else if (std::strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+        {
+            jobs = strtoul(argv[++i], NULL, 0);
+        }
+        else if (std::strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+        {
+            options.compressThreads = strtoul(argv[++i], NULL, 0);
+        }
+        else if (std::strcmp(argv[i], "-r") == 0)
+        {
+            recursive = true;
+        }
+        else if (std::strcmp(argv[i], "-c") == 0)
+        {
+            options.verify = true;
+        }
+        else if (std::strcmp(argv[i], "--best") == 0)
+        {
+            options.searchParams = true;
+        }
+        else if (std::strcmp(argv[i], "--optimal") == 0)
+        {
+            options.params.encoder = GZIP_ENCODER_OPTIMAL;
+        }
+        else if (std::strcmp(argv[i], "--strip") == 0)
+        {
+            options.strip = true;
+        }
+        else if (std::strcmp(argv[i], "--reproducible") == 0)
+        {
+            options.reproducible = true;
+        }
+        else if (std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+        {
+            char *end;
+            options.reproducible = true;
+            options.seed = strtoull(argv[++i], &end, 0);
+            
+            // a seed of 0 means one derived from the module, as --reproducible
+            if (*end != '\0' || options.seed == 0)
+            {
+                std::cerr << "--seed needs a number other than 0." << std::endl;
+                return 1;
+            }
+        }
+        else if (std::strcmp(argv[i], "--budget") == 0 && i + 1 < argc)
+        {
+            char *unit;
+            auto value = strtod(argv[++i], &unit);
+            
+            if (std::strcmp(unit, "MB/s") == 0)
+            {
+                options.budget.bytesPerSecond = value * 1e6;
+            }
+            else if (*unit == '\0' || std::strcmp(unit, "ms") == 0)
+            {
+                options.budget.seconds = value / 1e3;
+            }
+            else
+            {
+                usage();
+                return 1;
+            }
+        }
+        else if (std::strcmp(argv[i], "--ratio") == 0 && i + 1 < argc)
+        {
+            options.budget.ratio = strtod(argv[++i], NULL);
+        }
+        else if (std::strcmp(argv[i], "--params") == 0 && i + 1 < argc)
+        {
+            paramsPath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--cache") == 0 && i + 1 < argc)
+        {
+            cachePath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--cache-size") == 0 && i + 1 < argc)
+        {
+            cacheSize = strtoull(argv[++i], NULL, 0);
+        }
+        else if (std::strcmp(argv[i], "--unpack") == 0)
+        {
+            mode = MODE_UNPACK;
+        }
+        else if (std::strcmp(argv[i], "--verify") == 0)
+        {
+            mode = MODE_VERIFY;
+        }
+        else if (std::strcmp(argv[i], "--estimate") == 0)
+        {
+            mode = MODE_ESTIMATE;
+        }
+        else if (std::strcmp(argv[i], "--iso") == 0)
+        {
+            images = true;
+        }
+        else if (std::strcmp(argv[i], "--serve") == 0)
+        {
+            serve = true;
+        }
+        else if (std::strcmp(argv[i], "--client") == 0)
+        {
+            client = true;
+        }
+        else if (std::strcmp(argv[i], "--socket") == 0 && i + 1 < argc)
+        {
+            socketPath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--shutdown") == 0)
+        {
+            shutdown = true;
+        }
+        else if (std::strcmp(argv[i], "--stats") == 0)
+        {
+            stats = true;
+        }
+        else if (std::strcmp(argv[i], "--json") == 0)
+        {
+            json = true;
+        }
+        else if (std::strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+        {
+            tracePath = argv[++i];
+        }
+        else if (argv[i][0] == '-' && argv[i][1] != '\0')
+        {
+            usage();
+            return 1;
+        }
+        else
+        {
+            paths.push_back(argv[i]);
+        }
+    }
+    
+    if (shutdown)
+    {
+        PackClient server;
+        
+        if (!server.connect(socketPath) || !server.shutdown())
+        {
+            std::cerr << "could not reach server on \"" << socketPath << "\"." << std::endl;
+            return 1;
+        }
+        
+        return 0;
+    }
+    
+    // the server runs its own jobs, and the cache and parameters are its own
+    if ((serve && (client || !paths.empty() || mode != MODE_PACK || !tracePath.empty())) || (client && (mode != MODE_PACK || !paramsPath.empty() || !cachePath.empty())) || (images && (serve || client || mode != MODE_PACK)))
+    {
+        usage();
+        return 1;
+    }
+    
+    if (paths.empty() && !serve)
+    {
+        usage();
+        return 0;
+    }
+    
+    // the search and the level chooser only cover zlib's parameters, and
+    // they would both pick the level
+    if (((options.searchParams || options.budget.active()) && options.params.encoder != GZIP_ENCODER_ZLIB) || (options.searchParams && options.budget.active()))
+    {
+        usage();
+        return 1;
+    }
+    
+    // stdout is the packed output, so it has to be the only one
+    if (std::find(paths.begin(), paths.end(), "-") != paths.end())
+    {
+        if (paths.size() != 1 || mode != MODE_PACK || images || !tracePath.empty())
+        {
+            usage();
+            return 1;
+        }
+        
+        if (client)
+        {
+            return clientPackStream(socketPath, clientRequest(options, useTags, pspTag, oeTag));
+        }
+        
+        return packStream(pspTagHandler, oeTagHandler, options);
+    }
+    
+    if (!paramsPath.empty())
+    {
+        paramsDb.load(paramsPath);
+        options.paramsDb = &paramsDb;
+    }
+    
+    // stdout is kept for the JSON lines, if there are any
+    std::ostream& log = (json) ? (std::cerr) : (std::cout);
+    
+    if (!cachePath.empty())
+    {
+        if (!cache.open(cachePath, cacheSize * 1024 * 1024))
+        {
+            log << "could not open cache: \"" << cachePath << "\"." << std::endl;
+            return 1;
+        }
+        
+        options.cache = &cache;
+    }
+    
+    if (serve)
+    {
+        ServerOptions serverOptions;
+        serverOptions.socketPath = socketPath;
+        serverOptions.workers = jobs;
+        serverOptions.paramsDb = options.paramsDb;
+        serverOptions.cache = options.cache;
+        
+        auto ok = run_pack_server(serverOptions, std::cerr);
+        
+        if (!paramsDb.save())
+        {
+            std::cerr << "could not write file: \"" << paramsPath << "\"." << std::endl;
+        }
+        
+        if (options.cache != nullptr)
+        {
+            cache.trim();
+            std::cerr << "cache: " << cache.hits() << " hits, " << cache.misses() << " misses, " << cache.evictions() << " evicted." << std::endl;
+        }
+        
+        return (ok) ? (0) : (1);
+    }
+    
+    // everything from here on goes on the timeline
+    if (!tracePath.empty())
+    {
+        traceStart();
+        traceThreadName("main");
+    }
+    
+    std::vector<InputFile> files;
+    std::vector<std::string> errors;
+    TraceSpan findSpan("find files", "main");
+    expandInputPaths(paths, recursive, files, errors);
+    findSpan.stop();
+    
+    for (auto& error : errors)
+    {
+        log << error << std::endl;
+    }
+    
+    // only talk about every file when there is more than one of them
+    auto batch = (files.size() > 1 || recursive || images);
+    
+    std::vector<PackJob> packJobs(files.size());
+    std::vector<PackJob *> schedule;
+    
+    for (auto i = 0u; i < files.size(); ++i)
+    {
+        packJobs[i] = { files[i], JOB_FAILED, NO_ERROR, 0, std::string(), PackInfo(), PhaseTimes(), SizeEstimate() };
+        
+        if (stats || json)
+        {
+            packJobs[i].info.times = &packJobs[i].times;
+        }
+        
+        schedule.push_back(&packJobs[i]);
+    }
+    
+    // largest files first so a big EBOOT doesn't end up as the straggler
+    std::stable_sort(schedule.begin(), schedule.end(), [](const PackJob *a, const PackJob *b)
+    {
+        return a->input.size > b->input.size;
+    });
+    
+    if (!batch || jobs == 1)
+    {
+        jobs = 1;
+    }
+    
+    if (jobs == 0)
+    {
+        jobs = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    
+    // under make -j every thread past this one needs a token from make
+    Jobserver jobserver;
+    jobserver.open(std::getenv("MAKEFLAGS"));
+    
+    // files and compression blocks share one pool. images are done one at a
+    // time with their modules on the pool.
+    auto workers = (images) ? ((size_t)jobs) : (std::min<size_t>(jobs, schedule.size()));
+    ThreadPool pool(std::max<size_t>({ workers, options.compressThreads, 1 }), (jobserver.connected()) ? (&jobserver) : (nullptr));
+    options.pool = &pool;
+    
+    auto request = clientRequest(options, useTags, pspTag, oeTag);
+    
+    // a batch of files is read ahead of the workers and written behind them
+    std::unique_ptr<IoPipeline> pipeline;
+    
+    if (mode == MODE_PACK && batch && !client && !images)
+    {
+        std::vector<std::string> order;
+        
+        for (auto job : schedule)
+        {
+            order.push_back(job->input.path);
+        }
+        
+        pipeline.reset(new IoPipeline(IO_PIPELINE_BYTES));
+        pipeline->prefetch(order);
+    }
+    
+    if (images)
+    {
+        std::vector<PackJob> moduleJobs;
+        
+        for (auto job : schedule)
+        {
+            packImage(*job, pool, pspTagHandler, oeTagHandler, options, log, moduleJobs);
+        }
+        
+        packJobs.swap(moduleJobs);
+        schedule.clear();
+    }
+    
+    for (auto job : schedule)
+    {
+        pool.submit([=, &pspTagHandler, &oeTagHandler, &options, &request, &socketPath, &pipeline]()
+        {
+            TraceSpan span(modeSpan[mode], "file");
+            span.arg("file", job->input.path);
+            span.arg("input_bytes", job->input.size);
+            
+            // one file running out of memory mustn't take the batch with it
+            try
+            {
+                switch (mode)
+                {
+                    case MODE_PACK:
+                        if (client)
+                        {
+                            clientPackFile(*job, socketPath, request);
+                        }
+                        else
+                        {
+                            packFile(*job, pspTagHandler, oeTagHandler, options, pipeline.get());
+                        }
+                        break;
+                    case MODE_UNPACK:
+                        unpackFile(*job);
+                        break;
+                    case MODE_VERIFY:
+                        verifyFile(*job);
+                        break;
+                    case MODE_ESTIMATE:
+                        estimateFile(*job, pspTagHandler, oeTagHandler, options);
+                        break;
+                }
+            }
+            catch (const std::bad_alloc&)
+            {
+                job->status = JOB_FAILED;
+                job->error = ERROR_OUT_OF_MEMORY;
+                job->message = std::string("out of memory on file: \"") + job->input.path + "\".";
+            }
+            catch (...)
+            {
+                job->status = JOB_FAILED;
+                job->error = ERROR_INTERNAL;
+                job->message = std::string("internal error on file: \"") + job->input.path + "\".";
+            }
+            
+            span.arg("output_bytes", job->packedSize);
+        });
+    }
+    
+    pool.wait();
+    
+    if (pipeline)
+    {
+        pipeline->flush();
+    }
+    
+    if (!paramsDb.save())
+    {
+        log << "could not write file: \"" << paramsPath << "\"." << std::endl;
+    }
+    
+    auto packed = 0u, skipped = 0u, failed = (unsigned int)errors.size();
+    
+    for (auto& job : packJobs)
+    {
+        switch (job.status)
+        {
+            case JOB_PACKED:
+                ++packed;
+                
+                if (batch || mode == MODE_ESTIMATE || job.info.paramsSearched || job.info.paramsReused || job.info.cacheHit || job.info.strippedSize || job.info.levelChosen)
+                {
+                    log << modeDone[mode] << " " << job.input.path;
+                    
+                    if (mode == MODE_VERIFY)
+                    {
+                        log << std::endl;
+                        break;
+                    }
+                    
+                    log << " (" << job.input.size << " -> " << job.packedSize << " bytes";
+                    
+                    if (mode == MODE_ESTIMATE)
+                    {
+                        log << ", " << describeEstimate(job.estimate);
+                    }
+                    
+                    if (job.info.paramsSearched || job.info.paramsReused)
+                    {
+                        log << ", " << describeGzipParams(job.info.params) << (job.info.paramsReused ? ", reused" : "");
+                    }
+                    
+                    if (job.info.cacheHit)
+                    {
+                        log << ", cached";
+                    }
+                    
+                    // nothing was compressed to compare the estimate against
+                    if (job.info.levelChosen && mode == MODE_ESTIMATE)
+                    {
+                        log << ", level " << job.info.estimate.level << " for the budget";
+                    }
+                    else if (job.info.levelChosen)
+                    {
+                        log << ", " << describeLevelChoice(job.info);
+                    }
+                    
+                    if (job.info.strippedSize)
+                    {
+                        log << ", " << job.info.strippedSize << " bytes stripped";
+                    }
+                    
+                    log << ")" << std::endl;
+                }
+                break;
+                
+            case JOB_SKIPPED:
+                ++skipped;
+                break;
+                
+            case JOB_FAILED:
+                ++failed;
+                log << job.message << std::endl;
+                break;
+        }
+        
+        if (json)
+        {
+            printJson(std::cout, job, mode);
+        }
+        else if (stats && job.status == JOB_PACKED && mode == MODE_PACK)
+        {
+            printStats(std::cout, job);
+        }
+    }
+    
+    if (batch)
+    {
+        log << packed << " " << modeDone[mode] << ", " << skipped << " skipped, " << failed << " failed." << std::endl;
+    }
+    
+    // once every thread has a buffer and deflate state of its own these stop
+    // growing, however many more files there are
+    if (batch && (stats || json))
+    {
+        auto& buffers = sharedBufferPool();
+        log << "buffers: " << buffers.allocations() << " allocated, " << buffers.reuses() << " reused, " << gzipHeapAllocations() << " for zlib." << std::endl;
+    }
+    
+    if (options.cache != nullptr)
+    {
+        cache.trim();
+        log << "cache: " << cache.hits() << " hits, " << cache.misses() << " misses, " << cache.evictions() << " evicted." << std::endl;
+    }
+    
+    if (!tracePath.empty() && !traceWrite(tracePath))
+    {
+        log << "could not write file: \"" << tracePath << "\"." << std::endl;
+        ++failed;
+    }
+    
+    return (failed != 0) ? (1) : (0);
+}
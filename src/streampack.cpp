@@ -0,0 +1,256 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#include "streampack.h"
+
+#include "psp.h"
+#include "parallelgzip.h"
+#include "elfstrip.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <memory>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#endif
+
+// bytes of compressed output or PSAR held at once
+#define STREAM_BUFFER_SIZE  (256 * 1024)
+
+namespace
+{
+    int writeSink(void *opaque, const void *data, u32 size)
+    {
+        return (std::fwrite(data, 1, size, (std::FILE *)opaque) == size) ? (0) : (-1);
+    }
+    
+    int countSink(void *, const void *, u32)
+    {
+        return 0;
+    }
+    
+    bool writeAll(std::FILE *output, const void *data, size_t size)
+    {
+        return std::fwrite(data, 1, size, output) == size;
+    }
+    
+    // append to 'buffer' until the end of the input or 'limit' bytes. the
+    // buffer grows as data arrives, so a bogus size can't allocate up front.
+    bool readUpTo(std::FILE *input, ModuleBuffer& buffer, size_t limit)
+    {
+        auto used = buffer.size();
+        
+        while (used < limit)
+        {
+            buffer.resize(std::min(std::max<size_t>(used * 2, STREAM_BUFFER_SIZE), limit));
+            used += std::fread(buffer.data() + used, 1, buffer.size() - used, input);
+            
+            if (used < buffer.size())
+            {
+                break;
+            }
+        }
+        
+        buffer.resize(used);
+        return !std::ferror(input);
+    }
+    
+    // whether we can come back later and rewrite the headers
+    bool canPatch(std::FILE *output, std::fpos_t& position)
+    {
+#ifndef _WIN32
+        struct stat st;
+        auto fd = fileno(output);
+        
+        // appending ignores the position, and devices may pretend to seek
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || (fcntl(fd, F_GETFL) & O_APPEND) != 0)
+        {
+            return false;
+        }
+#endif
+        return std::fgetpos(output, &position) == 0;
+    }
+}
+
+int pack_stream(std::FILE *input, std::FILE *output, TagHandler psptagHandler, TagHandler oetagHandler, const PackOptions& options, size_t *packedSize)
+{
+    ModuleBuffer executable;
+    
+    // the PBP header says how much has to be in memory, a PRX is all ELF
+    if (!readUpTo(input, executable, sizeof(PbpHeader)))
+    {
+        return ERROR_STREAM_READ;
+    }
+    
+    auto isPbp = (executable.size() == sizeof(PbpHeader) && ((PbpHeader *)executable.data())->magic == PBP_HEADER_MAGIC);
+    auto limit = (isPbp) ? ((size_t)((PbpHeader *)executable.data())->psar_offset) : ((size_t)INT_MAX);
+    
+    if (!readUpTo(input, executable, limit))
+    {
+        return ERROR_STREAM_READ;
+    }
+    
+    // a PBP cut short before its PSAR fails the bounds checks here
+    PreparedExec prepared;
+    auto res = prepare_executable(executable.data(), executable.size(), prepared, psptagHandler, oetagHandler);
+    
+    if (res != NO_ERROR)
+    {
+        return res;
+    }
+    
+    const char *module = executable.data() + prepared.offset;
+    auto moduleSize = (u32)prepared.size;
+    ExecBuffer stripped;
+    
+    if (options.strip && !strip_prepared_elf(prepared, module, moduleSize, stripped))
+    {
+        return ERROR_NOT_PRX;
+    }
+    
+    auto seed = key_data_seed(prepared, module, moduleSize, options);
+    auto params = options.params;
+    LevelEstimate estimate;
+    
+    if (options.budget.active() && chooseGzipLevel(module, moduleSize, params, options.budget, 0, estimate))
+    {
+        params.level = estimate.level;
+    }
+    
+    std::unique_ptr<char[]> buffer(new char[STREAM_BUFFER_SIZE]);
+    auto ctx = gzipThreadContext();
+    
+    if (ctx == nullptr)
+    {
+        return ERROR_GZIP_COMPRESSION;
+    }
+    
+    // everything in front of the compressed module
+    auto writeHeaders = [&](u32 compSize) -> bool
+    {
+        PSP_Header header = prepared.header;
+        finish_psp_header(header, compSize, seed);
+        
+        if (isPbp)
+        {
+            PbpHeader pbp;
+            std::memcpy(&pbp, executable.data(), sizeof(PbpHeader));
+            pbp.psar_offset = prepared.offset + compSize + sizeof(PSP_Header);
+            
+            if (!writeAll(output, &pbp, sizeof(PbpHeader)) 
+            || !writeAll(output, executable.data() + sizeof(PbpHeader), prepared.offset - sizeof(PbpHeader)))
+            {
+                return false;
+            }
+        }
+        
+        return writeAll(output, &header, sizeof(PSP_Header));
+    };
+    
+    std::fpos_t start, end;
+    auto patch = canPatch(output, start);
+    auto compSize = 0;
+    
+    // nowhere to go back to, so the sizes have to be known before writing
+    if (!patch)
+    {
+        compSize = gzipCompressStream(ctx, buffer.get(), STREAM_BUFFER_SIZE, module, moduleSize, &params, countSink, nullptr);
+        
+        if (compSize < 0)
+        {
+            return ERROR_GZIP_COMPRESSION;
+        }
+    }
+    
+    if (!writeHeaders(compSize))
+    {
+        return ERROR_STREAM_WRITE;
+    }
+    
+    auto written = gzipCompressStream(ctx, buffer.get(), STREAM_BUFFER_SIZE, module, moduleSize, &params, writeSink, output);
+    
+    if (written == -3)
+    {
+        return ERROR_STREAM_WRITE;
+    }
+    
+    // the second pass has to match what the headers already claim
+    if (written < 0 || (!patch && written != compSize))
+    {
+        return ERROR_GZIP_COMPRESSION;
+    }
+    
+    if (patch)
+    {
+        compSize = written;
+        
+        if (std::fgetpos(output, &end) != 0 || std::fsetpos(output, &start) != 0 
+        || !writeHeaders(compSize) || std::fsetpos(output, &end) != 0)
+        {
+            return ERROR_STREAM_WRITE;
+        }
+    }
+    
+    size_t total = prepared.offset + sizeof(PSP_Header) + compSize;
+    
+    // the PSAR is whatever is left
+    while (isPbp)
+    {
+        auto count = std::fread(buffer.get(), 1, STREAM_BUFFER_SIZE, input);
+        
+        if (count != 0 && !writeAll(output, buffer.get(), count))
+        {
+            return ERROR_STREAM_WRITE;
+        }
+        
+        total += count;
+        
+        if (count < STREAM_BUFFER_SIZE)
+        {
+            break;
+        }
+    }
+    
+    if (std::ferror(input))
+    {
+        return ERROR_STREAM_READ;
+    }
+    
+    if (std::fflush(output) != 0)
+    {
+        return ERROR_STREAM_WRITE;
+    }
+    
+    if (packedSize != nullptr)
+    {
+        *packedSize = total;
+    }
+    
+    return NO_ERROR;
+}
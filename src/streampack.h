@@ -0,0 +1,41 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#ifndef STREAMPACK_H_
+#define STREAMPACK_H_
+
+#include <cstdio>
+
+#include "packexec.h"
+
+// pack an executable read from 'input' to 'output', neither of which has to
+// be seekable. only the PBP header, the data in front of the ELF and the ELF
+// are held in memory, a PSAR is forwarded in fixed size chunks. if 'output'
+// can seek the header sizes are patched once the module is written, otherwise
+// the module is compressed twice, the first time to measure it. only the
+// deflate parameters are taken from the options. 'packedSize' may be null.
+int pack_stream(std::FILE *input, std::FILE *output, TagHandler psptagHandler, TagHandler oetagHandler, const PackOptions& options, size_t *packedSize);
+
+#endif // STREAMPACK_H_
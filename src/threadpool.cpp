@@ -0,0 +1,315 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#include "threadpool.h"
+#include "jobserver.h"
+#include "tracelog.h"
+
+namespace
+{
+    // the pool and queue index owned by the calling thread, if any
+    thread_local ThreadPool *t_pool = nullptr;
+    thread_local unsigned int t_index = 0;
+}
+
+ThreadPool::ThreadPool(unsigned int threads, Jobserver *jobserver)
+    : m_nextQueue(0)
+    , m_jobserver(jobserver)
+    , m_queued(0)
+    , m_pending(0)
+    , m_stop(false)
+{
+    if (threads == 0)
+    {
+        threads = std::thread::hardware_concurrency();
+    }
+    
+    if (threads == 0)
+    {
+        threads = 1;
+    }
+    
+    for (auto i = 0u; i < threads; ++i)
+    {
+        m_queues.emplace_back(new WorkQueue);
+    }
+    
+    // queue 0 is serviced by whoever calls wait()
+    for (auto i = 1u; i < threads; ++i)
+    {
+        m_threads.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_stop = true;
+    }
+    
+    m_workAvailable.notify_all();
+    
+    for (auto& thread : m_threads)
+    {
+        thread.join();
+    }
+}
+
+void ThreadPool::submit(Task task)
+{
+    submit(std::move(task), nullptr);
+}
+
+void ThreadPool::submit(Task task, TaskGroup *group)
+{
+    // workers keep their own submissions local, everyone else round robins
+    auto local = (t_pool == this);
+    auto index = (local) ? (t_index) : (m_nextQueue++ % size());
+    auto& queue = *m_queues[index];
+    
+    // count the task before it becomes visible to other threads
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        ++m_pending;
+        ++m_queued;
+        
+        if (group)
+        {
+            ++group->m_pending;
+            ++group->m_queued;
+        }
+    }
+    
+    {
+        std::lock_guard<std::mutex> guard(queue.lock);
+        
+        // work fanned out by a running task goes first so the task that is
+        // waiting on it finishes as soon as possible
+        if (local)
+        {
+            queue.tasks.push_front({ std::move(task), group });
+        }
+        else
+        {
+            queue.tasks.push_back({ std::move(task), group });
+        }
+    }
+    
+    m_workAvailable.notify_one();
+    m_allDone.notify_all();
+}
+
+bool ThreadPool::takeTask(unsigned int index, QueuedTask& task, const TaskGroup *group)
+{
+    // own queue first, then steal from the others
+    for (auto i = 0u; i < size(); ++i)
+    {
+        auto& queue = *m_queues[(index + i) % size()];
+        std::lock_guard<std::mutex> guard(queue.lock);
+        
+        for (auto it = queue.tasks.begin(); it != queue.tasks.end(); ++it)
+        {
+            // when waiting on a group only that group's work is taken
+            if (group && it->group != group)
+            {
+                continue;
+            }
+            
+            task = std::move(*it);
+            queue.tasks.erase(it);
+            
+            std::lock_guard<std::mutex> poolGuard(m_lock);
+            --m_queued;
+            
+            if (task.group)
+            {
+                --task.group->m_queued;
+            }
+            
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+void ThreadPool::runTask(QueuedTask& task)
+{
+    std::exception_ptr error;
+    
+    // a failed task mustn't take the worker down with it, whoever waits on
+    // it gets the exception instead
+    try
+    {
+        task.task();
+    }
+    catch (...)
+    {
+        error = std::current_exception();
+    }
+    
+    task.task = nullptr;
+    
+    std::lock_guard<std::mutex> guard(m_lock);
+    
+    --m_pending;
+    
+    if (task.group)
+    {
+        --task.group->m_pending;
+    }
+    
+    auto& slot = (task.group) ? (task.group->m_error) : (m_error);
+    
+    if (error && !slot)
+    {
+        slot = error;
+    }
+    
+    m_allDone.notify_all();
+}
+
+void ThreadPool::workerLoop(unsigned int index)
+{
+    t_pool = this;
+    t_index = index;
+    traceThreadName("worker " + std::to_string(index));
+    
+    QueuedTask task;
+    auto holding = (m_jobserver == nullptr);
+    
+    while (true)
+    {
+        // only ask for a token once there is something to do with it, and
+        // keep asking so a stop isn't missed while make has none to spare
+        if (!holding)
+        {
+            {
+                std::unique_lock<std::mutex> lock(m_lock);
+                m_workAvailable.wait(lock, [this] { return m_stop || m_queued != 0; });
+                
+                if (m_stop)
+                {
+                    return;
+                }
+            }
+            
+            holding = m_jobserver->acquire(100);
+            continue;
+        }
+        
+        if (takeTask(index, task, nullptr))
+        {
+            runTask(task);
+            continue;
+        }
+        
+        if (m_jobserver != nullptr)
+        {
+            m_jobserver->release();
+            holding = false;
+            continue;
+        }
+        
+        std::unique_lock<std::mutex> lock(m_lock);
+        m_workAvailable.wait(lock, [this] { return m_stop || m_queued != 0; });
+        
+        if (m_stop)
+        {
+            return;
+        }
+    }
+}
+
+void ThreadPool::wait(void)
+{
+    wait(nullptr);
+    rethrow(m_error);
+}
+
+void ThreadPool::rethrow(std::exception_ptr& slot)
+{
+    std::exception_ptr error;
+    
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        error.swap(slot);
+    }
+    
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+void TaskGroup::wait(void)
+{
+    m_pool.wait(this);
+    m_pool.rethrow(m_error);
+}
+
+void ThreadPool::wait(const TaskGroup *group)
+{
+    auto prevPool = t_pool;
+    auto prevIndex = t_index;
+    
+    // a worker waiting on its own pool keeps its queue, others borrow queue 0
+    if (t_pool != this)
+    {
+        t_pool = this;
+        t_index = 0;
+    }
+    
+    QueuedTask task;
+    
+    while (true)
+    {
+        if (takeTask(t_index, task, group))
+        {
+            runTask(task);
+            continue;
+        }
+        
+        std::unique_lock<std::mutex> lock(m_lock);
+        
+        if (group)
+        {
+            m_allDone.wait(lock, [group] { return group->m_pending == 0 || group->m_queued != 0; });
+        }
+        else
+        {
+            m_allDone.wait(lock, [this] { return m_pending == 0 || m_queued != 0; });
+        }
+        
+        if ((group ? group->m_pending : m_pending) == 0)
+        {
+            break;
+        }
+    }
+    
+    t_pool = prevPool;
+    t_index = prevIndex;
+}
@@ -0,0 +1,139 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#ifndef THREADPOOL_H_
+#define THREADPOOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class TaskGroup;
+class Jobserver;
+
+// work stealing pool. every worker owns a queue and takes work from the
+// front of it, falling back to the front of the other queues when it runs
+// dry. callers that submit work in decreasing order of cost therefore get
+// largest-job-first scheduling across the whole pool.
+class ThreadPool
+{
+public:
+    using Task = std::function<void()>;
+    
+    // a pool of 'threads' workers in total, including the thread that calls
+    // wait(). zero picks the number of hardware threads. with a jobserver the
+    // workers only run tasks while they hold one of its tokens, and give it
+    // back as soon as they run out of work.
+    explicit ThreadPool(unsigned int threads = 0, Jobserver *jobserver = nullptr);
+    ~ThreadPool();
+    
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    
+    void submit(Task task);
+    
+    // run queued tasks on the calling thread until every submitted task has
+    // completed. the first exception a task outside any group threw is
+    // thrown again here.
+    void wait(void);
+    
+    unsigned int size(void) const { return (unsigned int)m_queues.size(); }
+    
+private:
+    friend class TaskGroup;
+    
+    struct QueuedTask
+    {
+        Task task;
+        TaskGroup *group;
+    };
+    
+    struct WorkQueue
+    {
+        std::mutex lock;
+        std::deque<QueuedTask> tasks;
+    };
+    
+    void submit(Task task, TaskGroup *group);
+    bool takeTask(unsigned int index, QueuedTask& task, const TaskGroup *group);
+    void runTask(QueuedTask& task);
+    void wait(const TaskGroup *group);
+    void rethrow(std::exception_ptr& slot);
+    void workerLoop(unsigned int index);
+    
+    std::vector<std::unique_ptr<WorkQueue>> m_queues;
+    std::vector<std::thread> m_threads;
+    
+    std::mutex m_lock;
+    std::condition_variable m_workAvailable;
+    std::condition_variable m_allDone;
+    
+    std::atomic<unsigned int> m_nextQueue;
+    
+    Jobserver *m_jobserver;
+    
+    // guarded by m_lock
+    unsigned int m_queued;
+    unsigned int m_pending;
+    bool m_stop;
+    std::exception_ptr m_error;
+};
+
+// a set of tasks on a pool that can be waited on separately from the rest of
+// the pool's work, so a task running on the pool can fan out and wait for its
+// own subtasks without deadlocking.
+class TaskGroup
+{
+public:
+    explicit TaskGroup(ThreadPool& pool) : m_pool(pool), m_pending(0), m_queued(0) {}
+    ~TaskGroup() { m_pool.wait(this); }
+    
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+    
+    void run(ThreadPool::Task task) { m_pool.submit(std::move(task), this); }
+    
+    // run this group's queued tasks on the calling thread until all of them
+    // have completed, then throw the first exception any of them threw.
+    void wait(void);
+    
+private:
+    friend class ThreadPool;
+    
+    ThreadPool& m_pool;
+    
+    // all guarded by the pool lock
+    unsigned int m_pending;
+    unsigned int m_queued;
+    std::exception_ptr m_error;
+};
+
+#endif // THREADPOOL_H_
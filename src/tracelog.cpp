@@ -0,0 +1,228 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#include "tracelog.h"
+
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+namespace
+{
+    struct TraceEvent
+    {
+        const char *name;
+        const char *category;
+        
+        // nonzero for spans that get a track of their own
+        unsigned long long id;
+        
+        // microseconds since traceStart()
+        long long start;
+        long long duration;
+        
+        std::string args;
+    };
+    
+    // one per thread that has recorded something. threads only ever append
+    // to their own, so the lock is just for traceWrite().
+    struct TraceThread
+    {
+        unsigned int id;
+        std::string name;
+        std::mutex lock;
+        std::vector<TraceEvent> events;
+    };
+    
+    std::atomic<bool> g_enabled(false);
+    std::chrono::steady_clock::time_point g_start;
+    
+    // kept past the end of their threads, so pool workers that are gone by
+    // the time the trace is written still show up
+    std::mutex g_threadsLock;
+    std::vector<std::shared_ptr<TraceThread>> g_threads;
+    
+    TraceThread& currentThread(void)
+    {
+        thread_local std::shared_ptr<TraceThread> thread;
+        
+        if (!thread)
+        {
+            thread = std::make_shared<TraceThread>();
+            
+            std::lock_guard<std::mutex> guard(g_threadsLock);
+            thread->id = (unsigned int)g_threads.size() + 1;
+            thread->name = "thread " + std::to_string(thread->id);
+            g_threads.push_back(thread);
+        }
+        
+        return *thread;
+    }
+    
+    long long sinceStart(std::chrono::steady_clock::time_point time)
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(time - g_start).count();
+    }
+}
+
+void traceStart(void)
+{
+    g_start = std::chrono::steady_clock::now();
+    g_enabled = true;
+}
+
+bool traceEnabled(void)
+{
+    return g_enabled.load(std::memory_order_relaxed);
+}
+
+void traceThreadName(const std::string& name)
+{
+    if (!traceEnabled())
+    {
+        return;
+    }
+    
+    auto& thread = currentThread();
+    std::lock_guard<std::mutex> guard(thread.lock);
+    thread.name = name;
+}
+
+bool traceWrite(const std::string& path)
+{
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    
+    if (!out)
+    {
+        return false;
+    }
+    
+    std::vector<std::shared_ptr<TraceThread>> threads;
+    
+    {
+        std::lock_guard<std::mutex> guard(g_threadsLock);
+        threads = g_threads;
+    }
+    
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" << std::endl;
+    out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"psp-packer\"}}";
+    
+    for (auto& thread : threads)
+    {
+        std::lock_guard<std::mutex> guard(thread->lock);
+        out << "," << std::endl << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread->id << ",\"args\":{\"name\":" << jsonString(thread->name) << "}}";
+        
+        for (auto& event : thread->events)
+        {
+            out << "," << std::endl << "{\"name\":\"" << event.name << "\",\"cat\":\"" << event.category << "\",\"pid\":1,\"tid\":" << thread->id << ",\"ts\":" << event.start;
+            
+            // overlapping spans are an async begin and end pair
+            if (event.id != 0)
+            {
+                out << ",\"ph\":\"b\",\"id\":" << event.id;
+            }
+            else
+            {
+                out << ",\"ph\":\"X\",\"dur\":" << event.duration;
+            }
+            
+            if (!event.args.empty())
+            {
+                out << ",\"args\":{" << event.args << "}";
+            }
+            
+            out << "}";
+            
+            if (event.id != 0)
+            {
+                out << "," << std::endl << "{\"name\":\"" << event.name << "\",\"cat\":\"" << event.category << "\",\"pid\":1,\"tid\":" << thread->id 
+                    << ",\"ts\":" << event.start + event.duration << ",\"ph\":\"e\",\"id\":" << event.id << "}";
+            }
+        }
+    }
+    
+    out << std::endl << "]}" << std::endl;
+    return out.good();
+}
+
+std::string jsonString(const std::string& text)
+{
+    std::ostringstream out;
+    out << '"';
+    
+    for (auto c : text)
+    {
+        if (c == '"' || c == '\\')
+        {
+            out << '\\' << c;
+        }
+        else if ((unsigned char)c < 0x20)
+        {
+            out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int)c << std::dec;
+        }
+        else
+        {
+            out << c;
+        }
+    }
+    
+    out << '"';
+    return out.str();
+}
+
+void TraceSpan::arg(const char *key, const std::string& value)
+{
+    if (m_active)
+    {
+        m_args += ((m_args.empty()) ? ("\"") : (",\"")) + std::string(key) + "\":" + jsonString(value);
+    }
+}
+
+void TraceSpan::arg(const char *key, unsigned long long value)
+{
+    if (m_active)
+    {
+        m_args += ((m_args.empty()) ? ("\"") : (",\"")) + std::string(key) + "\":" + std::to_string(value);
+    }
+}
+
+void TraceSpan::stop(void)
+{
+    if (!m_active)
+    {
+        return;
+    }
+    
+    auto end = std::chrono::steady_clock::now();
+    auto& thread = currentThread();
+    
+    std::lock_guard<std::mutex> guard(thread.lock);
+    thread.events.push_back({ m_name, m_category, m_id, sinceStart(m_start), sinceStart(end) - sinceStart(m_start), std::move(m_args) });
+    m_active = false;
+}
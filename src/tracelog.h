@@ -0,0 +1,88 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#ifndef TRACELOG_H_
+#define TRACELOG_H_
+
+#include <chrono>
+#include <string>
+
+// spans for a Chrome trace-event file, which Perfetto and chrome://tracing
+// both open. every thread that records anything gets a track of its own.
+// nothing is recorded until traceStart(), and until then a span costs a
+// single check.
+
+// start recording, with timestamps relative to now
+void traceStart(void);
+
+bool traceEnabled(void);
+
+// name the calling thread's track, "worker 3" for example
+void traceThreadName(const std::string& name);
+
+// write everything recorded so far as one JSON document
+bool traceWrite(const std::string& path);
+
+// text as a quoted JSON string
+std::string jsonString(const std::string& text);
+
+// records the time from construction until stop() or the end of the scope.
+// 'name' and 'category' have to outlive the trace, string literals do.
+class TraceSpan
+{
+public:
+    TraceSpan(const char *name, const char *category) : TraceSpan(name, category, 0) {}
+    
+    // spans that overlap others on the same thread, like I/O in flight, need
+    // an 'id' of their own
+    TraceSpan(const char *name, const char *category, unsigned long long id) : m_name(name), m_category(category), m_id(id), m_active(traceEnabled())
+    {
+        if (m_active)
+        {
+            m_start = std::chrono::steady_clock::now();
+        }
+    }
+    
+    ~TraceSpan() { stop(); }
+    
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+    
+    // shown with the span when it is selected
+    void arg(const char *key, const std::string& value);
+    void arg(const char *key, unsigned long long value);
+    
+    void stop(void);
+    
+private:
+    const char *m_name;
+    const char *m_category;
+    unsigned long long m_id;
+    bool m_active;
+    std::chrono::steady_clock::time_point m_start;
+    std::string m_args;
+};
+
+#endif // TRACELOG_H_
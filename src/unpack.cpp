@@ -0,0 +1,232 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#include "unpack.h"
+
+#include "elf.h"
+#include "psp.h"
+#include "gzip.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+
+// inflated bytes handled per step
+#define INFLATE_BUFFER_SIZE  (256 * 1024)
+
+// the most deflate can expand, a 258 byte match in under two bits. an
+// elf_size past comp_size times this is a lie, and isn't allocated.
+#define MAX_INFLATE_RATIO    (1032)
+
+namespace
+{
+    // where the packed module is and what its header claims
+    struct PackedModule
+    {
+        const PSP_Header *header;
+        size_t offset;
+        bool pbp;
+    };
+    
+    int findPackedModule(const char *packed, size_t size, PackedModule& module)
+    {
+        module.offset = 0;
+        module.pbp = false;
+        
+        if (size >= sizeof(PbpHeader) && ((const PbpHeader *)packed)->magic == PBP_HEADER_MAGIC)
+        {
+            auto pbp = (const PbpHeader *)packed;
+            
+            if (pbp->prx_offset < sizeof(PbpHeader) || pbp->psar_offset < pbp->prx_offset || pbp->psar_offset > size)
+            {
+                return ERROR_CORRUPT_PACKED;
+            }
+            
+            module.offset = pbp->prx_offset;
+            module.pbp = true;
+        }
+        
+        if (size - module.offset < sizeof(PSP_Header) || ((const PSP_Header *)(packed + module.offset))->signature != PSP_HEADER_MAGIC)
+        {
+            return ERROR_NOT_PACKED;
+        }
+        
+        auto header = (const PSP_Header *)(packed + module.offset);
+        module.header = header;
+        
+        // only gzip is ever written by us
+        if (header->comp_attribute != 1)
+        {
+            return ERROR_UNSUPPORTED_COMPRESSION;
+        }
+        
+        auto moduleSize = (module.pbp) ? (((const PbpHeader *)packed)->psar_offset - module.offset) : (size);
+        
+        if (header->comp_size <= 0 || header->elf_size < (int)sizeof(Elf32_Ehdr) 
+        || (u64)header->elf_size > (u64)header->comp_size * MAX_INFLATE_RATIO 
+        || header->psp_size != header->comp_size + (int)sizeof(PSP_Header) 
+        || (size_t)header->psp_size != moduleSize)
+        {
+            return ERROR_CORRUPT_PACKED;
+        }
+        
+        return NO_ERROR;
+    }
+    
+    struct UnpackState
+    {
+        char *data;
+        size_t size;
+        size_t used;
+    };
+    
+    int unpackSink(void *opaque, const void *data, u32 size)
+    {
+        auto state = (UnpackState *)opaque;
+        
+        // more than elf_size is as wrong as less
+        if (state->size - state->used < size)
+        {
+            return -1;
+        }
+        
+        std::memcpy(state->data + state->used, data, size);
+        state->used += size;
+        return 0;
+    }
+    
+    // the bits of the ELF verification cares about, picked out as they pass
+    struct VerifyState
+    {
+        size_t offset;
+        Elf32_Ehdr ehdr;
+        size_t modinfoOffset;
+        char modname[sizeof(((SceModuleInfo *)0)->modname)];
+    };
+    
+    // copy whatever part of [start, start+size) falls in this chunk
+    void capture(void *dest, size_t start, size_t size, const char *chunk, size_t chunkOffset, size_t chunkSize)
+    {
+        auto from = std::max(start, chunkOffset);
+        auto to = std::min(start + size, chunkOffset + chunkSize);
+        
+        if (from < to)
+        {
+            std::memcpy((char *)dest + (from - start), chunk + (from - chunkOffset), to - from);
+        }
+    }
+    
+    int verifySink(void *opaque, const void *data, u32 size)
+    {
+        auto state = (VerifyState *)opaque;
+        
+        capture(&state->ehdr, 0, sizeof(Elf32_Ehdr), (const char *)data, state->offset, size);
+        capture(state->modname, state->modinfoOffset + offsetof(SceModuleInfo, modname), sizeof(state->modname), (const char *)data, state->offset, size);
+        
+        state->offset += size;
+        return 0;
+    }
+}
+
+int unpack_executable(const char *packed, size_t size, PackedExec& output)
+{
+    PackedModule module;
+    auto res = findPackedModule(packed, size, module);
+    
+    if (res != NO_ERROR)
+    {
+        return res;
+    }
+    
+    auto header = module.header;
+    sharedBufferPool().take(output.module, header->elf_size);
+    UnpackState state = { output.module.data(), output.module.size(), 0 };
+    
+    std::unique_ptr<char[]> buffer(new char[INFLATE_BUFFER_SIZE]);
+    auto inflated = gzipDecompressStream(buffer.get(), INFLATE_BUFFER_SIZE, (const char *)header + sizeof(PSP_Header), header->comp_size, unpackSink, &state);
+    
+    if (inflated != header->elf_size)
+    {
+        return ERROR_CORRUPT_PACKED;
+    }
+    
+    output.segments.clear();
+    
+    if (module.pbp)
+    {
+        output.header.assign(packed, packed + sizeof(PbpHeader));
+        
+        auto pbp = (PbpHeader *)output.header.data();
+        auto psarOffset = pbp->psar_offset;
+        pbp->psar_offset = module.offset + header->elf_size;
+        
+        output.segments.push_back({ output.header.data(), output.header.size() });
+        output.segments.push_back({ packed + sizeof(PbpHeader), module.offset - sizeof(PbpHeader) });
+        output.segments.push_back({ output.module.data(), output.module.size() });
+        output.segments.push_back({ packed + psarOffset, size - psarOffset });
+    }
+    else
+    {
+        output.segments.push_back({ output.module.data(), output.module.size() });
+    }
+    
+    return NO_ERROR;
+}
+
+int verify_packed_executable(const char *packed, size_t size)
+{
+    PackedModule module;
+    auto res = findPackedModule(packed, size, module);
+    
+    if (res != NO_ERROR)
+    {
+        return res;
+    }
+    
+    auto header = module.header;
+    VerifyState state;
+    std::memset(&state, 0, sizeof(state));
+    state.modinfoOffset = header->modinfo_offset & 0x7FFFFFFF;
+    
+    std::unique_ptr<char[]> buffer(new char[INFLATE_BUFFER_SIZE]);
+    auto inflated = gzipDecompressStream(buffer.get(), INFLATE_BUFFER_SIZE, (const char *)header + sizeof(PSP_Header), header->comp_size, verifySink, &state);
+    
+    if (inflated != header->elf_size)
+    {
+        return ERROR_CORRUPT_PACKED;
+    }
+    
+    // the payload has to be the module the header was made from
+    if (state.ehdr.e_magic != ELF_MAGIC || state.ehdr.e_type != ELF_TYPE_PRX 
+    || state.ehdr.e_entry != header->entry 
+    || state.modinfoOffset + offsetof(SceModuleInfo, modname) + sizeof(state.modname) > (size_t)header->elf_size
+    || std::strncmp(state.modname, header->modname, sizeof(state.modname)) != 0)
+    {
+        return ERROR_CORRUPT_PACKED;
+    }
+    
+    return NO_ERROR;
+}
@@ -0,0 +1,44 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#ifndef UNPACK_H_
+#define UNPACK_H_
+
+#include <cstddef>
+
+#include "packexec.h"
+
+// inflate a ~PSP packed PRX or PBP back to a plain one, with the PBP's
+// psar_offset moved to follow the ELF. the module info keeps any attribute
+// bits packing set. output.module holds the ELF, the other segments point
+// into 'packed'.
+int unpack_executable(const char *packed, size_t size, PackedExec& output);
+
+// check that a packed executable's headers agree with each other and that
+// the payload inflates to the ELF they describe, with a bounded buffer
+// instead of the whole ELF
+int verify_packed_executable(const char *packed, size_t size);
+
+#endif // UNPACK_H_
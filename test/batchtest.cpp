@@ -0,0 +1,111 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#include "corpus.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+// packs a batch holding a symlink and a file with two hard links, and checks
+// the links are still what they were with the packed module behind them.
+// the batch goes through the I/O pipeline, a single file wouldn't.
+namespace
+{
+    bool isPacked(const std::string& path)
+    {
+        char magic[4] = {};
+        auto file = std::fopen(path.c_str(), "rb");
+        
+        if (file == nullptr)
+        {
+            return false;
+        }
+        
+        auto ok = std::fread(magic, 1, sizeof(magic), file) == sizeof(magic);
+        std::fclose(file);
+        return ok && std::memcmp(magic, "~PSP", 4) == 0;
+    }
+    
+    bool check(bool ok, const char *what)
+    {
+        std::printf("%s: %s\n", what, ok ? "ok" : "FAILED");
+        return ok;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        std::printf("usage: batch-test <psp-packer>\n");
+        return 1;
+    }
+    
+    char dir[] = "/tmp/psp-packer-batch-XXXXXX";
+    
+    if (mkdtemp(dir) == nullptr)
+    {
+        std::printf("could not make a directory\n");
+        return 1;
+    }
+    
+    auto base = std::string(dir);
+    auto target = base + "/target.prx", link = base + "/link.prx";
+    auto first = base + "/first.prx", second = base + "/second.prx";
+    auto plain = base + "/plain.prx";
+    
+    if (!writeCorpusFile(target, { "target", EXECUTABLE_TYPE_USER_PRX, 64 << 10, 2, 0, 1 })
+        || !writeCorpusFile(first, { "first", EXECUTABLE_TYPE_USER_PRX, 64 << 10, 2, 0, 2 })
+        || !writeCorpusFile(plain, { "plain", EXECUTABLE_TYPE_USER_PRX, 64 << 10, 2, 0, 3 })
+        || symlink("target.prx", link.c_str()) != 0
+        || ::link(first.c_str(), second.c_str()) != 0)
+    {
+        std::printf("could not write the inputs\n");
+        return 1;
+    }
+    
+    auto command = std::string(argv[1]) + " -j 2 " + link + " " + first + " " + plain;
+    auto ok = check(std::system(command.c_str()) == 0, "batch packed");
+    
+    struct stat linkStat, firstStat, secondStat;
+    ok &= check(lstat(link.c_str(), &linkStat) == 0 && S_ISLNK(linkStat.st_mode), "symlink kept");
+    ok &= check(isPacked(target), "symlink target packed");
+    ok &= check(stat(first.c_str(), &firstStat) == 0 && stat(second.c_str(), &secondStat) == 0 && firstStat.st_ino == secondStat.st_ino && firstStat.st_nlink == 2, "hard links kept together");
+    ok &= check(isPacked(second), "other hard link packed");
+    ok &= check(isPacked(plain), "plain file packed");
+    
+    for (auto& path : { link, target, first, second, plain })
+    {
+        unlink(path.c_str());
+    }
+    
+    rmdir(dir);
+    return ok ? 0 : 1;
+}
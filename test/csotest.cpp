@@ -0,0 +1,310 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#include "isoimage.h"
+#include "threadpool.h"
+#include "unpack.h"
+#include "testfiles.h"
+
+#include <zlib.h>
+
+#include <cstring>
+
+// builds a small ISO9660 image holding a PRX and a text file, packs it as
+// an ISO and as a CSO, and checks the module inside comes out packed and
+// unpacks to the original while the text file and the CSO framing survive.
+namespace
+{
+    const u32 SECTOR = 2048;
+    
+    void writeBoth32(char *p, u32 value)
+    {
+        for (int i = 0; i < 4; ++i)
+        {
+            p[i] = (char)(value >> (8 * i));
+            p[7 - i] = (char)(value >> (8 * i));
+        }
+    }
+    
+    u32 read32(const char *p)
+    {
+        return (u8)p[0] | ((u8)p[1] << 8) | ((u8)p[2] << 16) | ((u32)(u8)p[3] << 24);
+    }
+    
+    size_t addRecord(std::vector<char>& image, size_t offset, const char *name, size_t nameLength, u32 extent, u32 size, bool directory)
+    {
+        auto length = (33 + nameLength + 1) & ~(size_t)1;
+        auto record = image.data() + offset;
+        record[0] = (char)length;
+        writeBoth32(record + 2, extent);
+        writeBoth32(record + 10, size);
+        record[25] = (directory) ? (2) : (0);
+        record[32] = (char)nameLength;
+        std::memcpy(record + 33, name, nameLength);
+        return offset + length;
+    }
+    
+    // sectors 16 and 17 are the volume descriptors, 18 the root directory,
+    // then the two files
+    std::vector<char> buildIso(const std::vector<char>& module, const std::string& text)
+    {
+        auto sectors = [](size_t size) { return (u32)((size + SECTOR - 1) / SECTOR); };
+        u32 moduleExtent = 19, textExtent = moduleExtent + sectors(module.size());
+        auto total = textExtent + sectors(text.size());
+        std::vector<char> image((size_t)total * SECTOR, 0);
+        
+        auto pvd = image.data() + 16 * SECTOR;
+        pvd[0] = 1;
+        std::memcpy(pvd + 1, "CD001", 5);
+        pvd[6] = 1;
+        writeBoth32(pvd + 80, total);
+        addRecord(image, 16 * SECTOR + 156, "\0", 1, 18, SECTOR, true);
+        
+        auto end = image.data() + 17 * SECTOR;
+        end[0] = (char)255;
+        std::memcpy(end + 1, "CD001", 5);
+        end[6] = 1;
+        
+        auto offset = addRecord(image, 18 * SECTOR, "\0", 1, 18, SECTOR, true);
+        offset = addRecord(image, offset, "\1", 1, 18, SECTOR, true);
+        offset = addRecord(image, offset, "MODULE.PRX;1", 12, moduleExtent, (u32)module.size(), false);
+        addRecord(image, offset, "README.TXT;1", 12, textExtent, (u32)text.size(), false);
+        
+        std::memcpy(image.data() + (size_t)moduleExtent * SECTOR, module.data(), module.size());
+        std::memcpy(image.data() + (size_t)textExtent * SECTOR, text.data(), text.size());
+        return image;
+    }
+    
+    // the contents of a file in the root directory
+    bool findFile(const std::vector<char>& image, const char *name, std::vector<char>& data)
+    {
+        auto root = image.data() + 16 * SECTOR + 156;
+        auto start = (size_t)read32(root + 2) * SECTOR;
+        auto length = read32(root + 10);
+        
+        for (size_t offset = 0; offset < length && (u8)image[start + offset] != 0; offset += (u8)image[start + offset])
+        {
+            auto record = image.data() + start + offset;
+            
+            if ((u8)record[32] == std::strlen(name) && std::memcmp(record + 33, name, std::strlen(name)) == 0)
+            {
+                auto extent = (size_t)read32(record + 2) * SECTOR;
+                auto size = read32(record + 10);
+                
+                if (extent + size > image.size())
+                {
+                    return false;
+                }
+                
+                data.assign(image.data() + extent, image.data() + extent + size);
+                return true;
+            }
+        }
+        
+        return false;
+    }
+    
+    std::vector<char> writeCso(const std::vector<char>& image)
+    {
+        auto blocks = (u32)((image.size() + SECTOR - 1) / SECTOR);
+        std::vector<char> cso(0x18 + (blocks + 1) * 4, 0);
+        std::memcpy(cso.data(), "CISO", 4);
+        cso[4] = 0x18;
+        
+        u64 total = image.size();
+        std::memcpy(cso.data() + 8, &total, 8);
+        std::memcpy(cso.data() + 16, &SECTOR, 4);
+        cso[20] = 1;
+        
+        for (u32 block = 0; block < blocks; ++block)
+        {
+            std::vector<char> deflated(compressBound(SECTOR) + 16);
+            z_stream stream = {};
+            deflateInit2(&stream, 9, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+            stream.next_in = (Bytef *)image.data() + (size_t)block * SECTOR;
+            stream.avail_in = SECTOR;
+            stream.next_out = (Bytef *)deflated.data();
+            stream.avail_out = (uInt)deflated.size();
+            deflate(&stream, Z_FINISH);
+            deflateEnd(&stream);
+            
+            auto entry = (u32)cso.size();
+            
+            // blocks that don't shrink are stored plain
+            if (stream.total_out >= SECTOR)
+            {
+                entry |= 0x80000000;
+                cso.insert(cso.end(), image.data() + (size_t)block * SECTOR, image.data() + (size_t)(block + 1) * SECTOR);
+            }
+            else
+            {
+                cso.insert(cso.end(), deflated.data(), deflated.data() + stream.total_out);
+            }
+            
+            std::memcpy(cso.data() + 0x18 + block * 4, &entry, 4);
+        }
+        
+        auto end = (u32)cso.size();
+        std::memcpy(cso.data() + 0x18 + blocks * 4, &end, 4);
+        return cso;
+    }
+    
+    bool readCso(const std::vector<char>& cso, std::vector<char>& image)
+    {
+        if (cso.size() < 0x18 || std::memcmp(cso.data(), "CISO", 4) != 0)
+        {
+            return false;
+        }
+        
+        u64 total;
+        u32 blockSize;
+        std::memcpy(&total, cso.data() + 8, 8);
+        std::memcpy(&blockSize, cso.data() + 16, 4);
+        auto align = (u8)cso[21];
+        auto blocks = (total + blockSize - 1) / blockSize;
+        image.assign(total, 0);
+        
+        for (u64 block = 0; block < blocks; ++block)
+        {
+            auto entry = read32(cso.data() + 0x18 + block * 4);
+            auto start = (u64)(entry & 0x7FFFFFFF) << align;
+            auto end = (u64)(read32(cso.data() + 0x18 + (block + 1) * 4) & 0x7FFFFFFF) << align;
+            auto want = (uInt)std::min<u64>(blockSize, total - block * blockSize);
+            
+            if (start > end || end > cso.size())
+            {
+                return false;
+            }
+            
+            if (entry & 0x80000000)
+            {
+                std::memcpy(image.data() + block * blockSize, cso.data() + start, want);
+                continue;
+            }
+            
+            z_stream stream = {};
+            inflateInit2(&stream, -15);
+            stream.next_in = (Bytef *)cso.data() + start;
+            stream.avail_in = (uInt)(end - start);
+            stream.next_out = (Bytef *)image.data() + block * blockSize;
+            stream.avail_out = want;
+            inflate(&stream, Z_FINISH);
+            inflateEnd(&stream);
+            
+            if (stream.avail_out != 0)
+            {
+                return false;
+            }
+        }
+        
+        return true;
+    }
+    
+    bool checkImage(const std::vector<char>& image, const std::vector<char>& module, const std::string& text)
+    {
+        std::vector<char> packed, readme;
+        PackedExec unpacked;
+        
+        auto ok = check(findFile(image, "MODULE.PRX;1", packed) && packed.size() > 4 && std::memcmp(packed.data(), "~PSP", 4) == 0, "  module inside is packed");
+        ok &= check(unpack_executable(packed.data(), packed.size(), unpacked) == NO_ERROR, "  module unpacks");
+        
+        auto elf = joinSegments(unpacked);
+        ok &= check(elf.size() == module.size() && countDifferences(elf, module) <= 2, "  module unpacks to the original");
+        ok &= check(findFile(image, "README.TXT;1", readme) && std::string(readme.begin(), readme.end()) == text, "  other file untouched");
+        return ok;
+    }
+}
+
+int main(void)
+{
+    auto directory = makeTestDirectory("cso");
+    std::vector<char> module;
+    
+    if (directory.empty() || !corpusModule(directory, { "module.prx", EXECUTABLE_TYPE_USER_PRX, 256 << 10, 2, 0, 1 }, module))
+    {
+        std::printf("could not write the inputs\n");
+        return 1;
+    }
+    
+    std::string text;
+    
+    for (auto i = 0; i < 200; ++i)
+    {
+        text += "not a module, line " + std::to_string(i) + "\n";
+    }
+    
+    auto iso = buildIso(module, text);
+    auto isoPath = directory + "/image.iso", csoPath = directory + "/image.cso";
+    auto cso = writeCso(iso);
+    auto ok = check(writeTestFile(isoPath, iso.data(), iso.size()) && writeTestFile(csoPath, cso.data(), cso.size()), "images written");
+    
+    ThreadPool pool(2);
+    ImageResult isoResult, csoResult;
+    
+    std::printf("iso\n");
+    ok &= check(pack_image(isoPath, pool, default_psp_tag, default_oe_tag, PackOptions(), isoResult) == NO_ERROR && !isoResult.compressed, "  packed");
+    ok &= check(isoResult.modules.size() == 1 && isoResult.modules[0].error == NO_ERROR && !isoResult.modules[0].skipped, "  one module found");
+    
+    std::vector<char> packedIso;
+    ok &= readTestFile(isoPath, packedIso) && checkImage(packedIso, module, text);
+    
+    std::printf("cso\n");
+    ok &= check(pack_image(csoPath, pool, default_psp_tag, default_oe_tag, PackOptions(), csoResult) == NO_ERROR && csoResult.compressed, "  packed");
+    ok &= check(csoResult.modules.size() == 1 && csoResult.modules[0].error == NO_ERROR, "  one module found");
+    
+    std::vector<char> packedCso, inflated;
+    ok &= check(readTestFile(csoPath, packedCso) && readCso(packedCso, inflated), "  written back as a CSO");
+    ok &= check(inflated.size() == packedIso.size(), "  same size as the packed ISO");
+    ok &= checkImage(inflated, module, text);
+    
+    // the module in it is packed now, so only the image has to read back
+    ImageResult again;
+    ok &= check(pack_image(csoPath, pool, default_psp_tag, default_oe_tag, PackOptions(), again) == NO_ERROR && again.compressed, "  written CSO reads back");
+    
+    // headers claiming more than the index can describe are refused
+    // without inflating anything
+    std::printf("bad headers\n");
+    auto badPath = directory + "/bad.cso";
+    
+    auto bad = cso;
+    u32 hugeBlock = 1u << 30;
+    std::memcpy(bad.data() + 16, &hugeBlock, 4);
+    ImageResult badResult;
+    ok &= check(writeTestFile(badPath, bad.data(), bad.size()) && pack_image(badPath, pool, default_psp_tag, default_oe_tag, PackOptions(), badResult) == ERROR_BAD_IMAGE, "  huge block size refused");
+    
+    bad = cso;
+    u64 hugeTotal = (u64)bad.size() * SECTOR;
+    std::memcpy(bad.data() + 8, &hugeTotal, 8);
+    ok &= check(writeTestFile(badPath, bad.data(), bad.size()) && pack_image(badPath, pool, default_psp_tag, default_oe_tag, PackOptions(), badResult) == ERROR_BAD_IMAGE, "  huge image size refused");
+    
+    std::vector<char> unchanged;
+    ok &= check(readTestFile(badPath, unchanged) && unchanged == bad, "  file left alone");
+    
+    unlink(badPath.c_str());
+    unlink(isoPath.c_str());
+    unlink(csoPath.c_str());
+    rmdir(directory.c_str());
+    return ok ? 0 : 1;
+}
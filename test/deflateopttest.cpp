@@ -0,0 +1,126 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#include "deflateopt.h"
+
+#include <zlib.h>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace
+{
+    bool inflateRaw(const std::vector<u8> &packed, std::vector<u8> &out, u32 size)
+    {
+        z_stream stream = {};
+        
+        if (inflateInit2(&stream, -15) != Z_OK)
+            return false;
+        
+        out.assign(size + 1, 0);
+        stream.next_in = (Bytef *)packed.data();
+        stream.avail_in = (uInt)packed.size();
+        stream.next_out = out.data();
+        stream.avail_out = (uInt)out.size();
+        
+        int res = inflate(&stream, Z_FINISH);
+        out.resize(stream.total_out);
+        inflateEnd(&stream);
+        return res == Z_STREAM_END;
+    }
+    
+    // packs 'data' with the optimal encoder, checks the first block is of the
+    // type expected and that zlib gives the input back
+    bool roundTrip(const char *name, const std::vector<u8> &data, int blockType)
+    {
+        std::vector<u8> packed(data.size() * 2 + 64), unpacked;
+        int size = deflateOptimal(packed.data(), (u32)packed.size(), data.data(), (u32)data.size(), nullptr, 0, 1);
+        
+        if (size < 0)
+        {
+            std::printf("%s: deflateOptimal failed (%d)\n", name, size);
+            return false;
+        }
+        
+        packed.resize(size);
+        
+        if (blockType >= 0 && ((packed[0] >> 1) & 3) != blockType)
+        {
+            std::printf("%s: first block is type %d, not %d\n", name, (packed[0] >> 1) & 3, blockType);
+            return false;
+        }
+        
+        if (!inflateRaw(packed, unpacked, (u32)data.size()) || unpacked != data)
+        {
+            std::printf("%s: inflate does not give the input back\n", name);
+            return false;
+        }
+        
+        std::printf("%s: %u -> %d bytes\n", name, (unsigned)data.size(), size);
+        return true;
+    }
+}
+
+int main(void)
+{
+    std::vector<u8> data;
+    bool ok = true;
+    
+    // short and repetitive enough for the fixed code, with literals from the
+    // 9 bit range 0x90-0xFF
+    std::string text;
+    
+    for (int i = 0; i < 6; i++)
+        text += "module \x90\xA7\xC3\xFF start ";
+    
+    data.assign(text.begin(), text.end());
+    ok &= roundTrip("fixed, high literals", data, 1);
+    
+    // every byte value once, then repeated so that matches follow
+    data.clear();
+    
+    for (int i = 0; i < 256; i++)
+        data.push_back((u8)i);
+    
+    for (int i = 0; i < 64; i++)
+        data.push_back((u8)(0x90 + (i * 7) % 0x70));
+    
+    ok &= roundTrip("fixed, every literal", data, -1);
+    
+    // several blocks on dynamic codes
+    data.clear();
+    u32 seed = 1;
+    
+    for (int i = 0; i < 200000; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        data.push_back((u8)((seed >> 16) % 24 + ((i & 1024) ? (0xE0) : (0x40))));
+    }
+    
+    ok &= roundTrip("dynamic", data, 2);
+    
+    return ok ? 0 : 1;
+}
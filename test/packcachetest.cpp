@@ -0,0 +1,136 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#include "packcache.h"
+#include "testfiles.h"
+
+#include <ctime>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <utime.h>
+
+// packs a module through a cache twice and checks the second time is a hit
+// with the same output, that a damaged entry is a miss rather than a bad
+// module, and that trimming evicts entries and stale temp files but leaves
+// a temp file another process may still be writing.
+namespace
+{
+    bool exists(const std::string& path)
+    {
+        struct stat st;
+        return stat(path.c_str(), &st) == 0;
+    }
+    
+    size_t countEntries(const std::string& directory)
+    {
+        size_t count = 0;
+        auto dir = opendir(directory.c_str());
+        
+        while (auto entry = (dir) ? (readdir(dir)) : (nullptr))
+        {
+            auto name = std::string(entry->d_name);
+            count += (name.size() > 4 && name.compare(name.size() - 4, 4, ".psc") == 0);
+        }
+        
+        if (dir)
+        {
+            closedir(dir);
+        }
+        
+        return count;
+    }
+}
+
+int main(void)
+{
+    auto directory = makeTestDirectory("cache");
+    std::vector<char> input, first, second, third;
+    
+    if (directory.empty() || !corpusModule(directory, { "cached.prx", EXECUTABLE_TYPE_USER_PRX, 256 << 10, 2, 0, 1 }, input))
+    {
+        std::printf("could not write the input\n");
+        return 1;
+    }
+    
+    auto cacheDirectory = directory + "/cache";
+    PackCache cache;
+    auto ok = check(cache.open(cacheDirectory, 1ull << 30), "cache opened");
+    
+    PackOptions options;
+    options.cache = &cache;
+    options.reproducible = true;
+    
+    PackInfo firstInfo, secondInfo, thirdInfo;
+    ok &= check(packModule(input, options, first, &firstInfo) && !firstInfo.cacheHit, "first pack misses");
+    ok &= check(cache.stores() == 1 && countEntries(cacheDirectory) == 1, "entry stored");
+    ok &= check(packModule(input, options, second, &secondInfo) && secondInfo.cacheHit, "second pack hits");
+    ok &= check(first == second, "hit gives the same module");
+    
+    // flip a byte of the payload, the entry's crc has to catch it
+    auto dir = opendir(cacheDirectory.c_str());
+    std::string entry;
+    
+    while (auto item = (dir) ? (readdir(dir)) : (nullptr))
+    {
+        if (item->d_name[0] != '.')
+        {
+            entry = cacheDirectory + "/" + item->d_name;
+        }
+    }
+    
+    if (dir)
+    {
+        closedir(dir);
+    }
+    
+    std::vector<char> data;
+    ok &= check(readTestFile(entry, data) && data.size() > 16, "entry read");
+    data[data.size() - 16] ^= 0x55;
+    ok &= check(writeTestFile(entry, data.data(), data.size()), "entry damaged");
+    ok &= check(packModule(input, options, third, &thirdInfo) && !thirdInfo.cacheHit && third == first, "damaged entry misses and repacks");
+    
+    // one temp file being written now and one left by a crash long ago
+    auto fresh = cacheDirectory + "/0000000000000001.psc.AbCdEf";
+    auto stale = cacheDirectory + "/0000000000000002.psc.GhIjKl";
+    ok &= check(writeTestFile(fresh, "x", 1) && writeTestFile(stale, "x", 1), "temp files written");
+    
+    struct utimbuf times;
+    times.actime = times.modtime = std::time(nullptr) - 24 * 60 * 60;
+    utime(stale.c_str(), &times);
+    
+    PackCache small;
+    small.open(cacheDirectory, 0);
+    small.trim();
+    
+    ok &= check(countEntries(cacheDirectory) == 0, "trim evicts entries");
+    ok &= check(exists(fresh), "trim keeps a fresh temp file");
+    ok &= check(!exists(stale), "trim removes a stale temp file");
+    
+    unlink(fresh.c_str());
+    rmdir(cacheDirectory.c_str());
+    rmdir(directory.c_str());
+    return ok ? 0 : 1;
+}
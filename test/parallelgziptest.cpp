@@ -0,0 +1,121 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#include "parallelgzip.h"
+#include "threadpool.h"
+#include "testfiles.h"
+
+#include <zlib.h>
+
+#include <unistd.h>
+
+// compresses each corpus module serially and in parallel blocks on pools of
+// several sizes, and checks every stream inflates to the same bytes as the
+// serial one. the parallel streams should also match each other exactly.
+namespace
+{
+    bool inflateGzip(const char *data, size_t size, std::vector<char>& out, size_t expected)
+    {
+        z_stream stream = {};
+        
+        if (inflateInit2(&stream, 16 + 15) != Z_OK)
+        {
+            return false;
+        }
+        
+        out.assign(expected + 1, 0);
+        stream.next_in = (Bytef *)data;
+        stream.avail_in = (uInt)size;
+        stream.next_out = (Bytef *)out.data();
+        stream.avail_out = (uInt)out.size();
+        
+        auto res = inflate(&stream, Z_FINISH);
+        out.resize(stream.total_out);
+        inflateEnd(&stream);
+        return res == Z_STREAM_END && stream.avail_in == 0;
+    }
+}
+
+int main(void)
+{
+    auto directory = makeTestDirectory("parallel");
+    
+    if (directory.empty())
+    {
+        std::printf("could not make a directory\n");
+        return 1;
+    }
+    
+    const CorpusSpec corpus[] =
+    {
+        { "user_small.prx", EXECUTABLE_TYPE_USER_PRX, 20 << 10, 1, 0, 1 },
+        { "user_3m.prx", EXECUTABLE_TYPE_USER_PRX, 3 << 20, 3, 0, 2 },
+        { "kernel_1m.prx", EXECUTABLE_TYPE_KERNEL_PRX, 1 << 20, 2, 0, 3 },
+    };
+    
+    auto ok = true;
+    GzipParams params;
+    gzipDefaultParams(&params);
+    params.level = 6;
+    
+    for (auto& spec : corpus)
+    {
+        std::vector<char> input, serial, serialOut;
+        
+        if (!check(corpusModule(directory, spec, input), spec.name))
+        {
+            ok = false;
+            continue;
+        }
+        
+        serial.resize(gzipGetMaxCompressedSize((int)input.size()));
+        auto serialSize = gzipCompressWithParams(serial.data(), (u32)serial.size(), input.data(), (u32)input.size(), &params);
+        ok &= check(serialSize > 0 && inflateGzip(serial.data(), serialSize, serialOut, input.size()) && serialOut == input, "  serial round trip");
+        
+        std::vector<char> first;
+        
+        for (auto threads : { 1u, 2u, 4u })
+        {
+            ThreadPool pool(threads);
+            std::vector<char> parallel(gzipGetMaxCompressedSize((int)input.size())), parallelOut;
+            auto size = gzipCompressParallel(pool, parallel.data(), (u32)parallel.size(), input.data(), (u32)input.size(), &params);
+            
+            std::printf("  %u threads: %d bytes, serial %d\n", threads, size, serialSize);
+            ok &= check(size > 0 && inflateGzip(parallel.data(), size, parallelOut, input.size()) && parallelOut == serialOut, "  parallel inflates to the serial output");
+            
+            parallel.resize((size > 0) ? (size) : (0));
+            
+            if (first.empty())
+            {
+                first = parallel;
+            }
+            
+            ok &= check(parallel == first, "  same stream on any number of threads");
+        }
+    }
+    
+    rmdir(directory.c_str());
+    return ok ? 0 : 1;
+}
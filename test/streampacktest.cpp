@@ -0,0 +1,169 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#include "streampack.h"
+#include "unpack.h"
+#include "testfiles.h"
+
+#include <thread>
+
+// packs corpus modules through pack_stream, to a seekable file and to a
+// pipe, and checks both unpack to the same ELF as the module packed from a
+// file in memory, with the same packed size.
+namespace
+{
+    bool packToFile(const std::string& path, std::vector<char>& packed)
+    {
+        auto input = std::fopen(path.c_str(), "rb");
+        auto output = std::tmpfile();
+        size_t size = 0;
+        auto ok = input && output && pack_stream(input, output, default_psp_tag, default_oe_tag, PackOptions(), &size) == NO_ERROR;
+        
+        if (ok)
+        {
+            packed.resize(size);
+            std::rewind(output);
+            ok = std::fread(packed.data(), 1, size, output) == size && std::fgetc(output) == EOF;
+        }
+        
+        if (input)
+        {
+            std::fclose(input);
+        }
+        
+        if (output)
+        {
+            std::fclose(output);
+        }
+        
+        return ok;
+    }
+    
+    // the output can't seek, so pack_stream has to measure the module first
+    bool packToPipe(const std::string& path, std::vector<char>& packed)
+    {
+        int fds[2];
+        
+        if (pipe(fds) != 0)
+        {
+            return false;
+        }
+        
+        packed.clear();
+        std::thread reader([&packed, fds]()
+        {
+            char buffer[64 * 1024];
+            ssize_t res;
+            
+            while ((res = read(fds[0], buffer, sizeof(buffer))) > 0)
+            {
+                packed.insert(packed.end(), buffer, buffer + res);
+            }
+            
+            close(fds[0]);
+        });
+        
+        auto input = std::fopen(path.c_str(), "rb");
+        auto output = fdopen(fds[1], "wb");
+        size_t size = 0;
+        auto ok = input && output && pack_stream(input, output, default_psp_tag, default_oe_tag, PackOptions(), &size) == NO_ERROR;
+        
+        if (input)
+        {
+            std::fclose(input);
+        }
+        
+        if (output)
+        {
+            std::fclose(output);
+        }
+        else
+        {
+            close(fds[1]);
+        }
+        
+        reader.join();
+        return ok && packed.size() == size;
+    }
+    
+    bool unpackModule(const std::vector<char>& packed, std::vector<char>& elf)
+    {
+        PackedExec unpacked;
+        
+        if (unpack_executable(packed.data(), packed.size(), unpacked) != NO_ERROR)
+        {
+            return false;
+        }
+        
+        elf = joinSegments(unpacked);
+        return true;
+    }
+}
+
+int main(void)
+{
+    auto directory = makeTestDirectory("stream");
+    
+    if (directory.empty())
+    {
+        std::printf("could not make a directory\n");
+        return 1;
+    }
+    
+    const CorpusSpec corpus[] =
+    {
+        { "user.prx", EXECUTABLE_TYPE_USER_PRX, 256 << 10, 2, 0, 1 },
+        { "eboot.pbp", EXECUTABLE_TYPE_PBP, 256 << 10, 3, 3 << 20, 2 },
+    };
+    
+    auto ok = true;
+    
+    for (auto& spec : corpus)
+    {
+        auto path = directory + "/" + spec.name;
+        std::vector<char> input, fromMemory, toFile, toPipe, expected, elf;
+        
+        if (!check(writeCorpusFile(path, spec) && readTestFile(path, input), spec.name))
+        {
+            ok = false;
+            continue;
+        }
+        
+        ok &= check(packModule(input, PackOptions(), fromMemory) && unpackModule(fromMemory, expected), "  packed from memory");
+        
+        ok &= check(packToFile(path, toFile), "  streamed to a file");
+        ok &= check(toFile.size() == fromMemory.size(), "  same size as from memory");
+        ok &= check(unpackModule(toFile, elf) && elf == expected, "  unpacks to the same module");
+        
+        ok &= check(packToPipe(path, toPipe), "  streamed to a pipe");
+        ok &= check(toPipe.size() == fromMemory.size(), "  same size as from memory");
+        ok &= check(unpackModule(toPipe, elf) && elf == expected, "  unpacks to the same module");
+        
+        unlink(path.c_str());
+    }
+    
+    rmdir(directory.c_str());
+    return ok ? 0 : 1;
+}
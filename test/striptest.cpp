@@ -0,0 +1,171 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#include "elf.h"
+#include "elfstrip.h"
+#include "unpack.h"
+#include "testfiles.h"
+
+#include <cstring>
+
+// adds a debug section to a corpus module and packs it with and without
+// --strip. the stripped module has to come out smaller, without the debug
+// section, and with every segment and the relocations exactly as they were.
+namespace
+{
+    const u32 DEBUG_SIZE = 96 * 1024;
+    
+    // append a .debug_info section and move the names and section headers
+    // behind it, as a toolchain leaving debug information would
+    void addDebugSection(std::vector<char>& elf)
+    {
+        auto ehdr = *(Elf32_Ehdr *)elf.data();
+        std::vector<Elf32_Shdr> sections(ehdr.e_shnum);
+        std::memcpy(sections.data(), elf.data() + ehdr.e_shoff, ehdr.e_shnum * sizeof(Elf32_Shdr));
+        
+        auto& names = sections[ehdr.e_shstrndx];
+        std::string table(elf.data() + names.sh_offset, names.sh_size);
+        auto debugName = (u32)table.size();
+        table.append(".debug_info", sizeof(".debug_info"));
+        
+        elf.resize(ehdr.e_shoff);
+        auto debugOffset = (u32)elf.size();
+        u32 seed = 7;
+        
+        for (u32 i = 0; i < DEBUG_SIZE; ++i)
+        {
+            seed = seed * 1103515245 + 12345;
+            elf.push_back((char)((seed >> 16) & 0x3F));
+        }
+        
+        names.sh_offset = (u32)elf.size();
+        names.sh_size = (u32)table.size();
+        elf.insert(elf.end(), table.begin(), table.end());
+        
+        while (elf.size() % 4)
+        {
+            elf.push_back(0);
+        }
+        
+        Elf32_Shdr debug = { debugName, 1, 0, 0, debugOffset, DEBUG_SIZE, 0, 0, 1, 0 };
+        sections.push_back(debug);
+        
+        auto shoff = (u32)elf.size();
+        elf.insert(elf.end(), (const char *)sections.data(), (const char *)(sections.data() + sections.size()));
+        
+        auto header = (Elf32_Ehdr *)elf.data();
+        header->e_shoff = shoff;
+        header->e_shnum = (u16)sections.size();
+    }
+    
+    bool hasSection(const std::vector<char>& elf, const char *name)
+    {
+        auto ehdr = (const Elf32_Ehdr *)elf.data();
+        auto sections = (const Elf32_Shdr *)(elf.data() + ehdr->e_shoff);
+        auto names = elf.data() + sections[ehdr->e_shstrndx].sh_offset;
+        
+        for (auto i = 0; i < ehdr->e_shnum; ++i)
+        {
+            if (std::strcmp(names + sections[i].sh_name, name) == 0)
+            {
+                return true;
+            }
+        }
+        
+        return false;
+    }
+    
+    // every segment's bytes the same, bar the module info attribute bits
+    bool sameSegments(const std::vector<char>& original, const std::vector<char>& stripped)
+    {
+        auto ehdr = (const Elf32_Ehdr *)original.data();
+        
+        if (std::memcmp(original.data() + ehdr->e_phoff, stripped.data() + ehdr->e_phoff, ehdr->e_phnum * sizeof(Elf32_Phdr)) != 0)
+        {
+            return false;
+        }
+        
+        auto phdrs = (const Elf32_Phdr *)(original.data() + ehdr->e_phoff);
+        size_t differences = 0;
+        
+        for (auto i = 0; i < ehdr->e_phnum; ++i)
+        {
+            if (phdrs[i].p_offset + phdrs[i].p_filesz > stripped.size())
+            {
+                return false;
+            }
+            
+            for (u32 j = 0; j < phdrs[i].p_filesz; ++j)
+            {
+                differences += (original[phdrs[i].p_offset + j] != stripped[phdrs[i].p_offset + j]);
+            }
+        }
+        
+        return differences <= 2;
+    }
+}
+
+int main(void)
+{
+    auto directory = makeTestDirectory("strip");
+    std::vector<char> input, plain;
+    
+    if (directory.empty() || !corpusModule(directory, { "debug.prx", EXECUTABLE_TYPE_USER_PRX, 256 << 10, 3, 0, 1 }, input)
+        || !corpusModule(directory, { "plain.prx", EXECUTABLE_TYPE_USER_PRX, 64 << 10, 3, 0, 2 }, plain))
+    {
+        std::printf("could not write the inputs\n");
+        return 1;
+    }
+    
+    rmdir(directory.c_str());
+    addDebugSection(input);
+    
+    PackOptions options;
+    options.reproducible = true;
+    
+    std::vector<char> full, stripped;
+    PackInfo fullInfo, strippedInfo;
+    auto ok = check(packModule(input, options, full, &fullInfo) && fullInfo.strippedSize == 0, "packed without --strip");
+    
+    options.strip = true;
+    ok &= check(packModule(input, options, stripped, &strippedInfo), "packed with --strip");
+    ok &= check(strippedInfo.strippedSize >= DEBUG_SIZE, "debug section counted as stripped");
+    ok &= check(stripped.size() < full.size(), "stripped module is smaller");
+    
+    PackedExec unpacked;
+    ok &= check(verify_packed_executable(stripped.data(), stripped.size()) == NO_ERROR, "stripped module verifies");
+    ok &= check(unpack_executable(stripped.data(), stripped.size(), unpacked) == NO_ERROR, "stripped module unpacks");
+    
+    auto elf = joinSegments(unpacked);
+    ok &= check(elf.size() + DEBUG_SIZE <= input.size(), "unpacked ELF lost the debug section's bytes");
+    ok &= check(!hasSection(elf, ".debug_info") && hasSection(elf, ".rel.text") && hasSection(elf, ".rodata.sceModuleInfo"), "sections the loader needs kept, debug dropped");
+    ok &= check(sameSegments(input, elf), "segments unchanged");
+    
+    // nothing to drop in a module without debug information
+    ExecBuffer output;
+    ok &= check(strip_elf(plain.data(), plain.size(), output) && output.size() <= plain.size(), "module without debug information");
+    
+    return ok ? 0 : 1;
+}
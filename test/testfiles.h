@@ -0,0 +1,136 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#ifndef TESTFILES_H_
+#define TESTFILES_H_
+
+#include "corpus.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+// a fresh directory under /tmp, empty if it couldn't be made
+inline std::string makeTestDirectory(const char *name)
+{
+    auto path = std::string("/tmp/psp-packer-") + name + "-XXXXXX";
+    return (mkdtemp(&path[0]) != nullptr) ? (path) : (std::string());
+}
+
+inline bool readTestFile(const std::string& path, std::vector<char>& data)
+{
+    auto file = std::fopen(path.c_str(), "rb");
+    
+    if (file == nullptr)
+    {
+        return false;
+    }
+    
+    data.clear();
+    char buffer[64 * 1024];
+    size_t res;
+    
+    while ((res = std::fread(buffer, 1, sizeof(buffer), file)) != 0)
+    {
+        data.insert(data.end(), buffer, buffer + res);
+    }
+    
+    std::fclose(file);
+    return true;
+}
+
+inline bool writeTestFile(const std::string& path, const void *data, size_t size)
+{
+    auto file = std::fopen(path.c_str(), "wb");
+    
+    if (file == nullptr)
+    {
+        return false;
+    }
+    
+    auto ok = std::fwrite(data, 1, size, file) == size;
+    return (std::fclose(file) == 0) && ok;
+}
+
+// a corpus module in memory, written out through 'directory'
+inline bool corpusModule(const std::string& directory, const CorpusSpec& spec, std::vector<char>& data)
+{
+    auto path = directory + "/" + spec.name;
+    auto ok = writeCorpusFile(path, spec) && readTestFile(path, data);
+    unlink(path.c_str());
+    return ok;
+}
+
+// pack_executable_buffer into 'packed', false on any error
+inline bool packModule(const std::vector<char>& input, const PackOptions& options, std::vector<char>& packed, PackInfo *info = nullptr)
+{
+    size_t size = 0;
+    packed.resize(pack_executable_bound(input.data(), input.size()));
+    
+    if (packed.empty() || pack_executable_buffer(input.data(), input.size(), packed.data(), packed.size(), size, default_psp_tag, default_oe_tag, options, info) != NO_ERROR)
+    {
+        return false;
+    }
+    
+    packed.resize(size);
+    return true;
+}
+
+// the segments of a packed or unpacked executable joined up
+inline std::vector<char> joinSegments(const PackedExec& exec)
+{
+    std::vector<char> data;
+    
+    for (auto& segment : exec.segments)
+    {
+        data.insert(data.end(), segment.data, segment.data + segment.size);
+    }
+    
+    return data;
+}
+
+// bytes that differ, for comparing unpacked modules with their input.
+// packing may set attribute bits in the module info, so a couple can.
+inline size_t countDifferences(const std::vector<char>& a, const std::vector<char>& b)
+{
+    size_t count = 0;
+    
+    for (size_t i = 0; i < a.size() && i < b.size(); ++i)
+    {
+        count += (a[i] != b[i]);
+    }
+    
+    return count;
+}
+
+inline bool check(bool ok, const char *what)
+{
+    std::printf("%s: %s\n", what, ok ? "ok" : "FAILED");
+    return ok;
+}
+
+#endif // TESTFILES_H_
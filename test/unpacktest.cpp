@@ -0,0 +1,102 @@
+/*
+
+Copyright (C) 2015, David "Davee" Morgan 
+
+Permission is hereby granted, free of charge, to any person obtaining a 
+copy of this software and associated documentation files (the "Software"), 
+to deal in the Software without restriction, including without limitation 
+the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+and/or sell copies of the Software, and to permit persons to whom the 
+Software is furnished to do so, subject to the following conditions: 
+
+The above copyright notice and this permission notice shall be included in 
+all copies or substantial portions of the Software. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL 
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+DEALINGS IN THE SOFTWARE. 
+
+
+ */
+
+#include "unpack.h"
+#include "psp.h"
+#include "testfiles.h"
+
+// packs corpus modules of every type, serially and in parallel blocks, and
+// checks unpacking gives the input back
+int main(void)
+{
+    auto directory = makeTestDirectory("unpack");
+    
+    if (directory.empty())
+    {
+        std::printf("could not make a directory\n");
+        return 1;
+    }
+    
+    const CorpusSpec corpus[] =
+    {
+        { "user.prx", EXECUTABLE_TYPE_USER_PRX, 256 << 10, 2, 0, 1 },
+        { "kernel.prx", EXECUTABLE_TYPE_KERNEL_PRX, 512 << 10, 3, 0, 2 },
+        { "eboot.pbp", EXECUTABLE_TYPE_PBP, 384 << 10, 2, 200 << 10, 3 },
+    };
+    
+    auto ok = true;
+    
+    for (auto& spec : corpus)
+    {
+        std::vector<char> input;
+        
+        if (!check(corpusModule(directory, spec, input), spec.name))
+        {
+            ok = false;
+            continue;
+        }
+        
+        for (auto threads : { 0u, 2u })
+        {
+            PackOptions options;
+            options.compressThreads = threads;
+            
+            std::vector<char> packed;
+            PackedExec unpacked;
+            std::printf("  %u threads\n", threads);
+            
+            ok &= check(packModule(input, options, packed), "  packed");
+            ok &= check(verify_packed_executable(packed.data(), packed.size()) == NO_ERROR, "  verifies");
+            ok &= check(unpack_executable(packed.data(), packed.size(), unpacked) == NO_ERROR, "  unpacked");
+            
+            auto output = joinSegments(unpacked);
+            ok &= check(output.size() == input.size() && countDifferences(output, input) <= 2, "  unpacks to the input");
+            
+            PackedExec again;
+            ok &= check(unpack_executable(output.data(), output.size(), again) == ERROR_NOT_PACKED, "  the unpacked module isn't packed");
+        }
+        
+        std::vector<char> packed;
+        PackedExec unpacked;
+        
+        if (packModule(input, PackOptions(), packed))
+        {
+            // an elf_size deflate couldn't reach from comp_size must be
+            // rejected before anything is allocated for it
+            auto forged = packed;
+            auto offset = (spec.type == EXECUTABLE_TYPE_PBP) ? (((PbpHeader *)forged.data())->prx_offset) : (0);
+            ((PSP_Header *)(forged.data() + offset))->elf_size = 0x7FFFFF00;
+            ok &= check(unpack_executable(forged.data(), forged.size(), unpacked) == ERROR_CORRUPT_PACKED, "  impossible elf_size rejected");
+            ok &= check(verify_packed_executable(forged.data(), forged.size()) == ERROR_CORRUPT_PACKED, "  impossible elf_size fails verification");
+            
+            // cut off inside the compressed module, which must fail cleanly
+            packed.resize(packed.size() / 3);
+            ok &= check(unpack_executable(packed.data(), packed.size(), unpacked) != NO_ERROR, "  truncated module rejected");
+        }
+    }
+    
+    rmdir(directory.c_str());
+    return ok ? 0 : 1;
+}